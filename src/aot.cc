@@ -0,0 +1,78 @@
+#include "include/aot.h"
+#include "include/profiler.h"
+
+#include <algorithm>
+
+namespace {
+
+// a function local, generated files register before main and in no
+// particular order
+std::vector<const AotModule*>& registry() {
+    static std::vector<const AotModule*> modules;
+    return modules;
+}
+
+}
+
+bool register_aot_module(const AotModule& module) {
+    registry().push_back(&module);
+    return true;
+}
+
+const std::vector<const AotModule*>& aot_modules() {
+    return registry();
+}
+
+u16 Aot::stale_pages_of(const AotModule& module, const Chip8& c8, const u16 pages) {
+    const u8* memory = AotAccess::memory(c8);
+    u16 stale = 0;
+    for (const AotRange& range : module.code) {
+        for (u32 address = range.first; address < range.last; address++) {
+            const u16 page = 1 << (address / Chip8::page_size);
+            if (!(pages & page) || (stale & page)) continue;
+            if (memory[address] != module.program[address - Chip8::program_start]) {
+                stale |= page;
+            }
+        }
+    }
+    return stale;
+}
+
+void Aot::revalidate(const Chip8& c8, const u16 pages) {
+    // a program or profile got loaded, find the module that goes with it
+    if (pages == 0xFFFF || !current) {
+        current = nullptr;
+        stale_pages = 0;
+        for (const AotModule* module : aot_modules()) {
+            if (module->quirks == c8.quirks() && !stale_pages_of(*module, c8, 0xFFFF)) {
+                current = module;
+                return;
+            }
+        }
+        return;
+    }
+    stale_pages = (stale_pages & ~pages) | stale_pages_of(*current, c8, pages);
+}
+
+u64 Aot::run(Chip8& c8, u64 budget) {
+    u64 executed = 0;
+    // once the module gave up, only a jump, call, return or skip can bring pc
+    // to the start of a block again
+    bool at_block = true;
+    while (executed < budget && !c8.halted()) {
+        if (const u16 pages = c8.take_written_pages()) {
+            revalidate(c8, pages);
+        }
+        if (at_block && current && !profiling(c8)) {
+            if (const u64 ran = current->run(c8, budget - executed, stale_pages)) {
+                executed += ran;
+                continue;
+            }
+        }
+        const u16 pc = c8.pc();
+        c8.run_cycle();
+        executed++;
+        at_block = c8.pc() != pc + 2;
+    }
+    return executed;
+}
@@ -0,0 +1,333 @@
+#include <algorithm>
+#include <filesystem>
+#include <set>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "include/block_cache.h"
+#include "include/busy_loop.h"
+#include "include/chip8.h"
+#include "include/disassembler.h"
+#include "include/quirks.h"
+#include "include/rom.h"
+
+// compiles a ROM ahead of time into a C++ file for the aot engine, see
+// aot.h. list the ROM in CHIP8_AOT_ROMS and the build does it for you.
+
+void print_usage() {
+    std::cout << "Example usage: \n";
+    std::cout << "./chip8_aot [--quirks=legacy|cosmac|schip|xochip] [--disassemble] <rom_path> [out.cc]\n";
+    std::cout << "writes the C++ to out.cc, or to stdout without it\n";
+    std::cout << "--quirks defaults to the profile the ROM's instructions need\n";
+    std::cout << "--disassemble lists the basic blocks instead\n";
+}
+
+namespace {
+
+std::string hex(const unsigned value, const int width = 3) {
+    std::ostringstream out;
+    out << "0x" << std::hex << std::uppercase << std::setw(width) << std::setfill('0') << value;
+    return out.str();
+}
+
+// pages [first, last) touches, one bit each like Chip8's written pages
+u16 pages_of(const u32 first, const u32 last) {
+    u16 pages = 0;
+    for (u32 page = first / Chip8::page_size; page <= (last - 1) / Chip8::page_size; page++) {
+        pages |= 1 << page;
+    }
+    return pages;
+}
+
+// the handler's body in terms of the run function's v, i and pc, for the
+// instructions worth inlining. has to do exactly what the handler does, see
+// instructions in chip8.cc. empty for anything else.
+std::string inline_body(const CallBack handler, const OpcodeFields& fields, const u16 address) {
+    const std::string x = "v[" + std::to_string(fields.x) + "]";
+    const std::string y = "v[" + std::to_string(fields.y) + "]";
+    const std::string kk = hex(fields.kk, 2);
+    const std::string skip = " ? " + hex(address + 4) + " : " + hex(address + 2) + ";";
+
+    if (handler == Chip8::ld_vx_kk) return x + " = " + kk + ";";
+    if (handler == Chip8::add_vx_kk) return x + " += " + kk + ";";
+    if (handler == Chip8::ld_vx_vy) return x + " = " + y + ";";
+    if (handler == Chip8::or_vx_vy) return x + " |= " + y + ";";
+    if (handler == Chip8::and_vx_vy) return x + " &= " + y + ";";
+    if (handler == Chip8::xor_vx_vy) return x + " ^= " + y + ";";
+    if (handler == Chip8::or_vx_vy_reset_vf) return x + " |= " + y + "; v[15] = 0;";
+    if (handler == Chip8::and_vx_vy_reset_vf) return x + " &= " + y + "; v[15] = 0;";
+    if (handler == Chip8::xor_vx_vy_reset_vf) return x + " ^= " + y + "; v[15] = 0;";
+    if (handler == Chip8::add_vx_vy)
+        return "{ const unsigned res = " + x + " + " + y + "; " + x + " = res & 0xFF; v[15] = res > 0xFF; }";
+    if (handler == Chip8::sub_vx_vy)
+        return "{ const u8 vy = " + y + "; v[15] = " + x + " > vy; " + x + " = " + x + " - vy; }";
+    if (handler == Chip8::shr_vx_vy)
+        return "{ const u8 vy = " + y + "; " + x + " = vy >> 1; v[15] = vy & 0x1; }";
+    if (handler == Chip8::subn_vx_vy) return x + " = " + y + " - " + x + "; v[15] = " + y + " > " + x + ";";
+    if (handler == Chip8::shl_vx_vy)
+        return "{ const u8 vy = " + y + "; " + x + " = vy << 1; v[15] = (vy >> 7) & 0x1; }";
+    if (handler == Chip8::shr_vx)
+        return "{ const u8 out = " + x + " & 0x1; " + x + " >>= 1; v[15] = out; }";
+    if (handler == Chip8::shl_vx)
+        return "{ const u8 out = (" + x + " >> 7) & 0x1; " + x + " <<= 1; v[15] = out; }";
+    if (handler == Chip8::ld_iaddr) return "i = " + hex(fields.nnn) + ";";
+    // the terminators that only move pc
+    if (handler == Chip8::jp_addr) return "pc = " + hex(fields.nnn) + ";";
+    if (handler == Chip8::skip_next_ife_vxkk) return "pc = " + x + " == " + kk + skip;
+    if (handler == Chip8::skip_next_ifne_vxkk) return "pc = " + x + " != " + kk + skip;
+    if (handler == Chip8::skip_next_ife_vxvy) return "pc = " + x + " == " + y + skip;
+    if (handler == Chip8::skip_next_ifne_vx_vy) return "pc = " + x + " != " + y + skip;
+    return {};
+}
+
+// the handlers that store to memory, anything compiled may have been
+// overwritten after them
+bool stores(const CallBack handler) {
+    return handler == Chip8::ld_b_vx || handler == Chip8::ld_i_vx || handler == Chip8::ld_i_vx_keep_i ||
+           handler == Chip8::ld_i_vx_vy;
+}
+
+// the blocks worth compiling: whole, below 4K where the engines watch
+// stores, and not reaching past the end of the ROM with F000's operand
+bool compiled(const BasicBlock& block, const u32 program_end) {
+    return block.end <= 0x1000 && block.end <= program_end;
+}
+
+std::string label(const u16 address) {
+    return "block_" + hex(address).substr(2);
+}
+
+// where a block goes on without a round through the switch: the target of a
+// jump or the block it runs into, when that's compiled too
+std::optional<u16> chained(const Chip8& c8, const ControlFlowGraph& graph, const BasicBlock& block,
+                           const QuirkProfile quirks, const u32 program_end) {
+    const u16 opcode = c8.opcode_at(block.start + 2 * (block.length - 1));
+    const CallBack handler = instruction_tables[static_cast<size_t>(quirks)][opcode].handler;
+    u16 target;
+    if (handler == Chip8::jp_addr) {
+        target = opcode & 0xFFF;
+    } else if (!BlockCache::ends_block(handler) && block.end < 0x1000) {
+        target = block.end;
+    } else {
+        return std::nullopt;
+    }
+    const auto it = graph.blocks.find(target);
+    if (it == graph.blocks.end() || !compiled(it->second, program_end)) return std::nullopt;
+    return target;
+}
+
+void write_block(std::ostream& out, const Chip8& c8, const ControlFlowGraph& graph, const BasicBlock& block,
+                 const QuirkProfile quirks, const u32 program_end, const std::set<u16>& labels) {
+    const std::optional<BusyLoop> loop = BusyLoop::match(c8, block.start);
+    const u32 last = loop ? std::max<u32>(block.end, block.start + 2 * loop->length) : block.end;
+    out << "            case " << hex(block.start) << ":";
+    if (labels.contains(block.start)) out << ' ' << label(block.start) << ':';
+    out << " {\n";
+    out << "                if (budget - executed < " << block.length << " || (stale_pages & "
+        << hex(pages_of(block.start, last), 4) << ")) return executed;\n";
+    if (loop) {
+        out << "                constexpr BusyLoop loop{BusyLoop::Kind::"
+            << (loop->kind == BusyLoop::Kind::delay_timer ? "delay_timer" : "key") << ", "
+            << int(loop->length) << ", " << int(loop->x) << ", " << int(loop->kk) << ", "
+            << (loop->exit_on_match ? "true" : "false") << "};\n";
+        out << "                if (const u64 skipped = loop.fast_forward(c8, " << hex(block.start)
+            << ", budget - executed)) {\n";
+        out << "                    executed += skipped;\n";
+        out << "                    continue;\n";
+        out << "                }\n";
+    }
+
+    const InstructionTable& table = instruction_tables[static_cast<size_t>(quirks)];
+    bool moved_pc = false;
+    bool terminator = false;
+    for (u16 n = 0; n < block.length; n++) {
+        const u16 address = block.start + 2 * n;
+        const u16 opcode = c8.opcode_at(address);
+        const Instruction& instruction = table[opcode];
+        terminator = BlockCache::ends_block(instruction.handler);
+
+        out << "                // " << hex(address) << "  " << disassemble(opcode, quirks) << '\n';
+        const std::string body = inline_body(instruction.handler, instruction.fields, address);
+        if (!body.empty()) {
+            out << "                " << body << '\n';
+            moved_pc = terminator;
+            continue;
+        }
+        // handlers expect pc past the instruction already
+        out << "                pc = " << hex(address + 2) << ";\n";
+        out << "                Chip8::" << handler_name(instruction.handler) << "(c8, OpcodeFields("
+            << hex(opcode, 4) << "));\n";
+        moved_pc = true;
+        // leave before running what it may have overwritten, this block
+        // included
+        if (stores(instruction.handler) && !terminator) {
+            out << "                if (AotAccess::written_pages(c8) & code_pages) return executed + " << n + 1
+                << ";\n";
+        }
+    }
+    // a block that runs into the next one only moved pc when it last called
+    // a handler
+    if (!terminator && !moved_pc) out << "                pc = " << hex(block.end) << ";\n";
+    out << "                executed += " << block.length << ";\n";
+    if (const std::optional<u16> target = chained(c8, graph, block, quirks, program_end)) {
+        out << "                goto " << label(*target) << ";\n";
+    } else {
+        out << "                break;\n";
+    }
+    out << "            }\n";
+}
+
+void write_module(std::ostream& out, const std::string& name, std::span<const u8> program, const QuirkProfile quirks) {
+    auto c8 = std::make_unique<Chip8>();
+    c8->set_quirks(quirks);
+    c8->load_program(program);
+    const ControlFlowGraph graph = recover_control_flow(program, quirks);
+    const u32 program_end = Chip8::program_start + program.size();
+
+    // compiled code as ranges, merged where blocks touch
+    std::vector<std::pair<u32, u32>> code;
+    u16 code_pages = 0;
+    for (const auto& [start, block] : graph.blocks) {
+        if (!compiled(block, program_end)) continue;
+        const std::optional<BusyLoop> loop = BusyLoop::match(*c8, start);
+        const u32 end = loop ? std::max<u32>(block.end, start + 2 * loop->length) : block.end;
+        code_pages |= pages_of(start, end);
+        if (!code.empty() && start <= code.back().second) {
+            code.back().second = std::max(code.back().second, end);
+        } else {
+            code.emplace_back(start, end);
+        }
+    }
+
+    out << "// generated by chip8_aot from " << name << " (" << quirk_profile_name(quirks) << "), don't edit\n";
+    out << "#include \"include/aot.h\"\n\n";
+    out << "namespace {\n\n";
+    out << "constexpr std::array<u8, " << program.size() << "> program = {";
+    for (size_t n = 0; n < program.size(); n++) {
+        out << (n % 12 ? " " : "\n    ") << hex(program[n], 2) << ',';
+    }
+    out << "\n};\n\n";
+    out << "constexpr std::array<AotRange, " << code.size() << "> code = {{";
+    for (const auto& [first, last] : code) {
+        out << "\n    {" << hex(first) << ", " << hex(last) << "},";
+    }
+    out << "\n}};\n\n";
+    out << "constexpr u16 code_pages = " << hex(code_pages, 4) << ";\n\n";
+
+    out << "u64 run(Chip8& c8, const u64 budget, const u16 stale_pages) {\n";
+    out << "    [[maybe_unused]] u8* const v = AotAccess::registers(c8);\n";
+    out << "    [[maybe_unused]] u16& pc = AotAccess::pc(c8);\n";
+    out << "    [[maybe_unused]] u16& i = AotAccess::index(c8);\n";
+    out << "    u64 executed = 0;\n";
+    out << "    while (!c8.halted() && !(AotAccess::written_pages(c8) & code_pages)) {\n";
+    out << "        switch (pc) {\n";
+    std::set<u16> labels;
+    for (const auto& [start, block] : graph.blocks) {
+        if (!compiled(block, program_end)) continue;
+        if (const std::optional<u16> target = chained(*c8, graph, block, quirks, program_end)) labels.insert(*target);
+    }
+    for (const auto& [start, block] : graph.blocks) {
+        if (compiled(block, program_end)) write_block(out, *c8, graph, block, quirks, program_end, labels);
+    }
+    out << "            default:\n";
+    out << "                return executed;\n";
+    out << "        }\n";
+    out << "    }\n";
+    out << "    return executed;\n";
+    out << "}\n\n";
+
+    std::string quoted;
+    for (const char c : name) {
+        if (c >= ' ' && c <= '~' && c != '"' && c != '\\' && c != '?') quoted += c;
+    }
+    out << "const AotModule module{\"" << quoted << "\", QuirkProfile::" << quirk_profile_name(quirks)
+        << ", program, code, run};\n";
+    out << "const bool registered = register_aot_module(module);\n\n";
+    out << "}\n";
+}
+
+void write_listing(std::ostream& out, std::span<const u8> program, const QuirkProfile quirks) {
+    const ControlFlowGraph graph = recover_control_flow(program, quirks);
+    const auto opcode_at = [&](const u32 address) -> u16 {
+        return program[address - Chip8::program_start] << 8 | program[address + 1 - Chip8::program_start];
+    };
+    for (const auto& [start, block] : graph.blocks) {
+        out << hex(start) << '-' << hex(block.end) << ", " << block.length << " instructions ->";
+        for (const u16 successor : block.successors) out << ' ' << hex(successor);
+        if (block.successors.empty()) out << " none";
+        out << '\n';
+        for (u16 n = 0; n < block.length; n++) {
+            const u16 address = start + 2 * n;
+            const u16 opcode = opcode_at(address);
+            out << "    " << hex(address) << "  " << hex(opcode, 4).substr(2) << "  " << disassemble(opcode, quirks);
+            if (n == block.length - 1 && block.end - address == 4) out << ' ' << hex(opcode_at(address + 2), 4);
+            out << '\n';
+        }
+    }
+    if (graph.indirect_jumps) out << "computed jumps, code behind them is missing\n";
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::optional<QuirkProfile> quirks;
+    bool disassemble_only = false;
+    std::string rom_path;
+    std::string out_path;
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg.starts_with("--quirks=")) {
+            quirks = parse_quirk_profile(arg.substr(std::string_view("--quirks=").size()));
+            if (!quirks) {
+                std::cout << "Unknown quirk profile: " << arg << '\n';
+                print_usage();
+                return 1;
+            }
+        } else if (arg == "--disassemble") {
+            disassemble_only = true;
+        } else if (rom_path.empty()) {
+            rom_path = arg;
+        } else if (out_path.empty()) {
+            out_path = arg;
+        } else {
+            std::cout << "Too many arguments passed.\n";
+            print_usage();
+            return 1;
+        }
+    }
+    if (rom_path.empty()) {
+        std::cout << "No ROM passed.\n";
+        print_usage();
+        return 1;
+    }
+
+    // bad ROMs and unwritable output is reported rather than thrown
+    try {
+        const Rom rom(rom_path);
+        if (!quirks) quirks = analyze_rom(rom.bytes()).quirks;
+
+        std::ofstream file;
+        if (!out_path.empty()) {
+            file.open(out_path);
+            if (!file.good()) throw std::runtime_error("couldn't write " + out_path + "\n");
+        }
+        std::ostream& out = out_path.empty() ? std::cout : file;
+        if (disassemble_only) {
+            write_listing(out, rom.bytes(), *quirks);
+        } else {
+            write_module(out, std::filesystem::path(rom_path).filename().string(), rom.bytes(), *quirks);
+        }
+        return out.good() ? 0 : 1;
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what();
+        return 1;
+    }
+}
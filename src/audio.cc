@@ -0,0 +1,62 @@
+#include "include/audio.h"
+#include <algorithm>
+#include <stdexcept>
+
+void Beeper::generate(bool sound_on, Frame& out) {
+    const i32 target = sound_on ? amplitude : 0;
+    for (i16& sample : out) {
+        if (level < target) {
+            level = std::min(level + ramp_step, target);
+        } else if (level > target) {
+            level = std::max(level - ramp_step, target);
+        }
+        phase += phase_step;
+        sample = static_cast<i16>(phase & 0x80000000 ? level : -level);
+    }
+}
+
+WavWriter::WavWriter(const std::string& path) : file(path, std::ios::binary) {
+    if (!file) {
+        throw std::runtime_error("Couldn't create " + path + "\n");
+    }
+    write_header();
+}
+
+WavWriter::~WavWriter() {
+    // the sizes are known now
+    file.seekp(0);
+    write_header();
+}
+
+void WavWriter::play_frame(bool sound_on) {
+    beeper.generate(sound_on, samples);
+    // WAV is little endian, like every host this builds on, but don't rely on it
+    std::array<char, Beeper::samples_per_frame * 2> bytes;
+    for (size_t i = 0; i < samples.size(); i++) {
+        const u16 sample = static_cast<u16>(samples[i]);
+        bytes[i * 2] = static_cast<char>(sample & 0xFF);
+        bytes[i * 2 + 1] = static_cast<char>(sample >> 8);
+    }
+    file.write(bytes.data(), bytes.size());
+    samples_written += samples.size();
+}
+
+void WavWriter::write_header() {
+    const auto put = [&](u32 value, size_t size) {
+        for (size_t i = 0; i < size; i++) file.put(static_cast<char>(value >> (i * 8)));
+    };
+    const u32 data_size = static_cast<u32>(samples_written * 2);
+
+    file.write("RIFF", 4);
+    put(36 + data_size, 4);
+    file.write("WAVEfmt ", 8);
+    put(16, 4);                         // fmt chunk size
+    put(1, 2);                          // PCM
+    put(1, 2);                          // mono
+    put(Beeper::sample_rate, 4);
+    put(Beeper::sample_rate * 2, 4);    // bytes per second
+    put(2, 2);                          // bytes per sample
+    put(16, 2);                         // bits per sample
+    file.write("data", 4);
+    put(data_size, 4);
+}
@@ -0,0 +1,281 @@
+#include "include/batch.h"
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include "include/io.h"
+#include "include/runner.h"
+#include "include/savestate.h"
+#include "include/scheduler.h"
+
+namespace {
+
+// presses and releases random keys at frame boundaries
+class RandomInput : public InputSource {
+  public:
+    explicit RandomInput(u32 seed) : rng(seed) {}
+
+    bool poll(Chip8& c8, const InputTime&) override {
+        if (rng() % 8 == 0) {
+            const u8 key = rng() % 16;
+            held[key] = !held[key];
+            if (held[key]) {
+                c8.press_key(key);
+            } else {
+                c8.release_key(key);
+            }
+        }
+        return true;
+    }
+  private:
+    std::minstd_rand rng;
+    std::array<bool, 16> held{};
+};
+
+// job indices owned by one worker. the owner takes from the back, thieves
+// from the front, so they only meet when the queue is almost empty.
+class WorkQueue {
+  public:
+    void push(size_t job) {
+        std::lock_guard lock(mutex);
+        jobs.push_back(job);
+    }
+
+    std::optional<size_t> pop() {
+        std::lock_guard lock(mutex);
+        if (jobs.empty()) return std::nullopt;
+        const size_t job = jobs.back();
+        jobs.pop_back();
+        return job;
+    }
+
+    std::optional<size_t> steal() {
+        std::lock_guard lock(mutex);
+        if (jobs.empty()) return std::nullopt;
+        const size_t job = jobs.front();
+        jobs.pop_front();
+        return job;
+    }
+  private:
+    std::mutex mutex;
+    std::deque<size_t> jobs;
+};
+
+// comfortably fits a machine, the rest of a job lives on the stack
+constexpr size_t arena_size = 128 * 1024;
+
+struct Worker {
+    WorkQueue queue;
+    alignas(64) std::array<std::byte, arena_size> arena;
+    // engines are reused across jobs, loading a program invalidates whatever
+    // they cached for the previous one.
+    std::array<std::unique_ptr<Engine>, engine_kind_count> engines;
+
+    Engine& engine(EngineKind kind) {
+        auto& engine = engines[static_cast<size_t>(kind)];
+        if (!engine) engine = make_engine(kind);
+        return *engine;
+    }
+};
+
+// a ROM as the jobs running it see it
+struct LoadedRom {
+    std::unique_ptr<Rom> rom;
+    // why it couldn't be loaded when rom isn't set
+    std::string error;
+    RomInfo info;
+};
+
+// a checkpoint as the jobs resuming from it see it
+struct LoadedState {
+    std::unique_ptr<MappedState> state;
+    // why it couldn't be mapped when state isn't set
+    std::string error;
+};
+
+BatchResult run_job(const BatchJob& job, const LoadedRom& loaded, const MappedState* state, Worker& worker) {
+    std::pmr::monotonic_buffer_resource arena(worker.arena.data(), worker.arena.size());
+    std::pmr::polymorphic_allocator<Chip8> allocator(&arena);
+
+    Chip8* c8 = allocator.new_object<Chip8>();
+    c8->set_quirks(job.quirks.value_or(loaded.info.quirks));
+    c8->seed(job.seed);
+    try {
+        c8->load_program(loaded.rom->bytes());
+        if (state) {
+            load_state(*c8, state->bytes());
+        }
+    } catch (const std::runtime_error& e) {
+        allocator.delete_object(c8);
+        BatchResult result;
+        result.error = e.what();
+        result.error.pop_back();
+        return result;
+    }
+
+    std::optional<RandomInput> input;
+    if (job.input_seed) input.emplace(*job.input_seed);
+
+    Runner runner(*c8, worker.engine(job.engine), input ? &*input : nullptr);
+    if (job.cycles_per_frame) {
+        runner.cycles_per_frame = *job.cycles_per_frame;
+    } else if (loaded.info.ips) {
+        runner.cycles_per_frame = cycles_for_speed(loaded.info.ips);
+    }
+    while (runner.frames < job.frames && runner.run_frame());
+
+    BatchResult result;
+    result.state_hash = c8->state_hash();
+    result.frames = runner.frames;
+    result.instructions = runner.instructions;
+    result.trap = c8->trap;
+
+    allocator.delete_object(c8);
+    return result;
+}
+
+}
+
+std::vector<BatchJob> parse_manifest(std::istream& manifest) {
+    std::vector<BatchJob> jobs;
+    std::string line;
+
+    for (size_t line_number = 1; std::getline(manifest, line); line_number++) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream tokens(line);
+
+        BatchJob job;
+        if (!(tokens >> job.rom_path)) continue;
+
+        for (std::string token; tokens >> token;) {
+            const size_t separator = token.find('=');
+            const std::string key = token.substr(0, separator);
+            const std::string value = separator == std::string::npos ? "" : token.substr(separator + 1);
+            const auto error = [&](const std::string& what) {
+                return std::runtime_error("manifest line " + std::to_string(line_number) + ": " + what + '\n');
+            };
+
+            try {
+                if (key == "frames") {
+                    job.frames = std::stoull(value);
+                } else if (key == "cycles") {
+                    job.cycles_per_frame = std::stoul(value);
+                } else if (key == "seed") {
+                    job.seed = std::stoul(value);
+                } else if (key == "input_seed") {
+                    job.input_seed = std::stoul(value);
+                } else if (key == "state") {
+                    if (value.empty()) throw error("missing path in " + token);
+                    job.state_path = value;
+                } else if (key == "engine") {
+                    const auto kind = parse_engine_kind(value);
+                    if (!kind) throw error("unknown engine " + value);
+                    job.engine = *kind;
+                } else if (key == "quirks") {
+                    const auto profile = parse_quirk_profile(value);
+                    if (!profile) throw error("unknown quirk profile " + value);
+                    job.quirks = *profile;
+                } else {
+                    throw error("unknown setting " + token);
+                }
+            } catch (const std::invalid_argument&) {
+                throw error("bad value in " + token);
+            } catch (const std::out_of_range&) {
+                throw error("value out of range in " + token);
+            }
+        }
+        jobs.push_back(std::move(job));
+    }
+    return jobs;
+}
+
+BatchExecutor::BatchExecutor(size_t thread_count) : thread_count(std::max<size_t>(thread_count, 1)) {}
+
+std::vector<BatchResult> BatchExecutor::run(const std::vector<BatchJob>& jobs) {
+    std::vector<BatchResult> results(jobs.size());
+
+    // every ROM is mapped and looked up once up front, jobs only copy it
+    // into their machine
+    std::unordered_map<std::string, LoadedRom> roms;
+    for (const BatchJob& job : jobs) {
+        if (roms.contains(job.rom_path)) continue;
+        LoadedRom& loaded = roms[job.rom_path];
+        try {
+            loaded.rom = std::make_unique<Rom>(job.rom_path);
+        } catch (const std::runtime_error& e) {
+            loaded.error = e.what();
+            loaded.error.pop_back();
+            continue;
+        }
+        if (rom_cache) {
+            loaded.info = rom_cache->lookup(loaded.rom->bytes());
+        }
+    }
+
+    // checkpoints are mapped once and shared by every job resuming from them
+    std::unordered_map<std::string, LoadedState> states;
+    for (const BatchJob& job : jobs) {
+        if (job.state_path.empty() || states.contains(job.state_path)) continue;
+        LoadedState& loaded = states[job.state_path];
+        try {
+            loaded.state = std::make_unique<MappedState>(job.state_path);
+        } catch (const std::runtime_error& e) {
+            loaded.error = e.what();
+            loaded.error.pop_back();
+        }
+    }
+
+    const size_t workers_needed = std::min(thread_count, std::max<size_t>(jobs.size(), 1));
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (size_t i = 0; i < workers_needed; i++) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    for (size_t job = 0; job < jobs.size(); job++) {
+        workers[job % workers.size()]->queue.push(job);
+    }
+
+    const auto work = [&](size_t self) {
+        Worker& worker = *workers[self];
+        while (true) {
+            std::optional<size_t> job = worker.queue.pop();
+            for (size_t victim = 1; !job && victim < workers.size(); victim++) {
+                job = workers[(self + victim) % workers.size()]->queue.steal();
+            }
+            // nothing gets queued once the workers are running, so empty
+            // queues everywhere means everything is done or being done.
+            if (!job) return;
+
+            const LoadedRom& loaded = roms.at(jobs[*job].rom_path);
+            if (!loaded.rom) {
+                results[*job].error = loaded.error;
+                continue;
+            }
+            const MappedState* state = nullptr;
+            if (!jobs[*job].state_path.empty()) {
+                const LoadedState& loaded_state = states.at(jobs[*job].state_path);
+                if (!loaded_state.state) {
+                    results[*job].error = loaded_state.error;
+                    continue;
+                }
+                state = loaded_state.state.get();
+            }
+            results[*job] = run_job(jobs[*job], loaded, state, worker);
+        }
+    };
+
+    std::vector<std::jthread> threads;
+    for (size_t self = 1; self < workers.size(); self++) {
+        threads.emplace_back(work, self);
+    }
+    work(0);
+    threads.clear();
+
+    return results;
+}
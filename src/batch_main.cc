@@ -0,0 +1,101 @@
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "include/batch.h"
+#include "include/options.h"
+
+// runs every job of a manifest in-process, spread over all cores
+
+void print_usage() {
+    std::cout << "Example usage: \n";
+    std::cout << "./chip8_batch [--threads=n] [--rom-cache=dir] <manifest_path_here>\n";
+    std::cout << "manifest lines look like: roms/pong.ch8 frames=3600 seed=7 input_seed=1 engine=jit\n";
+    std::cout << "--rom-cache=dir keeps what's known about each ROM in dir, jobs without quirks= or cycles=\n";
+    std::cout << "                use the detected profile and the ips set there\n";
+}
+
+int main(int argc, char** argv) {
+    size_t threads = std::thread::hardware_concurrency();
+    std::string manifest_path;
+    std::string rom_cache_path;
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg.starts_with("--threads=")) {
+            if (!parse_option(arg.substr(std::string_view("--threads=").size()), threads))
+                return bad_option(arg, print_usage);
+        } else if (arg.starts_with("--rom-cache=")) {
+            rom_cache_path = arg.substr(std::string_view("--rom-cache=").size());
+        } else if (manifest_path.empty()) {
+            manifest_path = arg;
+        } else {
+            std::cout << "Too many arguments passed.\n";
+            print_usage();
+            return 1;
+        }
+    }
+
+    if (manifest_path.empty()) {
+        std::cout << "Too few arguments passed.\n";
+        print_usage();
+        return 1;
+    }
+
+    std::ifstream manifest(manifest_path);
+    if (!manifest.good()) {
+        std::cerr << "Manifest couldn't be found\n";
+        return 1;
+    }
+
+    std::vector<BatchJob> jobs;
+    try {
+        jobs = parse_manifest(manifest);
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what();
+        return 1;
+    }
+
+    BatchExecutor executor(threads);
+    std::optional<RomCache> rom_cache;
+    if (!rom_cache_path.empty()) {
+        try {
+            rom_cache.emplace(rom_cache_path);
+        } catch (const std::runtime_error& e) {
+            std::cerr << e.what();
+            return 1;
+        }
+        executor.rom_cache = &*rom_cache;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const std::vector<BatchResult> results = executor.run(jobs);
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    u64 total_instructions = 0;
+    bool failed = false;
+    for (size_t job = 0; job < jobs.size(); job++) {
+        const BatchResult& result = results[job];
+        std::cout << job << ' ' << jobs[job].rom_path;
+        if (!result.error.empty()) {
+            std::cout << " error: " << result.error << '\n';
+            failed = true;
+            continue;
+        }
+
+        std::cout << " hash=" << std::hex << std::setw(16) << std::setfill('0') << result.state_hash << std::dec
+                  << " frames=" << result.frames << " instructions=" << result.instructions;
+        if (result.trap) {
+            std::cout << " trap: " << *result.trap;
+        }
+        std::cout << '\n';
+        total_instructions += result.instructions;
+    }
+
+    std::cerr << jobs.size() << " jobs, " << total_instructions << " instructions in "
+              << elapsed.count() << "s (" << total_instructions / elapsed.count() << " instructions per second)\n";
+    return failed ? 1 : 0;
+}
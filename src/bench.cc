@@ -0,0 +1,378 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "include/audio.h"
+#include "include/chip8.h"
+#include "include/engine.h"
+#include "include/framebuffer.h"
+#include "include/lockstep.h"
+#include "include/options.h"
+#include "include/rom.h"
+#include "include/runner.h"
+
+// micro and macro benchmarks. prints JSON, and with --compare checks the
+// results against an earlier run and fails on regressions.
+
+namespace {
+
+// keeps the compiler from dropping work whose result nobody reads
+template <typename T>
+void keep(const T& value) {
+#if defined(__GNUC__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile T sink;
+    sink = value;
+#endif
+}
+
+struct Result {
+    std::string name;
+    double ns_per_op;
+};
+
+struct Settings {
+    double min_seconds = 0.2;
+    u32 repetitions = 5;
+    u64 macro_instructions = 20'000'000;
+    std::string filter;
+};
+
+// body(iterations) runs the operation iterations times. the iteration count
+// doubles until one run takes min_seconds, then the median of a few runs at
+// that count is reported.
+Result measure(const Settings& settings, const std::string& name, const std::function<void(u64)>& body) {
+    using clock = std::chrono::steady_clock;
+    const auto time = [&](u64 iterations) {
+        const auto start = clock::now();
+        body(iterations);
+        return std::chrono::duration<double>(clock::now() - start).count();
+    };
+
+    u64 iterations = 1;
+    while (time(iterations) < settings.min_seconds / settings.repetitions) iterations *= 2;
+
+    std::vector<double> samples;
+    for (u32 i = 0; i < settings.repetitions; i++) samples.push_back(time(iterations) / iterations);
+    std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+    return {name, samples[samples.size() / 2] * 1e9};
+}
+
+std::vector<u8> assemble(const std::vector<u16>& opcodes) {
+    std::vector<u8> program;
+    for (const u16 opcode : opcodes) {
+        program.push_back(opcode >> 8);
+        program.push_back(opcode & 0xFF);
+    }
+    return program;
+}
+
+// synthetic ROMs for the macro benchmarks, all of them loop forever without
+// trapping.
+
+std::vector<u8> alu_rom() {
+    std::vector<u16> code = {0x6001, 0x6103, 0x6207};
+    for (u16 i = 0; i < 60; i++) {
+        static constexpr std::array<u16, 9> alu = {0x8014, 0x8125, 0x8206, 0x8017, 0x812E, 0x8201, 0x8012, 0x8123, 0x7207};
+        code.push_back(alu[i % alu.size()]);
+    }
+    code.push_back(0x1206);
+    return assemble(code);
+}
+
+std::vector<u8> draw_rom() {
+    return assemble({
+        0x6000, 0x6100, 0x6200,
+        0xF229, // I = digit sprite for V2
+        0xD015, 0x7005, 0x7201,
+        0x3041, 0x1206, // until the row is full, 13 digits 5 apart
+        0x6000, 0x7106,
+        0x311E, 0x1206, // until the screen is full, 5 rows 6 apart
+        0x00E0, 0x6100, 0x1206,
+    });
+}
+
+std::vector<u8> call_rom() {
+    return assemble({
+        0x6000,
+        0x2208, 0x2208, 0x1202,
+        0x7001, 0x220E, 0x00EE, // 0x208
+        0x8014, 0x00EE,         // 0x20E
+    });
+}
+
+std::vector<u8> mixed_rom(u32 seed) {
+    std::mt19937 rng(seed);
+    std::vector<u16> code;
+    const auto x = [&]() -> u16 { return (rng() % 15) << 8; };
+    const auto y = [&]() -> u16 { return (rng() % 15) << 4; };
+
+    while (code.size() < 500) {
+        switch (rng() % 12) {
+            case 0: code.push_back(0x6000 | x() | (rng() & 0xFF)); break;
+            case 1: code.push_back(0x7000 | x() | (rng() & 0xFF)); break;
+            case 2: case 3: {
+                static constexpr std::array<u16, 9> alu = {0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE};
+                code.push_back(0x8000 | x() | y() | alu[rng() % alu.size()]);
+                break;
+            }
+            case 4: code.push_back(0x3000 | x() | (rng() & 0xFF)); code.push_back(0x7000 | x() | 1); break;
+            case 5: code.push_back(0x9000 | x() | y()); code.push_back(0x6000 | x()); break;
+            case 6: code.push_back(0xC000 | x() | (rng() & 0xFF)); break;
+            case 7: code.push_back(0xF029 | x()); code.push_back(0xD000 | x() | y() | (rng() % 6)); break;
+            // memory ops only ever touch the scratch area past the code
+            case 8: code.push_back(0xAE00); code.push_back(0xF033 | x()); break;
+            case 9: code.push_back(0xAE00); code.push_back(0xF055 | x()); break;
+            case 10: code.push_back(0xAE00); code.push_back(0xF065 | x()); break;
+            case 11: code.push_back(0xF01E | x()); break;
+        }
+    }
+    code.push_back(0x6000);
+    code.push_back(0x1200);
+    return assemble(code);
+}
+
+void micro_benchmarks(const Settings& settings, std::vector<Result>& results) {
+    const auto run = [&](const std::string& name, const std::function<void(u64)>& body) {
+        if (name.find(settings.filter) == std::string::npos) return;
+        results.push_back(measure(settings, name, body));
+    };
+
+    auto c8 = std::make_unique<Chip8>();
+    c8->load_program(alu_rom());
+
+    run("dispatch/fetch_instruction", [&](u64 iterations) {
+        for (u64 i = 0; i < iterations; i++) keep(c8->fetch_instruction(static_cast<u16>(i * 0x9E37)).handler);
+    });
+    run("dispatch/execute_instruction", [&](u64 iterations) {
+        // 7xkk, cheap enough that the dispatch itself dominates
+        for (u64 i = 0; i < iterations; i++) c8->execute_instruction(0x7001 | (i & 0xF) << 8);
+        keep(*c8);
+    });
+
+    const std::array<std::pair<const char*, u16>, 11> alu = {{
+        {"alu/ld_vx_kk", 0x6123}, {"alu/add_vx_kk", 0x7123},
+        {"alu/ld_vx_vy", 0x8120}, {"alu/or_vx_vy", 0x8121}, {"alu/and_vx_vy", 0x8122}, {"alu/xor_vx_vy", 0x8123},
+        {"alu/add_vx_vy", 0x8124}, {"alu/sub_vx_vy", 0x8125}, {"alu/shr_vx_vy", 0x8126}, {"alu/subn_vx_vy", 0x8127},
+        {"alu/shl_vx_vy", 0x812E},
+    }};
+    for (const auto& [name, opcode] : alu) {
+        const Instruction& instruction = c8->fetch_instruction(opcode);
+        run(name, [&](u64 iterations) {
+            for (u64 i = 0; i < iterations; i++) instruction.handler(*c8, instruction.fields);
+            keep(*c8);
+        });
+    }
+
+    // sprites come from the font, positions from V0/V1
+    struct DrawCase {
+        const char* name;
+        u8 x, y, height;
+    };
+    const std::array<DrawCase, 6> draws = {{
+        {"draw/height_1", 10, 10, 1}, {"draw/height_5", 10, 10, 5}, {"draw/height_15", 10, 10, 15},
+        {"draw/clip_right", 60, 10, 5}, {"draw/clip_bottom", 10, 29, 15}, {"draw/clip_corner", 60, 29, 15},
+    }};
+    for (const DrawCase& draw : draws) {
+        c8->execute_instruction(0x6000 | draw.x);
+        c8->execute_instruction(0x6100 | draw.y);
+        c8->execute_instruction(0xA050);
+        const Instruction& instruction = c8->fetch_instruction(0xD010 | draw.height);
+        run(draw.name, [&](u64 iterations) {
+            for (u64 i = 0; i < iterations; i++) instruction.handler(*c8, instruction.fields);
+            keep(c8->display);
+        });
+    }
+
+    const std::vector<u8> rom = mixed_rom(1);
+    run("load_program/1k", [&](u64 iterations) {
+        for (u64 i = 0; i < iterations; i++) c8->load_program(rom);
+        keep(*c8);
+    });
+    run("load_program/analyze_1k", [&](u64 iterations) {
+        for (u64 i = 0; i < iterations; i++) keep(analyze_rom(rom).code.size());
+    });
+
+    std::array<u32, Chip8::display_size> pixels;
+    std::array<u64, Chip8::display_height> rows;
+    std::array<u64, Chip8::display_height> second_plane{};
+    const std::array<u32, 4> palette = {0, 0xFFFFFF, 0xAAAAAA, 0x555555};
+    std::mt19937_64 rng(1);
+    for (u64& row : rows) row = rng();
+    run("framebuffer/expand_frame", [&](u64 iterations) {
+        for (u64 i = 0; i < iterations; i++) {
+            for (size_t row = 0; row < rows.size(); row++) {
+                expand_row(rows[row], second_plane[row], &pixels[row * Chip8::display_width], palette);
+            }
+            keep(pixels);
+        }
+    });
+
+    Beeper beeper;
+    Beeper::Frame samples;
+    run("audio/beeper_frame", [&](u64 iterations) {
+        for (u64 i = 0; i < iterations; i++) {
+            beeper.generate(i & 1, samples);
+            keep(samples);
+        }
+    });
+}
+
+void macro_benchmarks(const Settings& settings, std::vector<Result>& results) {
+    const std::array<std::pair<const char*, std::vector<u8>>, 4> roms = {{
+        {"alu", alu_rom()}, {"draw", draw_rom()}, {"calls", call_rom()}, {"mixed", mixed_rom(2)},
+    }};
+    const std::array<std::pair<const char*, EngineKind>, 3> engines = {{
+        {"interpreter", EngineKind::interpreter}, {"block", EngineKind::block_cache}, {"jit", EngineKind::jit},
+    }};
+    // one iteration is a whole run from boot, reported per instruction
+    const auto run = [&](const std::string& name, const std::function<u64()>& boot_and_run) {
+        if (name.find(settings.filter) == std::string::npos) return;
+        u64 executed = 0;
+        Result result = measure(settings, name, [&](u64 iterations) {
+            for (u64 i = 0; i < iterations; i++) executed = boot_and_run();
+        });
+        result.ns_per_op /= std::max<u64>(executed, 1);
+        results.push_back(result);
+    };
+
+    for (const auto& [rom_name, rom] : roms) {
+        for (const auto& [engine_name, kind] : engines) {
+            run(std::string("rom/") + rom_name + "/" + engine_name, [&]() {
+                auto c8 = std::make_unique<Chip8>();
+                c8->load_program(rom);
+                auto engine = make_engine(kind);
+                Runner runner(*c8, *engine);
+                runner.cycles_per_frame = 1000;
+                while (runner.instructions < settings.macro_instructions && runner.run_frame());
+                keep(c8->state_hash());
+                return runner.instructions;
+            });
+        }
+
+        run(std::string("rom/") + rom_name + "/lockstep_64", [&]() {
+            Lockstep lockstep(64);
+            lockstep.load_program(rom);
+            for (size_t lane = 0; lane < lockstep.lanes(); lane++) lockstep.seed(lane, lane);
+            // the same instructions per lane spread over 64 lanes
+            u64 executed = 0;
+            for (u64 per_lane = 0; per_lane < settings.macro_instructions / 64; per_lane += 1000) {
+                executed += lockstep.run(1000);
+                lockstep.tick_timers();
+            }
+            return executed;
+        });
+    }
+}
+
+void write_json(std::ostream& out, const std::vector<Result>& results) {
+    out << "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        out << "    {\"name\": \"" << results[i].name << "\", \"ns_per_op\": " << std::setprecision(6)
+            << results[i].ns_per_op << ", \"ops_per_second\": " << 1e9 / results[i].ns_per_op << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+}
+
+// reads back what write_json wrote, nothing more general than that
+std::vector<Result> read_json(std::istream& in) {
+    std::vector<Result> results;
+    std::string line;
+    while (std::getline(in, line)) {
+        const size_t name = line.find("\"name\": \"");
+        const size_t time = line.find("\"ns_per_op\": ");
+        if (name == std::string::npos || time == std::string::npos) continue;
+        const size_t name_start = name + 9;
+        const size_t name_end = line.find('"', name_start);
+        results.push_back({line.substr(name_start, name_end - name_start), std::stod(line.substr(time + 13))});
+    }
+    return results;
+}
+
+void print_usage() {
+    std::cout << "Example usage: \n";
+    std::cout << "./chip8_bench [--filter=text] [--min-time=seconds] [--instructions=n] [--out=path]\n";
+    std::cout << "              [--compare=baseline.json] [--threshold=percent]\n";
+}
+
+}
+
+int main(int argc, char** argv) {
+    Settings settings;
+    std::string out_path;
+    std::string baseline_path;
+    double threshold = 10;
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        auto value = [&](std::string_view option) { return std::string(arg.substr(option.size())); };
+
+        if (arg.starts_with("--filter=")) {
+            settings.filter = value("--filter=");
+        } else if (arg.starts_with("--min-time=")) {
+            if (!parse_option(value("--min-time="), settings.min_seconds)) return bad_option(arg, print_usage);
+        } else if (arg.starts_with("--instructions=")) {
+            if (!parse_option(value("--instructions="), settings.macro_instructions))
+                return bad_option(arg, print_usage);
+            settings.macro_instructions = std::max<u64>(settings.macro_instructions, 1);
+        } else if (arg.starts_with("--out=")) {
+            out_path = value("--out=");
+        } else if (arg.starts_with("--compare=")) {
+            baseline_path = value("--compare=");
+        } else if (arg.starts_with("--threshold=")) {
+            if (!parse_option(value("--threshold="), threshold)) return bad_option(arg, print_usage);
+        } else {
+            std::cout << "Unknown argument: " << arg << '\n';
+            print_usage();
+            return 1;
+        }
+    }
+
+    std::vector<Result> results;
+    micro_benchmarks(settings, results);
+    macro_benchmarks(settings, results);
+
+    write_json(std::cout, results);
+    if (!out_path.empty()) {
+        std::ofstream out(out_path);
+        write_json(out, results);
+    }
+
+    if (baseline_path.empty()) return 0;
+
+    std::ifstream baseline_file(baseline_path);
+    if (!baseline_file.good()) {
+        std::cerr << "Baseline couldn't be found\n";
+        return 1;
+    }
+    const std::vector<Result> baseline = read_json(baseline_file);
+
+    // slower by more than threshold percent is a regression
+    u32 regressions = 0;
+    for (const Result& result : results) {
+        const auto before = std::find_if(baseline.begin(), baseline.end(),
+                                         [&](const Result& other) { return other.name == result.name; });
+        if (before == baseline.end()) continue;
+
+        const double change = (result.ns_per_op / before->ns_per_op - 1) * 100;
+        const bool regressed = change > threshold;
+        regressions += regressed;
+        std::ostringstream percent;
+        percent << std::fixed << std::setprecision(1) << change << '%';
+        std::cerr << (regressed ? "REGRESSION " : "ok         ") << std::left << std::setw(36) << result.name
+                  << std::right << std::setw(9) << percent.str() << '\n';
+    }
+    std::cerr << regressions << " regressions beyond " << threshold << "%\n";
+    return regressions ? 1 : 0;
+}
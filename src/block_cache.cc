@@ -0,0 +1,110 @@
+#include "include/block_cache.h"
+#include "include/profiler.h"
+
+u16 PageIndex::pages_of(u16 address, size_t length) {
+    u16 page_mask = 0;
+    for (size_t offset = 0; offset < length; offset++) {
+        page_mask |= 1 << (((address + offset) & 0xFFF) / Chip8::page_size);
+    }
+    return page_mask;
+}
+
+void PageIndex::insert(u16 address, u16 page_mask) {
+    const u16 unlisted = page_mask & ~listed_pages[address];
+    for (size_t page = 0; page < page_count; page++) {
+        if (unlisted & (1 << page)) {
+            page_blocks[page].push_back(address);
+        }
+    }
+    listed_pages[address] |= unlisted;
+}
+
+BlockCache::BlockCache() : blocks(std::make_unique<std::array<Block, memory_size>>()) {}
+
+bool BlockCache::ends_block(CallBack handler) {
+    // anything that may not fall through to the next instruction
+    return handler == Chip8::jp_addr || handler == Chip8::call_addr ||
+           handler == Chip8::ret || handler == Chip8::jp_offset || handler == Chip8::jp_offset_vx ||
+           handler == Chip8::skip_next_ife_vxkk || handler == Chip8::skip_next_ifne_vxkk ||
+           handler == Chip8::skip_next_ife_vxvy || handler == Chip8::skip_next_ifne_vx_vy ||
+           handler == Chip8::skp_vx || handler == Chip8::sknp_vx ||
+           handler == Chip8::skip_next_ife_vxkk_long || handler == Chip8::skip_next_ifne_vxkk_long ||
+           handler == Chip8::skip_next_ife_vxvy_long || handler == Chip8::skip_next_ifne_vx_vy_long ||
+           handler == Chip8::skp_vx_long || handler == Chip8::sknp_vx_long ||
+           // its operand isn't an instruction
+           handler == Chip8::ld_i_long ||
+           handler == Chip8::ld_vx_key || handler == Chip8::exit || handler == Chip8::invalid_opcode;
+}
+
+void BlockCache::decode(const Chip8& c8, u16 address, Block& block) {
+    for (u16 pc = address; block.instructions.size() < max_block_length; pc += 2) {
+        const Instruction& instruction = c8.fetch_instruction(c8.opcode_at(pc));
+        block.instructions.push_back(instruction);
+        block.page_mask |= PageIndex::pages_of(pc, 2);
+
+        // stop at the end of memory as well, the program counter doesn't wrap
+        // there even though fetching does.
+        if (ends_block(instruction.handler) || size_t(pc) + 2 >= memory_size) break;
+    }
+    // the loop may reach past the block, a store to any of it has to drop it
+    block.busy_loop = BusyLoop::match(c8, address);
+    if (block.busy_loop) {
+        block.page_mask |= PageIndex::pages_of(address, block.busy_loop->length * 2);
+    }
+
+    page_index.insert(address, block.page_mask);
+}
+
+const Block& BlockCache::lookup(const Chip8& c8, u16 address) {
+    Block& block = (*blocks)[address];
+    if (block.instructions.empty()) {
+        decode(c8, address, block);
+    }
+    return block;
+}
+
+void BlockCache::invalidate(u16 pages) {
+    page_index.invalidate(pages, [this](u16 address, u16 page_bit) {
+        Block& block = (*blocks)[address];
+        if (block.page_mask & page_bit) {
+            block.instructions.clear();
+            block.page_mask = 0;
+        }
+    });
+}
+
+u64 BlockCache::run(Chip8& c8, u64 budget) {
+    u64 executed = 0;
+    invalidate(c8.take_written_pages());
+
+    while (executed < budget && !c8.halted()) {
+        // XO-CHIP code past the first 4K isn't cached
+        if ((c8.program_counter & c8.address_mask) >= memory_size) {
+            c8.run_cycle();
+            executed++;
+            continue;
+        }
+        const Block& block = lookup(c8, c8.program_counter & 0xFFF);
+        if (block.busy_loop && !profiling(c8)) {
+            if (const u64 skipped = block.busy_loop->fast_forward(c8, c8.program_counter & 0xFFF, budget - executed)) {
+                executed += skipped;
+                continue;
+            }
+        }
+        for (const Instruction& instruction : block.instructions) {
+            PROFILE(c8, count_instruction(c8.program_counter, c8.opcode_at(c8.program_counter)));
+            c8.program_counter += 2;
+            instruction.handler(c8, instruction.fields);
+            executed++;
+
+            // the store may have hit this very block, so leave it before
+            // dropping anything.
+            if (c8.written_pages) {
+                invalidate(c8.take_written_pages());
+                break;
+            }
+            if (executed == budget) break;
+        }
+    }
+    return executed;
+}
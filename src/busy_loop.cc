@@ -0,0 +1,47 @@
+#include "include/busy_loop.h"
+#include "include/profiler.h"
+
+std::optional<BusyLoop> BusyLoop::match(const Chip8& c8, u16 address) {
+    // the pc doesn't wrap, a loop running into the end of memory isn't one
+    if (address + 6 > 4096) return std::nullopt;
+
+    const u16 first = c8.opcode_at(address);
+    const u16 second = c8.opcode_at(address + 2);
+    const u16 back = 0x1000 | address;
+    const u8 x = (first >> 8) & 0xF;
+
+    if ((first & 0xF0FF) == 0xF007 && c8.opcode_at(address + 4) == back) {
+        // Fx07 then a skip on the same register
+        const u8 family = second >> 12;
+        if ((family == 0x3 || family == 0x4) && ((second >> 8) & 0xF) == x) {
+            return BusyLoop{Kind::delay_timer, 3, x, static_cast<u8>(second & 0xFF), family == 0x3};
+        }
+    }
+    if (((first & 0xF0FF) == 0xE09E || (first & 0xF0FF) == 0xE0A1) && second == back) {
+        return BusyLoop{Kind::key, 2, x, 0, (first & 0xFF) == 0x9E};
+    }
+    return std::nullopt;
+}
+
+u64 BusyLoop::fast_forward(Chip8& c8, u16 address, u64 budget) const {
+    if (c8.program_counter != address || budget == 0) return 0;
+
+    if (kind == Kind::delay_timer) {
+        if ((c8.timer_delay == kk) == exit_on_match) return 0;
+        c8.registers[x] = c8.timer_delay;
+    } else {
+        if (c8.keyboard.keys[c8.registers[x] & 0xF] == exit_on_match) return 0;
+    }
+    // budget instructions in, the last iteration stopped part way through
+    c8.program_counter = address + 2 * (budget % length);
+    return budget;
+}
+
+u64 BusyLoop::fast_forward(Chip8& c8, u64 budget) {
+    // a profile should see every iteration
+    if (profiling(c8)) return 0;
+
+    const u16 address = c8.program_counter;
+    const std::optional<BusyLoop> loop = BusyLoop::match(c8, address);
+    return loop ? loop->fast_forward(c8, address, budget) : 0;
+}
@@ -1,102 +1,225 @@
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
 #include <string>
-#include <fstream>
-#include <cassert>
+#include <utility>
 
 #include "include/chip8.h"
-//#define Debug
+#include "include/hash.h"
+#include "include/profiler.h"
+#include "include/rom.h"
 
 u16 Chip8::fetch_opcode() const {
+    return opcode_at(program_counter);
+}
+
+u16 Chip8::opcode_at(const u16 address) const {
     // merge the opcode by shifting the first byte and then ORing the second.
     // this follows from memory being stored as single bytes, therefore the instruction
     // is placed on 2 different spaces.
-    u16 opcode = memory[program_counter] << 8 | memory[program_counter + 1];
+    u16 opcode = load(address) << 8 | load(address + 1);
     return opcode;
 }
 
-CallBack Chip8::fetch_instruction(const u16 instruction) {
-    u8 most_significant_byte = instruction >> 12;
-    u8 least_significant_byte = instruction & 0x000F;
-    u8 least_two_significant_bytes = instruction & 0x00FF; 
-
-    std::unordered_map<Mask, CallBack> lookup_table;
-    // we want to parse which instruction to use, and since all
-    // instructions are built up differently (most_significant_byte + lsb) and some are
-    // (most_significant_byte + 0x00FF) or just most_significant_byte.
-    // therefore we set instr_byte to which variant we want to look up.
-    u8 instruction_byte = least_significant_byte;
-    if (most_significant_byte == 0x0) {
-        // lsb
-        lookup_table = instruction_table_0;
-    } else if (most_significant_byte == 0x8) {
-        // lsb
-        lookup_table = instruction_table_8;
-    } else if (most_significant_byte == 0xE) { 
-        instruction_byte = least_two_significant_bytes;
-        lookup_table = instruction_table_e;
-    } else if (most_significant_byte == 0xF) {
-        instruction_byte = least_two_significant_bytes;
-        lookup_table = instruction_table_f;
-    } else {
-        instruction_byte = most_significant_byte;
-        lookup_table = instruction_table_rest;
-    }
-
-    try { 
-        return lookup_table.at(instruction_byte);
-    } catch(std::out_of_range& e) {
-        std::cout << "Instruction that doesn't exist: " << std::hex << instruction << '\n';
-    }
-    return nullptr;
+const Instruction& Chip8::fetch_instruction(const u16 instruction) const {
+    // every opcode is decoded ahead of time, see instructions.cc
+    return (*instructions)[instruction];
 }
 
 void Chip8::execute_instruction(const u16 instruction) {
-    #ifdef Debug
-        std::cout << "[Log]: Currently executing opcode: " << std::hex << instruction << '\n';
-    #endif
-    auto instruction_to_execute = fetch_instruction(instruction);    
+    PROFILE(*this, count_instruction(program_counter, instruction));
+    const Instruction& instruction_to_execute = fetch_instruction(instruction);    
     program_counter += 2;
-    OpcodeFields opcode_fields(instruction);  
-    instruction_to_execute(*this, opcode_fields);
+    instruction_to_execute.handler(*this, instruction_to_execute.fields);
+}
+
+void Chip8::set_quirks(const QuirkProfile profile) {
+    quirk_profile = profile;
+    instructions = &instruction_tables[static_cast<size_t>(profile)];
+    address_mask = quirks_of(profile).xo_chip ? 0xFFFF : 0xFFF;
+    if (quirks_of(profile).super_chip) {
+        load_font();
+    }
+    // code decoded under the old profile has the wrong handlers in it
+    written_pages = 0xFFFF;
+}
+
+u16 Chip8::take_written_pages() {
+    return std::exchange(written_pages, 0);
+}
+
+u64 Chip8::take_dirty_rows() {
+    return std::exchange(dirty_rows, 0);
+}
+
+void Chip8::store(const u16 address, const u8 value) {
+    const u16 masked = address & address_mask;
+    memory[masked] = value;
+    if (masked < 0x1000) {
+        written_pages |= 1 << (masked / page_size);
+    }
 }
 
 void Chip8::load_font() {
     // According to the documentation, the convention is to put
     // all fonts in the memory region of 0x50-0x9F
     std::copy(font.begin(), font.end(), memory.begin() + 0x50);
+    // SUPER-CHIP's big one goes right after, but only for profiles with
+    // Fx30. plain CHIP-8 programs that index past the small font keep
+    // seeing the zeros they always did.
+    if (quirks_of(quirk_profile).super_chip) {
+        std::copy(big_font.begin(), big_font.end(), memory.begin() + 0xA0);
+    }
+    written_pages = 0xFFFF;
 }
 
 void Chip8::run_cycle() {
+    // a trapped machine stays on the faulting instruction
+    if (trap) return;
     u16 opcode = fetch_opcode();
     execute_instruction(opcode);
 }
 
+template <QuirkProfile profile>
+void Chip8::run_cycle() {
+    if (trap) return;
+    // the profile fixes how much memory there is, no need to load the mask
+    constexpr u16 mask = quirks_of(profile).xo_chip ? 0xFFFF : 0xFFF;
+    const u16 opcode = memory[program_counter & mask] << 8 | memory[(program_counter + 1) & mask];
+    PROFILE(*this, count_instruction(program_counter, opcode));
+    const Instruction& instruction = instruction_tables[static_cast<size_t>(profile)][opcode];
+    program_counter += 2;
+    instruction.handler(*this, instruction.fields);
+}
+
+template void Chip8::run_cycle<QuirkProfile::legacy>();
+template void Chip8::run_cycle<QuirkProfile::cosmac>();
+template void Chip8::run_cycle<QuirkProfile::schip>();
+template void Chip8::run_cycle<QuirkProfile::xochip>();
+
 void Chip8::load_program(const std::string& rom_path) {
-    std::ifstream rom(rom_path, std::ios::binary);
-    
-    if (!rom.good())
-        throw std::runtime_error("ROM couldn't be found\n");
+    const Rom rom(rom_path);
+    load_program(rom.bytes());
+}
 
-    u32 program_start_offset = 0x200;
-    while(rom.good()) {
-        // this is "fine" range handling :) 
-        memory[program_start_offset++ & 0xFFF] = rom.get();
-    }
+void Chip8::load_program(std::span<const u8> program) {
+    if (program.size() > max_program_size(quirk_profile))
+        throw std::runtime_error("ROM is too big, " + std::to_string(program.size()) + " bytes but " +
+                                 quirk_profile_name(quirk_profile) + " only fits " +
+                                 std::to_string(max_program_size(quirk_profile)) + "\n");
+    std::copy(program.begin(), program.end(), memory.begin() + program_start);
     load_font();
 }
 
+void Chip8::seed(const u32 seed) {
+    rnd.seed(seed);
+}
+
+void Chip8::press_key(const u8 key) {
+    keyboard.keys[key] = true;
+    if (keyboard.waiting) {
+        registers[keyboard.wait_register] = key;
+        keyboard.waiting = false;
+    }
+}
+
+void Chip8::release_key(const u8 key) {
+    keyboard.keys[key] = false;
+}
+
+u16 Chip8::held_keys() const {
+    u16 held = 0;
+    for (u8 key = 0; key < 16; key++) {
+        if (keyboard.keys[key]) held |= 1 << key;
+    }
+    return held;
+}
+
+void Chip8::tick_timers() {
+    if (timer_delay > 0) {
+        timer_delay--;
+    }
+    if (sound_delay > 0) {
+        sound_delay--;
+    }
+    PROFILE(*this, end_frame(*this));
+}
+
+u64 Chip8::display_hash() const {
+    // only the pixels that are on screen, so a 64x32 display in one plane
+    // hashes like it always did
+    std::array<u64, Framebuffer::plane_count * hires_height * 2> pixels;
+    size_t count = 0;
+    for (size_t plane = 0; plane < Framebuffer::plane_count; plane++) {
+        const size_t start = count;
+        for (size_t row = 0; row < display.height(); row++) {
+            pixels[count++] = display.planes[plane][row][0];
+            if (display.hires) pixels[count++] = display.planes[plane][row][1];
+        }
+        // the second plane only counts once something was drawn into it
+        if (plane > 0 && std::all_of(&pixels[start], &pixels[count], [](u64 word) { return word == 0; })) {
+            count = start;
+        }
+    }
+    u64 hash = fnv1a(pixels.data(), count * sizeof(u64));
+    if (display.hires) {
+        hash = fnv1a(&display.hires, 1, hash);
+    }
+    return hash;
+}
+
+template <u64 (*hasher)(const void*, size_t, u64)>
+u64 Chip8::hash_state() const {
+    u64 hash = hasher(memory.data(), size_t(address_mask) + 1, fnv1a_offset);
+    hash = hasher(display.planes.data(), sizeof(display.planes), hash);
+    const std::array<u8, 3> modes = {display.hires, selected_planes, pitch};
+    hash = hasher(modes.data(), modes.size(), hash);
+    hash = hasher(flags.data(), flags.size(), hash);
+    hash = hasher(audio_pattern.data(), audio_pattern.size(), hash);
+    hash = hasher(stack.data(), stack.size() * sizeof(u16), hash);
+    hash = hasher(registers.data(), registers.size(), hash);
+    const u16 waiting = keyboard.waiting ? 0x80 | keyboard.wait_register : 0;
+    const std::array<u16, 6> scalars = {program_counter, index_register, stack_pointer, sound_delay, timer_delay, waiting};
+    return hasher(scalars.data(), scalars.size() * sizeof(u16), hash);
+}
+
+u64 Chip8::state_hash() const {
+    return hash_state<fnv1a>();
+}
+
+u64 Chip8::quick_state_hash() const {
+    return hash_state<fxhash>();
+}
+
+void Chip8::clear_planes(const u8 planes) {
+    for (size_t plane = 0; plane < Framebuffer::plane_count; plane++) {
+        if (planes & (1 << plane)) display.planes[plane].fill({});
+    }
+    dirty_rows = ~u64{0};
+}
+
 void Chip8::cls(Chip8& c8, const OpcodeFields& fields) {
-    c8.display.fill({});
+    c8.clear_planes(c8.selected_planes);
 }
 
 void Chip8::ret(Chip8& c8, const OpcodeFields& fields) {
+    if (c8.stack_pointer == 0) {
+        c8.raise_trap(TrapKind::stack_underflow);
+        return;
+    }
     c8.program_counter = c8.stack[--c8.stack_pointer];
+    PROFILE(c8, leave());
 }
 
 void Chip8::call_addr(Chip8& c8, const OpcodeFields& fields) {
     // Call subroutine at nnn 
-    assert(c8.stack_pointer != 12);
+    if (c8.stack_pointer == stack_depth) {
+        c8.raise_trap(TrapKind::stack_overflow);
+        return;
+    }
     c8.stack[c8.stack_pointer++] = c8.program_counter;
     c8.program_counter = fields.nnn;
+    PROFILE(c8, enter(fields.nnn));
 }
 
 void Chip8::jp_addr(Chip8& c8, const OpcodeFields& fields) {
@@ -125,6 +248,35 @@ void Chip8::skip_next_ife_vxvy(Chip8& c8, const OpcodeFields& fields) {
     }
 }
 
+void Chip8::skip_long() {
+    program_counter += opcode_at(program_counter) == 0xF000 ? 4 : 2;
+}
+
+// XO-CHIP's F000 nnnn is four bytes long, its skips step over all of it
+void Chip8::skip_next_ife_vxkk_long(Chip8& c8, const OpcodeFields& fields) {
+    if (c8.registers[fields.x] == fields.kk) c8.skip_long();
+}
+
+void Chip8::skip_next_ifne_vxkk_long(Chip8& c8, const OpcodeFields& fields) {
+    if (c8.registers[fields.x] != fields.kk) c8.skip_long();
+}
+
+void Chip8::skip_next_ife_vxvy_long(Chip8& c8, const OpcodeFields& fields) {
+    if (c8.registers[fields.x] == c8.registers[fields.y]) c8.skip_long();
+}
+
+void Chip8::skip_next_ifne_vx_vy_long(Chip8& c8, const OpcodeFields& fields) {
+    if (c8.registers[fields.x] != c8.registers[fields.y]) c8.skip_long();
+}
+
+void Chip8::skp_vx_long(Chip8& c8, const OpcodeFields& fields) {
+    if (c8.keyboard.keys[c8.registers[fields.x] & 0xF]) c8.skip_long();
+}
+
+void Chip8::sknp_vx_long(Chip8& c8, const OpcodeFields& fields) {
+    if (!c8.keyboard.keys[c8.registers[fields.x] & 0xF]) c8.skip_long();
+}
+
 void Chip8::ld_vx_kk(Chip8& c8, const OpcodeFields& fields) {
     auto& Vx = c8.registers[fields.x];
     Vx = fields.kk;
@@ -161,6 +313,22 @@ void Chip8::xor_vx_vy(Chip8& c8, const OpcodeFields& fields) {
     Vx ^= Vy; 
 }
 
+// the COSMAC VIP did logic ops through a routine that clobbered VF
+void Chip8::or_vx_vy_reset_vf(Chip8& c8, const OpcodeFields& fields) {
+    c8.registers[fields.x] |= c8.registers[fields.y];
+    c8.registers[15] = 0;
+}
+
+void Chip8::and_vx_vy_reset_vf(Chip8& c8, const OpcodeFields& fields) {
+    c8.registers[fields.x] &= c8.registers[fields.y];
+    c8.registers[15] = 0;
+}
+
+void Chip8::xor_vx_vy_reset_vf(Chip8& c8, const OpcodeFields& fields) {
+    c8.registers[fields.x] ^= c8.registers[fields.y];
+    c8.registers[15] = 0;
+}
+
 void Chip8::add_vx_vy(Chip8& c8, const OpcodeFields& fields) {
     auto& Vx = c8.registers[fields.x];
     auto& Vy = c8.registers[fields.y];
@@ -190,7 +358,7 @@ void Chip8::shr_vx_vy(Chip8& c8, const OpcodeFields& fields) {
     auto Vy = c8.registers[fields.y];
     auto& Vf = c8.registers[15];
 
-    // implementations seem to differ here, might cause bugs in some roms
+    // implementations differ here, shr_vx is the SUPER-CHIP version
     Vx = Vy >> 1;
     Vf = Vy & 0x1;
 }
@@ -214,6 +382,25 @@ void Chip8::shl_vx_vy(Chip8& c8, const OpcodeFields& fields) {
     Vf = (Vy >> 7) & 0x1;
 }
 
+// SUPER-CHIP ignores y and shifts Vx in place
+void Chip8::shr_vx(Chip8& c8, const OpcodeFields& fields) {
+    auto& Vx = c8.registers[fields.x];
+    auto& Vf = c8.registers[15];
+
+    const u8 shifted_out = Vx & 0x1;
+    Vx >>= 1;
+    Vf = shifted_out;
+}
+
+void Chip8::shl_vx(Chip8& c8, const OpcodeFields& fields) {
+    auto& Vx = c8.registers[fields.x];
+    auto& Vf = c8.registers[15];
+
+    const u8 shifted_out = (Vx >> 7) & 0x1;
+    Vx <<= 1;
+    Vf = shifted_out;
+}
+
 void Chip8::skip_next_ifne_vx_vy(Chip8& c8, const OpcodeFields& fields) {
     auto& Vx = c8.registers[fields.x];
     auto& Vy = c8.registers[fields.y];
@@ -232,6 +419,12 @@ void Chip8::jp_offset(Chip8& c8, const OpcodeFields& fields) {
     c8.program_counter = fields.nnn + V0;
 }
 
+// SUPER-CHIP's Bxnn, the top nibble of nnn doubles as the register
+void Chip8::jp_offset_vx(Chip8& c8, const OpcodeFields& fields) {
+    auto& Vx = c8.registers[fields.x];
+    c8.program_counter = fields.nnn + Vx;
+}
+
 void Chip8::rnd_vx_kk(Chip8& c8, const OpcodeFields& fields) {
     auto& Vx = c8.registers[fields.x];
     Vx = std::uniform_int_distribution<>(0, 255)(c8.rnd) & fields.kk;
@@ -244,10 +437,9 @@ void Chip8::ld_vx_dt(Chip8& c8, const OpcodeFields& fields) {
 
 void Chip8::ld_vx_key(Chip8& c8, const OpcodeFields& fields) {
     // All execution stops until a key is pressed, then the value of that key is stored in Vx.
-    // fields.x holds Vx
-    // unsure if this works properly
-    c8.keyboard.waiting_key = 0x80 | fields.x;
-    c8.program_counter -= 2;
+    // press_key finishes the instruction, the pc already points past it
+    c8.keyboard.waiting = true;
+    c8.keyboard.wait_register = fields.x;
 }
 
 void Chip8::ld_dt_vx(Chip8& c8, const OpcodeFields& fields) {
@@ -269,46 +461,174 @@ void Chip8::add_i_vx(Chip8& c8, const OpcodeFields& fields) {
     c8.index_register = res;
 }
 
-void Chip8::draw_vx_vy_nibble(Chip8& c8, const OpcodeFields& fields) {
-    // "Wrap" starting position of the sprite
-    u8 x = c8.registers[fields.x] % display_width;
-    u8 y = c8.registers[fields.y] % display_height; 
+// XO-CHIP's I spans all 64K and leaves VF alone
+void Chip8::add_i_vx_wide(Chip8& c8, const OpcodeFields& fields) {
+    c8.index_register += c8.registers[fields.x];
+}
+
+template <bool wrap, bool large>
+void Chip8::draw(Chip8& c8, const OpcodeFields& fields) {
+    // "Wrap" starting position of the sprite, the sprite itself gets clipped
+    // unless wrap is set. both resolutions are powers of two, masking does.
+    const bool hires = c8.display.hires;
+    const u8 width_mask = hires ? hires_width - 1 : display_width - 1;
+    const u8 height_mask = hires ? hires_height - 1 : display_height - 1;
+    const u8 x = c8.registers[fields.x] & width_mask;
+    const u8 y = c8.registers[fields.y] & height_mask;
     u8& Vf = c8.registers[15] = 0;
 
-    // obtain the 'n'-nibble containing the sprite_height using kk and
-    // shifting 4 times.
-    const u8 sprite_height = fields.kk & 0xF;
-    for (u8 n = 0; n < sprite_height; n++, y++) {
-        const u8 sprite_data = c8.memory[(c8.index_register + n) & 0xFFF];
-        // reset x_pixel_coord for each row
-        u8 x_pixel_coord = x;
-        for (i8 bit = 7; bit >= 0; bit--, x_pixel_coord++) {
-            const u8 sprite_bit = (sprite_data >> bit) & 0x1;
-            const u16 pixel_memory_address = x_pixel_coord + c8.display_width * y; 
-             
-            if (c8.display[pixel_memory_address & 0xFFF] == 1 &&
-                sprite_bit == 1)
-                Vf = 1;
-
-            c8.display[pixel_memory_address & 0xFFF] ^= sprite_bit;
-
-            if (x_pixel_coord + 1 >= display_width) break;
+    // obtain the 'n'-nibble containing the sprite_height using kk, rows
+    // below the bottom edge are dropped or wrap to the top. SUPER-CHIP's
+    // Dxy0 draws 16x16, two bytes a row.
+    const u8 sprite_height = large ? 16 : fields.kk & 0xF;
+    const u8 sprite_size = large ? 32 : sprite_height;
+    const u8 rows = wrap ? sprite_height : std::min<u8>(sprite_height, height_mask + 1 - y);
+    // the common case, one plane in low resolution
+    if (c8.selected_planes == 1 && !hires) {
+        Vf = c8.draw_plane<wrap, large, false>(c8.display.planes[0], c8.index_register, x, y, rows);
+        PROFILE(c8, count_draw());
+        return;
+    }
+    bool collision = false;
+    // each selected plane gets its own sprite, stored one after the other
+    u16 sprite_data = c8.index_register;
+    for (u8 planes = c8.selected_planes, plane = 0; planes; planes >>= 1, plane++) {
+        if (!(planes & 1)) continue;
+        BitPlane& pixels = c8.display.planes[plane];
+        if (hires) {
+            collision |= c8.draw_plane<wrap, large, true>(pixels, sprite_data, x, y, rows);
+        } else {
+            collision |= c8.draw_plane<wrap, large, false>(pixels, sprite_data, x, y, rows);
+        }
+        sprite_data += sprite_size;
+    }
+    Vf = collision;
+    PROFILE(c8, count_draw());
+}
+
+template <bool wrap, bool large, bool hires>
+bool Chip8::draw_plane(BitPlane& pixels, const u16 sprite_data, const u8 x, const u8 y, const u8 rows) {
+    constexpr u8 height_mask = hires ? hires_height - 1 : display_height - 1;
+    // the stores below don't touch the mask, but the compiler can't tell
+    const u16 mask = address_mask;
+    bool collision = false;
+    for (u8 n = 0; n < rows; n++) {
+        const u16 address = sprite_data + (large ? 2 * n : n);
+        const u16 sprite = large ? memory[address & mask] << 8 | memory[(address + 1) & mask] : memory[address & mask] << 8;
+        const u8 row = (y + n) & height_mask;
+        if constexpr (hires) {
+            collision |= draw_sprite_row<wrap>(pixels[row][0], pixels[row][1], sprite, x);
+        } else {
+            collision |= draw_sprite_row<wrap>(pixels[row][0], sprite, x);
         }
-        if (y + 1 >= display_height) break;
     }
+    // the drawn rows are consecutive, wrapping around at the bottom
+    const u64 drawn_rows = (u64{1} << rows) - 1;
+    if constexpr (hires) {
+        dirty_rows |= std::rotl(drawn_rows, y);
+    } else {
+        dirty_rows |= std::rotl(static_cast<u32>(drawn_rows), y);
+    }
+    return collision;
+}
+
+void Chip8::draw_vx_vy_nibble(Chip8& c8, const OpcodeFields& fields) {
+    draw<false, false>(c8, fields);
 }
 
+void Chip8::draw_vx_vy_nibble_wrap(Chip8& c8, const OpcodeFields& fields) {
+    draw<true, false>(c8, fields);
+}
+
+void Chip8::draw_vx_vy_large(Chip8& c8, const OpcodeFields& fields) {
+    draw<false, true>(c8, fields);
+}
+
+void Chip8::draw_vx_vy_large_wrap(Chip8& c8, const OpcodeFields& fields) {
+    draw<true, true>(c8, fields);
+}
+
+// scrolls move whole rows, or whole words within a row, and count in pixels
+// of the current mode
+void Chip8::scroll_down_n(Chip8& c8, const OpcodeFields& fields) {
+    const size_t n = fields.kk & 0xF;
+    const size_t height = c8.display.height();
+    for (size_t plane = 0; plane < Framebuffer::plane_count; plane++) {
+        if (!(c8.selected_planes & (1 << plane))) continue;
+        BitPlane& pixels = c8.display.planes[plane];
+        std::copy_backward(pixels.begin(), pixels.begin() + height - n, pixels.begin() + height);
+        std::fill_n(pixels.begin(), n, DisplayRow{});
+    }
+    c8.dirty_rows = ~u64{0};
+}
+
+void Chip8::scroll_up_n(Chip8& c8, const OpcodeFields& fields) {
+    const size_t n = fields.kk & 0xF;
+    const size_t height = c8.display.height();
+    for (size_t plane = 0; plane < Framebuffer::plane_count; plane++) {
+        if (!(c8.selected_planes & (1 << plane))) continue;
+        BitPlane& pixels = c8.display.planes[plane];
+        std::copy(pixels.begin() + n, pixels.begin() + height, pixels.begin());
+        std::fill_n(pixels.begin() + height - n, n, DisplayRow{});
+    }
+    c8.dirty_rows = ~u64{0};
+}
+
+void Chip8::scroll_right(Chip8& c8, const OpcodeFields& fields) {
+    for (size_t plane = 0; plane < Framebuffer::plane_count; plane++) {
+        if (!(c8.selected_planes & (1 << plane))) continue;
+        for (size_t row = 0; row < c8.display.height(); row++) {
+            DisplayRow& pixels = c8.display.planes[plane][row];
+            if (c8.display.hires) {
+                shift_row_right(pixels[0], pixels[1], 4);
+            } else {
+                pixels[0] >>= 4;
+            }
+        }
+    }
+    c8.dirty_rows = ~u64{0};
+}
+
+void Chip8::scroll_left(Chip8& c8, const OpcodeFields& fields) {
+    for (size_t plane = 0; plane < Framebuffer::plane_count; plane++) {
+        if (!(c8.selected_planes & (1 << plane))) continue;
+        for (size_t row = 0; row < c8.display.height(); row++) {
+            DisplayRow& pixels = c8.display.planes[plane][row];
+            if (c8.display.hires) {
+                shift_row_left(pixels[0], pixels[1], 4);
+            } else {
+                pixels[0] <<= 4;
+            }
+        }
+    }
+    c8.dirty_rows = ~u64{0};
+}
+
+void Chip8::exit(Chip8& c8, const OpcodeFields& fields) {
+    c8.raise_trap(TrapKind::exit);
+}
+
+// switching modes starts from a blank screen, pixels don't carry over
+void Chip8::low_res(Chip8& c8, const OpcodeFields& fields) {
+    c8.display.hires = false;
+    c8.clear_planes(0x3);
+}
+
+void Chip8::high_res(Chip8& c8, const OpcodeFields& fields) {
+    c8.display.hires = true;
+    c8.clear_planes(0x3);
+}
 
 void Chip8::skp_vx(Chip8& c8, const OpcodeFields& fields) {
     u8 vx = c8.registers[fields.x];
-    if (c8.keyboard.keys[vx]) {
+    if (c8.keyboard.keys[vx & 0xF]) {
         c8.program_counter += 2;
     }
 }
 
 void Chip8::sknp_vx(Chip8& c8, const OpcodeFields& fields) {
     u8 vx = c8.registers[fields.x];
-    if (!c8.keyboard.keys[vx]) {
+    if (!c8.keyboard.keys[vx & 0xF]) {
         c8.program_counter += 2;
     }
 
@@ -321,22 +641,110 @@ void Chip8::ld_f_vx(Chip8& c8, const OpcodeFields& fields) {
 
 void Chip8::ld_b_vx(Chip8& c8, const OpcodeFields& fields) {
     u8 vx = c8.registers[fields.x];
-    c8.memory[c8.index_register & 0xFFF] = vx / 100; // place the hundreds digit in memory at location in I
-    c8.memory[(c8.index_register + 1) & 0xFFF] = (vx / 10) % 10; // place the tens digit in memory at location in I + 1
-    c8.memory[(c8.index_register + 2) & 0xFFF] = vx % 10; // place the ones digit in memory at location in I + 2
+    c8.store(c8.index_register, vx / 100); // place the hundreds digit in memory at location in I
+    c8.store(c8.index_register + 1, (vx / 10) % 10); // place the tens digit in memory at location in I + 1
+    c8.store(c8.index_register + 2, vx % 10); // place the ones digit in memory at location in I + 2
 }
 
 void Chip8::ld_i_vx(Chip8& c8, const OpcodeFields& fields) {
     u8 vx = fields.x; 
     for (u8 reg = 0; reg <= vx; reg++) {
-        c8.memory[c8.index_register++ & 0xFFF] = c8.registers[reg];  
+        c8.store(c8.index_register++, c8.registers[reg]);
     }
 }
 
 void Chip8::ld_vx_i(Chip8& c8, const OpcodeFields& fields) {
     u8 vx = fields.x;
     for (u8 reg = 0; reg <= vx; reg++) {
-       c8.registers[reg] = c8.memory[c8.index_register++ & 0xFFF]; 
+       c8.registers[reg] = c8.load(c8.index_register++); 
+    }
+}
+
+// SUPER-CHIP leaves I where it was
+void Chip8::ld_i_vx_keep_i(Chip8& c8, const OpcodeFields& fields) {
+    for (u8 reg = 0; reg <= fields.x; reg++) {
+        c8.store(c8.index_register + reg, c8.registers[reg]);
+    }
+}
+
+void Chip8::ld_vx_i_keep_i(Chip8& c8, const OpcodeFields& fields) {
+    for (u8 reg = 0; reg <= fields.x; reg++) {
+        c8.registers[reg] = c8.load(c8.index_register + reg);
+    }
+}
+
+void Chip8::ld_hf_vx(Chip8& c8, const OpcodeFields& fields) {
+    const u8 digit = c8.registers[fields.x] & 0xF;
+    c8.index_register = 0xA0 + 10 * digit;
+}
+
+void Chip8::ld_r_vx(Chip8& c8, const OpcodeFields& fields) {
+    for (u8 reg = 0; reg <= fields.x; reg++) {
+        c8.flags[reg] = c8.registers[reg];
+    }
+}
+
+void Chip8::ld_vx_r(Chip8& c8, const OpcodeFields& fields) {
+    for (u8 reg = 0; reg <= fields.x; reg++) {
+        c8.registers[reg] = c8.flags[reg];
+    }
+}
+
+// 5xy2/5xy3 go from x to y, downwards if x is the larger one, I stays put
+void Chip8::ld_i_vx_vy(Chip8& c8, const OpcodeFields& fields) {
+    const int step = fields.x <= fields.y ? 1 : -1;
+    const int count = std::abs(fields.y - fields.x);
+    for (int n = 0; n <= count; n++) {
+        c8.store(c8.index_register + n, c8.registers[fields.x + n * step]);
     }
 }
 
+void Chip8::ld_vx_vy_i(Chip8& c8, const OpcodeFields& fields) {
+    const int step = fields.x <= fields.y ? 1 : -1;
+    const int count = std::abs(fields.y - fields.x);
+    for (int n = 0; n <= count; n++) {
+        c8.registers[fields.x + n * step] = c8.load(c8.index_register + n);
+    }
+}
+
+// the address is the whole next word, the pc moves past it as well
+void Chip8::ld_i_long(Chip8& c8, const OpcodeFields& fields) {
+    c8.index_register = c8.opcode_at(c8.program_counter);
+    c8.program_counter += 2;
+}
+
+void Chip8::plane_n(Chip8& c8, const OpcodeFields& fields) {
+    c8.selected_planes = fields.x & 0x3;
+}
+
+void Chip8::ld_audio_i(Chip8& c8, const OpcodeFields& fields) {
+    for (size_t n = 0; n < c8.audio_pattern.size(); n++) {
+        c8.audio_pattern[n] = c8.load(c8.index_register + n);
+    }
+}
+
+void Chip8::ld_pitch_vx(Chip8& c8, const OpcodeFields& fields) {
+    c8.pitch = c8.registers[fields.x];
+}
+
+
+void Chip8::invalid_opcode(Chip8& c8, const OpcodeFields& fields) {
+    c8.raise_trap(TrapKind::invalid_opcode);
+}
+
+void Chip8::raise_trap(const TrapKind kind) {
+    // handlers run after the program counter has moved past the instruction,
+    // step back so the trap points at the instruction that caused it.
+    program_counter -= 2;
+    trap = Trap{kind, program_counter, fetch_opcode()};
+}
+
+std::ostream& operator<<(std::ostream& os, const Trap& trap) {
+    switch (trap.kind) {
+        case TrapKind::invalid_opcode: os << "Instruction that doesn't exist: "; break;
+        case TrapKind::stack_overflow: os << "Stack overflow: "; break;
+        case TrapKind::stack_underflow: os << "Stack underflow: "; break;
+        case TrapKind::exit: os << "Program exited: "; break;
+    }
+    return os << std::hex << trap.opcode << " at " << trap.address << std::dec;
+}
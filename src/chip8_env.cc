@@ -0,0 +1,168 @@
+#include "include/chip8_env.h"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include "include/environment.h"
+
+struct chip8_env {
+    EnvironmentBatch batch;
+};
+
+struct chip8_env_state {
+    EnvironmentState state;
+};
+
+struct chip8_shared {
+    SharedBuffer buffer;
+};
+
+namespace {
+
+void report(const std::exception& e, char* error, const size_t error_size) {
+    if (!error || !error_size) return;
+    std::string message = e.what();
+    if (!message.empty() && message.back() == '\n') message.pop_back();
+    const size_t length = std::min(message.size(), error_size - 1);
+    std::memcpy(error, message.data(), length);
+    error[length] = '\0';
+}
+
+}
+
+chip8_env* chip8_env_create(const uint8_t* program, const size_t size, const size_t count, const int quirks,
+                            const int engine, const int observation, char* error, const size_t error_size) {
+    try {
+        if (quirks < 0 || static_cast<size_t>(quirks) >= quirk_profile_count)
+            throw std::runtime_error("Unknown quirk profile\n");
+        if (engine < CHIP8_ENGINE_INTERPRETER || engine > CHIP8_ENGINE_AOT)
+            throw std::runtime_error("Unknown engine\n");
+        if (observation != CHIP8_OBSERVATION_PACKED && observation != CHIP8_OBSERVATION_BYTES)
+            throw std::runtime_error("Unknown observation format\n");
+        return new chip8_env{EnvironmentBatch(count, std::span(program, size), static_cast<QuirkProfile>(quirks),
+                                              static_cast<EngineKind>(engine),
+                                              static_cast<ObservationFormat>(observation))};
+    } catch (const std::exception& e) {
+        report(e, error, error_size);
+        return nullptr;
+    }
+}
+
+void chip8_env_destroy(chip8_env* env) {
+    delete env;
+}
+
+size_t chip8_env_count(const chip8_env* env) {
+    return env->batch.size();
+}
+
+size_t chip8_env_observation_size(const chip8_env* env) {
+    return env->batch.observation_size();
+}
+
+void chip8_env_observation_shape(const chip8_env* env, size_t* width, size_t* height, size_t* planes) {
+    const ObservationShape& shape = env->batch.shape();
+    if (width) *width = shape.width;
+    if (height) *height = shape.height;
+    if (planes) *planes = shape.planes;
+}
+
+void chip8_env_set_cycles_per_frame(chip8_env* env, const uint32_t cycles) {
+    for (size_t i = 0; i < env->batch.size(); i++) {
+        env->batch[i].cycles_per_frame = cycles;
+    }
+}
+
+void chip8_env_set_max_frames(chip8_env* env, const uint64_t frames) {
+    for (size_t i = 0; i < env->batch.size(); i++) {
+        env->batch[i].max_frames = frames;
+    }
+}
+
+void chip8_env_set_reward(chip8_env* env, const chip8_env_reward reward, void* user) {
+    for (size_t i = 0; i < env->batch.size(); i++) {
+        if (reward) {
+            env->batch[i].reward = [env, i, reward, user](const Chip8&) { return reward(env, i, user); };
+        } else {
+            env->batch[i].reward = nullptr;
+        }
+    }
+}
+
+uint8_t chip8_env_peek(const chip8_env* env, const size_t index, const uint16_t address) {
+    return env->batch[index].machine().peek(address);
+}
+
+uint8_t chip8_env_register(const chip8_env* env, const size_t index, const uint8_t x) {
+    return env->batch[index].machine().reg(x);
+}
+
+uint64_t chip8_env_frames(const chip8_env* env, const size_t index) {
+    return env->batch[index].frames();
+}
+
+void chip8_env_reset_all(chip8_env* env, const uint32_t first_seed) {
+    env->batch.reset(first_seed);
+}
+
+void chip8_env_reset(chip8_env* env, const size_t index, const uint32_t seed) {
+    env->batch[index].reset(seed);
+}
+
+void chip8_env_step(chip8_env* env, const uint16_t* actions, const uint32_t frames, uint8_t* observations,
+                    float* rewards, uint8_t* done) {
+    const size_t count = env->batch.size();
+    env->batch.step(std::span(actions, count), frames, std::span(observations, count * env->batch.observation_size()),
+                    std::span(rewards, count), std::span(done, count));
+}
+
+void chip8_env_observe(const chip8_env* env, uint8_t* observations) {
+    env->batch.observe(std::span(observations, env->batch.size() * env->batch.observation_size()));
+}
+
+chip8_env_state* chip8_env_clone_state(const chip8_env* env, const size_t index, chip8_env_state* into) {
+    if (!into) into = new chip8_env_state;
+    env->batch[index].clone_state(into->state);
+    return into;
+}
+
+void chip8_env_restore_state(chip8_env* env, const size_t index, const chip8_env_state* state) {
+    env->batch[index].restore_state(state->state);
+}
+
+void chip8_env_free_state(chip8_env_state* state) {
+    delete state;
+}
+
+chip8_shared* chip8_shared_create(const char* name, const size_t size, char* error, const size_t error_size) {
+    try {
+        return new chip8_shared{SharedBuffer::create(name, size)};
+    } catch (const std::exception& e) {
+        report(e, error, error_size);
+        return nullptr;
+    }
+}
+
+chip8_shared* chip8_shared_open(const char* name, char* error, const size_t error_size) {
+    try {
+        return new chip8_shared{SharedBuffer::open(name)};
+    } catch (const std::exception& e) {
+        report(e, error, error_size);
+        return nullptr;
+    }
+}
+
+uint8_t* chip8_shared_data(const chip8_shared* shared) {
+    return shared->buffer.bytes().data();
+}
+
+size_t chip8_shared_size(const chip8_shared* shared) {
+    return shared->buffer.bytes().size();
+}
+
+void chip8_shared_close(chip8_shared* shared) {
+    delete shared;
+}
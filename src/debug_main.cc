@@ -0,0 +1,211 @@
+#include <atomic>
+#include <csignal>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "include/chip8.h"
+#include "include/debugger.h"
+#include "include/options.h"
+#include "include/quirks.h"
+#include "include/rom.h"
+#include "include/savestate.h"
+#include "include/scheduler.h"
+
+#ifdef __unix__
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+// runs a ROM under the debugger, driven from stdin or a Unix socket. see
+// DebugConsole in debugger.h for the commands.
+
+void print_usage() {
+    std::cout << "Example usage: \n";
+    std::cout << "./chip8_debug [--quirks=legacy|cosmac|schip|xochip] [--cycles-per-frame=n | --ips=n]\n";
+    std::cout << "              [--seed=n] [--load-state=path] [--socket=path] <file_path_here>\n";
+    std::cout << "reads commands from stdin, type help for a list. Ctrl-C stops a running machine.\n";
+    std::cout << "--socket=path serves the same commands on a Unix socket instead, one client at a time.\n";
+    std::cout << "              every reply ends with a line holding a single '.'\n";
+    std::cout << "--quirks defaults to the profile the ROM's instructions need\n";
+}
+
+namespace {
+
+std::atomic<bool> interrupted{false};
+
+void request_interrupt(int) {
+    interrupted = true;
+}
+
+int run_repl(DebugConsole& console) {
+#ifdef __unix__
+    const bool interactive = isatty(STDIN_FILENO);
+#else
+    const bool interactive = true;
+#endif
+    std::string line;
+    while (true) {
+        if (interactive) std::cout << "(chip8) " << std::flush;
+        if (!std::getline(std::cin, line)) break;
+        interrupted = false;
+        if (!console.execute(line, std::cout)) break;
+    }
+    return 0;
+}
+
+#ifdef __unix__
+bool send_all(const int fd, std::string_view data) {
+    while (!data.empty()) {
+        const ssize_t sent = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (sent <= 0) return false;
+        data.remove_prefix(sent);
+    }
+    return true;
+}
+
+// one connection, until the client hangs up or quits. returns false for
+// quit.
+bool serve_client(const int fd, DebugConsole& console) {
+    std::ostringstream greeting;
+    console.print_location(greeting);
+    greeting << ".\n";
+    if (!send_all(fd, greeting.str())) return true;
+
+    std::string pending;
+    char buffer[4096];
+    while (true) {
+        const ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+        if (received <= 0) return true;
+        pending.append(buffer, received);
+        size_t end;
+        while ((end = pending.find('\n')) != std::string::npos) {
+            const std::string line = pending.substr(0, end);
+            pending.erase(0, end + 1);
+            interrupted = false;
+            std::ostringstream reply;
+            const bool going = console.execute(line, reply);
+            reply << ".\n";
+            if (!send_all(fd, reply.str()) || !going) return going;
+        }
+    }
+}
+
+int run_server(const std::string& path, DebugConsole& console) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path is too long\n";
+        return 1;
+    }
+    path.copy(address.sun_path, path.size());
+
+    const int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path.c_str());
+    if (server < 0 || bind(server, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(server, 1) != 0) {
+        std::cerr << "Couldn't listen on " << path << '\n';
+        return 1;
+    }
+    std::cout << "listening on " << path << '\n';
+    bool going = true;
+    while (going) {
+        const int client = accept(server, nullptr, nullptr);
+        if (client < 0) continue;
+        going = serve_client(client, console);
+        close(client);
+    }
+    close(server);
+    unlink(path.c_str());
+    return 0;
+}
+#endif
+
+}
+
+int main(int argc, char** argv) {
+    std::optional<QuirkProfile> quirks;
+    u32 cycles_per_frame = 10;
+    std::optional<u32> seed;
+    std::string load_state_path;
+    std::string socket_path;
+    std::string rom_path;
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        auto value = [&](std::string_view option) { return std::string(arg.substr(option.size())); };
+
+        if (arg.starts_with("--quirks=")) {
+            quirks = parse_quirk_profile(value("--quirks="));
+            if (!quirks) {
+                std::cout << "Unknown quirk profile: " << arg << '\n';
+                print_usage();
+                return 1;
+            }
+        } else if (arg.starts_with("--cycles-per-frame=")) {
+            if (!parse_option(value("--cycles-per-frame="), cycles_per_frame)) return bad_option(arg, print_usage);
+        } else if (arg.starts_with("--ips=")) {
+            u32 ips = 0;
+            if (!parse_option(value("--ips="), ips)) return bad_option(arg, print_usage);
+            cycles_per_frame = cycles_for_speed(ips);
+        } else if (arg.starts_with("--seed=")) {
+            if (!parse_option(value("--seed="), seed)) return bad_option(arg, print_usage);
+        } else if (arg.starts_with("--load-state=")) {
+            load_state_path = value("--load-state=");
+        } else if (arg.starts_with("--socket=")) {
+            socket_path = value("--socket=");
+        } else if (rom_path.empty()) {
+            rom_path = arg;
+        } else {
+            std::cout << "Too many arguments passed.\n";
+            print_usage();
+            return 1;
+        }
+    }
+    if (rom_path.empty()) {
+        std::cout << "No ROM passed.\n";
+        print_usage();
+        return 1;
+    }
+
+    // bad ROMs and save states are reported rather than thrown
+    try {
+        const Rom rom(rom_path);
+        auto chip8 = std::make_unique<Chip8>();
+        chip8->set_quirks(quirks.value_or(analyze_rom(rom.bytes()).quirks));
+        chip8->load_program(rom.bytes());
+        if (seed) {
+            chip8->seed(*seed);
+        }
+        if (!load_state_path.empty()) {
+            load_state_file(*chip8, load_state_path);
+        }
+
+        Debugger debugger(*chip8);
+        debugger.cycles_per_frame = cycles_per_frame;
+        debugger.interrupt = &interrupted;
+        // Ctrl-C stops a running machine instead of the debugger, reads at the
+        // prompt are restarted
+        std::signal(SIGINT, request_interrupt);
+
+        DebugConsole console(debugger);
+        if (!socket_path.empty()) {
+#ifdef __unix__
+            return run_server(socket_path, console);
+#else
+            std::cout << "--socket needs a Unix host\n";
+            return 1;
+#endif
+        }
+        console.print_location(std::cout);
+        return run_repl(console);
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what();
+        return 1;
+    }
+}
@@ -0,0 +1,511 @@
+#include "include/debugger.h"
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+#include "include/disassembler.h"
+#include "include/engine.h"
+
+namespace {
+
+std::string hex(const unsigned value, const int width) {
+    std::ostringstream out;
+    out << "0x" << std::hex << std::uppercase << std::setw(width) << std::setfill('0') << value;
+    return out.str();
+}
+
+std::optional<u32> parse_number(const std::string_view text, const int base) {
+    u32 value = 0;
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value, base);
+    if (text.empty() || error != std::errc() || end != text.data() + text.size()) return std::nullopt;
+    return value;
+}
+
+std::optional<u32> parse_hex(std::string_view text) {
+    if (text.starts_with("0x") || text.starts_with("0X")) text.remove_prefix(2);
+    return parse_number(text, 16);
+}
+
+// V0-VF or I, case doesn't matter
+std::optional<u8> parse_register(const std::string_view text) {
+    if (text == "I" || text == "i") return Condition::index;
+    if (text.size() == 2 && (text[0] == 'V' || text[0] == 'v')) {
+        const std::optional<u32> reg = parse_hex(text.substr(1));
+        if (reg) return static_cast<u8>(*reg);
+    }
+    return std::nullopt;
+}
+
+constexpr std::pair<std::string_view, Condition::Op> operators[] = {
+    // two character ones first, so <= isn't taken for <
+    {"==", Condition::Op::equal},
+    {"!=", Condition::Op::not_equal},
+    {"<=", Condition::Op::less_equal},
+    {">=", Condition::Op::greater_equal},
+    {"<", Condition::Op::less},
+    {">", Condition::Op::greater},
+};
+
+std::vector<std::string_view> split(const std::string_view line) {
+    std::vector<std::string_view> words;
+    size_t at = 0;
+    while (at < line.size()) {
+        const size_t start = line.find_first_not_of(" \t\r", at);
+        if (start == std::string_view::npos) break;
+        const size_t end = std::min(line.find_first_of(" \t\r", start), line.size());
+        words.push_back(line.substr(start, end - start));
+        at = end;
+    }
+    return words;
+}
+
+}
+
+bool Condition::holds(const Chip8& c8) const {
+    const u16 current = target == index ? c8.index() : c8.reg(target);
+    switch (op) {
+        case Op::equal: return current == value;
+        case Op::not_equal: return current != value;
+        case Op::less: return current < value;
+        case Op::less_equal: return current <= value;
+        case Op::greater: return current > value;
+        case Op::greater_equal: return current >= value;
+    }
+    return false;
+}
+
+std::optional<Condition> parse_condition(const std::string_view text) {
+    std::string compact;
+    for (const char c : text) {
+        if (c != ' ' && c != '\t') compact += c;
+    }
+    for (const auto& [symbol, op] : operators) {
+        const size_t at = compact.find(symbol);
+        if (at == std::string::npos) continue;
+        const std::optional<u8> target = parse_register(std::string_view(compact).substr(0, at));
+        const std::optional<u32> value = parse_hex(std::string_view(compact).substr(at + symbol.size()));
+        if (!target || !value || *value > 0xFFFF) return std::nullopt;
+        return Condition{*target, op, static_cast<u16>(*value)};
+    }
+    return std::nullopt;
+}
+
+std::ostream& operator<<(std::ostream& os, const Condition& condition) {
+    if (condition.target == Condition::index) {
+        os << 'I';
+    } else {
+        os << 'V' << std::hex << std::uppercase << int(condition.target) << std::dec;
+    }
+    for (const auto& [symbol, op] : operators) {
+        if (op == condition.op) os << ' ' << symbol << ' ';
+    }
+    return os << hex(condition.value, condition.target == Condition::index ? 3 : 2);
+}
+
+// what the interpreter loop asks before every instruction. busy loops run
+// instruction by instruction, their iterations may hit something as well.
+struct Debugger::Hooks {
+    static constexpr bool fast_forward = false;
+
+    bool stop(const Chip8&) {
+        stopped = debugger.check(until, first);
+        first = false;
+        return stopped.has_value();
+    }
+    void executed(const Chip8&) {}
+
+    Debugger& debugger;
+    const Until& until;
+    bool first = true;
+    std::optional<Stop> stopped;
+};
+
+u32 Debugger::add_breakpoint(const u16 address, std::optional<Condition> condition) {
+    breakpoints.push_back({next_id, address, condition});
+    return next_id++;
+}
+
+u32 Debugger::add_watchpoint(const u16 first, const u16 last, const u8 access) {
+    watchpoints.push_back({next_id, std::min(first, last), std::max(first, last), access});
+    return next_id++;
+}
+
+u32 Debugger::add_condition(const Condition& condition) {
+    conditions.push_back({next_id, condition, condition.holds(c8)});
+    return next_id++;
+}
+
+bool Debugger::remove(const u32 id) {
+    const auto matches = [id](const auto& point) { return point.id == id; };
+    return std::erase_if(breakpoints, matches) + std::erase_if(watchpoints, matches) +
+               std::erase_if(conditions, matches) > 0;
+}
+
+bool Debugger::has_breakpoint(const u16 address) const {
+    return std::any_of(breakpoints.begin(), breakpoints.end(),
+                       [address](const Breakpoint& point) { return point.address == address; });
+}
+
+void Debugger::print_points(std::ostream& os) const {
+    if (breakpoints.empty() && watchpoints.empty() && conditions.empty()) {
+        os << "no breakpoints, watchpoints or conditions\n";
+        return;
+    }
+    for (const Breakpoint& point : breakpoints) {
+        os << point.id << "  break " << hex(point.address, 3);
+        if (point.condition) os << " if " << *point.condition;
+        os << '\n';
+    }
+    for (const Watchpoint& point : watchpoints) {
+        os << point.id << "  watch " << hex(point.first, 3);
+        if (point.last != point.first) os << '-' << hex(point.last, 3);
+        os << ' ' << (point.access & access_read ? "r" : "") << (point.access & access_write ? "w" : "") << '\n';
+    }
+    for (const ConditionPoint& point : conditions) {
+        os << point.id << "  when " << point.condition << '\n';
+    }
+}
+
+Debugger::MemoryAccess Debugger::memory_access() const {
+    const u16 opcode = c8.opcode_at(c8.program_counter);
+    const CallBack handler = c8.fetch_instruction(opcode).handler;
+    const OpcodeFields fields(opcode);
+    // every selected plane gets a sprite of its own, see Chip8::draw
+    const u16 planes = std::popcount(c8.selected_planes);
+    const u16 range = std::abs(fields.x - fields.y) + 1;
+
+    MemoryAccess access{c8.index_register, 0, 0};
+    if (handler == Chip8::draw_vx_vy_nibble || handler == Chip8::draw_vx_vy_nibble_wrap) {
+        access = {c8.index_register, static_cast<u16>((opcode & 0xF) * planes), access_read};
+    } else if (handler == Chip8::draw_vx_vy_large || handler == Chip8::draw_vx_vy_large_wrap) {
+        access = {c8.index_register, static_cast<u16>(32 * planes), access_read};
+    } else if (handler == Chip8::ld_b_vx) {
+        access = {c8.index_register, 3, access_write};
+    } else if (handler == Chip8::ld_i_vx || handler == Chip8::ld_i_vx_keep_i) {
+        access = {c8.index_register, static_cast<u16>(fields.x + 1), access_write};
+    } else if (handler == Chip8::ld_vx_i || handler == Chip8::ld_vx_i_keep_i) {
+        access = {c8.index_register, static_cast<u16>(fields.x + 1), access_read};
+    } else if (handler == Chip8::ld_i_vx_vy) {
+        access = {c8.index_register, range, access_write};
+    } else if (handler == Chip8::ld_vx_vy_i) {
+        access = {c8.index_register, range, access_read};
+    } else if (handler == Chip8::ld_audio_i) {
+        access = {c8.index_register, static_cast<u16>(c8.audio_pattern.size()), access_read};
+    }
+    return access;
+}
+
+std::optional<Stop> Debugger::check(const Until& until, const bool first) {
+    // conditions see every instruction, the first included, so one that
+    // already held when the command started doesn't fire right away
+    std::optional<Stop> turned_true;
+    for (ConditionPoint& point : conditions) {
+        const bool holds = point.condition.holds(c8);
+        if (holds && !point.held && !turned_true) turned_true = Stop{Stop::Reason::condition, point.id};
+        point.held = holds;
+    }
+    // the instruction a command starts on always runs
+    if (first) return std::nullopt;
+
+    const u16 pc = c8.program_counter;
+    if (until.step) return Stop{Stop::Reason::step};
+    if (until.address && pc == *until.address && c8.stack_pointer <= until.depth) return Stop{Stop::Reason::step};
+    if (until.below && c8.stack_pointer < *until.below) return Stop{Stop::Reason::step};
+
+    for (const Breakpoint& point : breakpoints) {
+        if (point.address == pc && (!point.condition || point.condition->holds(c8))) {
+            return Stop{Stop::Reason::breakpoint, point.id};
+        }
+    }
+    if (!watchpoints.empty()) {
+        const MemoryAccess access = memory_access();
+        for (u16 n = 0; n < access.count; n++) {
+            const u16 address = (access.start + n) & c8.address_mask;
+            for (const Watchpoint& point : watchpoints) {
+                if ((point.access & access.access) && address >= point.first && address <= point.last) {
+                    return Stop{Stop::Reason::watchpoint, point.id, address, access.access};
+                }
+            }
+        }
+    }
+    return turned_true;
+}
+
+Stop Debugger::run(const Until& until) {
+    Hooks hooks{*this, until, true, std::nullopt};
+    while (true) {
+        if (c8.trap) return Stop{Stop::Reason::trap};
+        const u64 executed = interpret(c8, cycles_per_frame - in_frame, hooks);
+        in_frame += executed;
+        instruction_count += executed;
+        if (hooks.stopped) return *hooks.stopped;
+
+        // the frame's instructions ran out or the machine halted, the frame
+        // ends like Runner ends it
+        frame_count++;
+        in_frame = 0;
+        c8.tick_timers();
+        if (c8.trap) return Stop{Stop::Reason::trap};
+        if (c8.halted()) return Stop{Stop::Reason::waiting};
+        if (interrupt && interrupt->load()) return Stop{Stop::Reason::interrupted};
+        if (until.frame && frame_count >= *until.frame) return Stop{Stop::Reason::frames};
+    }
+}
+
+Stop Debugger::resume(const u64 frames) {
+    Until until;
+    if (frames) until.frame = frame_count + frames;
+    return run(until);
+}
+
+Stop Debugger::step() {
+    Until until;
+    until.step = true;
+    return run(until);
+}
+
+Stop Debugger::step_over() {
+    const u16 opcode = c8.opcode_at(c8.program_counter);
+    if (c8.fetch_instruction(opcode).handler != Chip8::call_addr) return step();
+    Until until;
+    until.address = c8.program_counter + 2;
+    until.depth = c8.stack_pointer;
+    return run(until);
+}
+
+Stop Debugger::finish() {
+    Until until;
+    until.below = c8.stack_pointer;
+    return run(until);
+}
+
+bool DebugConsole::execute(const std::string_view line, std::ostream& out) {
+    std::vector<std::string_view> words = split(line);
+    if (words.empty()) {
+        words = split(last);
+        if (words.empty()) return true;
+    } else {
+        last = line;
+    }
+    Chip8& c8 = debugger.machine();
+    const std::string_view command = words[0];
+    const auto number = [&](const size_t at, const u32 fallback) -> std::optional<u32> {
+        return at < words.size() ? parse_hex(words[at]) : fallback;
+    };
+    // the rest of the line after the word at, for conditions with spaces
+    const auto rest = [&](const size_t at) {
+        return at < words.size() ? line.substr(words[at].data() - line.data()) : std::string_view();
+    };
+
+    if (command == "help" || command == "h") {
+        out << "break addr [if cond]        stop before the instruction at addr, when cond holds\n"
+               "watch first [last] [r|w|rw] stop before an instruction accesses memory in [first, last] through I\n"
+               "when cond                   stop once cond turns true, e.g. when V3 == 2 or when I >= 300\n"
+               "delete id                   remove a breakpoint, watchpoint or condition\n"
+               "info                        list them\n"
+               "continue [n], c             run until something stops the machine, or for n frames\n"
+               "step, s                     run one instruction\n"
+               "next, n                     run one instruction, a call with its whole subroutine\n"
+               "finish, f                   run until the current subroutine returns\n"
+               "regs, r                     registers, timers and counters\n"
+               "stack                       the call stack, innermost last\n"
+               "mem addr [n], x             n bytes of memory, 0x40 by default\n"
+               "list [addr] [n], l          n instructions from addr, 0x10 from the pc by default\n"
+               "press key, release key      change a key of the keypad\n"
+               "set Vx|I|pc value           change a register\n"
+               "quit, q\n"
+               "numbers are hex except ids and frame counts, an empty line repeats the last command\n";
+    } else if (command == "break" || command == "b") {
+        const std::optional<u32> address = number(1, c8.pc());
+        std::optional<Condition> condition;
+        if (words.size() > 2) {
+            if (words[2] == "if") condition = parse_condition(rest(3));
+            if (!condition) {
+                out << "Expected break addr [if cond], e.g. break 230 if V3 == 2\n";
+                return true;
+            }
+        }
+        if (!address || *address > 0xFFFF) {
+            out << "Expected an address\n";
+            return true;
+        }
+        out << "breakpoint " << debugger.add_breakpoint(*address, condition) << " at " << hex(*address, 3) << '\n';
+    } else if (command == "watch" || command == "w") {
+        const std::optional<u32> first = number(1, 0);
+        size_t at = 2;
+        std::optional<u32> last = first;
+        if (words.size() > 2 && parse_hex(words[2])) last = number(at++, 0);
+        u8 access = access_read | access_write;
+        if (at < words.size()) {
+            access = words[at] == "r" ? access_read : words[at] == "w" ? access_write : words[at] == "rw" ? access : 0;
+        }
+        if (words.size() < 2 || !first || !last || *first > 0xFFFF || *last > 0xFFFF || !access) {
+            out << "Expected watch first [last] [r|w|rw]\n";
+            return true;
+        }
+        out << "watchpoint " << debugger.add_watchpoint(*first, *last, access) << '\n';
+    } else if (command == "when") {
+        const std::optional<Condition> condition = parse_condition(rest(1));
+        if (!condition) {
+            out << "Expected when cond, e.g. when V3 == 2\n";
+            return true;
+        }
+        out << "condition " << debugger.add_condition(*condition) << ": " << *condition << '\n';
+    } else if (command == "delete" || command == "d") {
+        // ids and frame counts aren't hex, they're counted
+        const std::optional<u32> id = words.size() > 1 ? parse_number(words[1], 10) : std::nullopt;
+        if (!id || !debugger.remove(*id)) out << "No such breakpoint, watchpoint or condition\n";
+    } else if (command == "info" || command == "i") {
+        debugger.print_points(out);
+    } else if (command == "continue" || command == "c") {
+        const std::optional<u32> frames = words.size() > 1 ? parse_number(words[1], 10) : 0;
+        if (!frames) {
+            out << "Expected continue [n]\n";
+            return true;
+        }
+        report(out, debugger.resume(*frames));
+    } else if (command == "step" || command == "s") {
+        report(out, debugger.step());
+    } else if (command == "next" || command == "n") {
+        report(out, debugger.step_over());
+    } else if (command == "finish" || command == "f") {
+        if (c8.stack_pointer == 0) {
+            out << "Not in a subroutine\n";
+            return true;
+        }
+        report(out, debugger.finish());
+    } else if (command == "regs" || command == "r") {
+        print_registers(out);
+    } else if (command == "stack") {
+        print_stack(out);
+    } else if (command == "mem" || command == "x") {
+        const std::optional<u32> address = number(1, c8.index_register);
+        const std::optional<u32> count = number(2, 0x40);
+        if (!address || !count) {
+            out << "Expected mem addr [n]\n";
+            return true;
+        }
+        print_memory(out, *address, std::min<u32>(*count, 0x1000));
+    } else if (command == "list" || command == "l") {
+        const std::optional<u32> address = number(1, c8.pc());
+        const std::optional<u32> count = number(2, 0x10);
+        if (!address || !count) {
+            out << "Expected list [addr] [n]\n";
+            return true;
+        }
+        print_listing(out, *address, std::min<u32>(*count, 0x400));
+    } else if (command == "press" || command == "release") {
+        const std::optional<u32> key = number(1, 0x10);
+        if (!key || *key > 0xF) {
+            out << "Expected a key, 0-F\n";
+            return true;
+        }
+        if (command == "press") {
+            c8.press_key(*key);
+        } else {
+            c8.release_key(*key);
+        }
+    } else if (command == "set") {
+        const std::optional<u32> value = number(2, 0x10000);
+        if (words.size() < 3 || !value || *value > 0xFFFF) {
+            out << "Expected set Vx|I|pc value\n";
+            return true;
+        }
+        const std::optional<u8> reg = parse_register(words[1]);
+        if (words[1] == "pc") {
+            c8.program_counter = *value & c8.address_mask;
+        } else if (reg == Condition::index) {
+            c8.index_register = *value;
+        } else if (reg && *reg < 16) {
+            c8.registers[*reg] = *value;
+        } else {
+            out << "Unknown register " << words[1] << '\n';
+        }
+    } else if (command == "quit" || command == "q") {
+        return false;
+    } else {
+        out << "Unknown command " << command << ", try help\n";
+    }
+    return true;
+}
+
+void DebugConsole::report(std::ostream& out, const Stop& stop) const {
+    const Chip8& c8 = debugger.machine();
+    switch (stop.reason) {
+        case Stop::Reason::step: break;
+        case Stop::Reason::breakpoint: out << "breakpoint " << stop.id << '\n'; break;
+        case Stop::Reason::watchpoint:
+            out << "watchpoint " << stop.id << ": " << (stop.access == access_write ? "write to " : "read of ")
+                << hex(stop.address, 3) << '\n';
+            break;
+        case Stop::Reason::condition: out << "condition " << stop.id << '\n'; break;
+        case Stop::Reason::trap: out << *c8.trap << '\n'; break;
+        case Stop::Reason::waiting:
+            out << "waiting for a key into V" << std::hex << std::uppercase << int(c8.keyboard.wait_register)
+                << std::dec << ", press one\n";
+            break;
+        case Stop::Reason::interrupted: out << "interrupted\n"; break;
+        case Stop::Reason::frames: break;
+    }
+    print_location(out);
+}
+
+void DebugConsole::print_location(std::ostream& out) const {
+    out << "frame " << debugger.frames() << ", instruction " << debugger.instructions() << '\n';
+    print_listing(out, debugger.machine().pc(), 1);
+}
+
+void DebugConsole::print_registers(std::ostream& out) const {
+    const Chip8& c8 = debugger.machine();
+    out << "pc " << hex(c8.program_counter, 3) << "  I " << hex(c8.index_register, 3) << "  sp "
+        << int(c8.stack_pointer) << "  DT " << hex(c8.timer_delay, 2) << "  ST " << hex(c8.sound_delay, 2) << '\n';
+    for (u8 reg = 0; reg < 16; reg++) {
+        out << 'V' << std::hex << std::uppercase << int(reg) << std::dec << ' ' << hex(c8.registers[reg], 2)
+            << (reg % 8 == 7 ? "\n" : "  ");
+    }
+    out << "keys held " << hex(c8.held_keys(), 4) << "  frame " << debugger.frames() << "  instruction "
+        << debugger.instructions() << '\n';
+}
+
+void DebugConsole::print_stack(std::ostream& out) const {
+    const Chip8& c8 = debugger.machine();
+    if (c8.stack_pointer == 0) out << "not in a subroutine\n";
+    for (u8 level = 0; level < std::min<size_t>(c8.stack_pointer, Chip8::stack_depth); level++) {
+        // each entry is the address the ret goes back to, the call is before it
+        const u16 call = c8.stack[level] - 2;
+        out << int(level) << "  called from " << hex(call, 3) << ", " << disassemble(c8.opcode_at(call), c8.quirks())
+            << '\n';
+    }
+}
+
+void DebugConsole::print_memory(std::ostream& out, const u16 address, const u16 count) const {
+    const Chip8& c8 = debugger.machine();
+    for (u16 row = 0; row < count; row += 16) {
+        out << hex((address + row) & c8.address_mask, 4) << ':';
+        for (u16 n = row; n < std::min<u16>(row + 16, count); n++) {
+            out << ' ' << std::hex << std::uppercase << std::setw(2) << std::setfill('0')
+                << int(c8.peek(address + n)) << std::dec;
+        }
+        out << '\n';
+    }
+}
+
+void DebugConsole::print_listing(std::ostream& out, const u16 address, const u16 count) const {
+    const Chip8& c8 = debugger.machine();
+    u16 at = address & c8.address_mask;
+    for (u16 n = 0; n < count; n++) {
+        const u16 opcode = c8.opcode_at(at);
+        out << (at == c8.pc() ? "=> " : "   ") << (debugger.has_breakpoint(at) ? '*' : ' ') << ' ' << hex(at, 3)
+            << "  " << hex(opcode, 4) << "  " << disassemble(opcode, c8.quirks());
+        // F000's address is the word after it
+        if (c8.fetch_instruction(opcode).handler == Chip8::ld_i_long) {
+            at = (at + 2) & c8.address_mask;
+            out << ' ' << hex(c8.opcode_at(at), 4);
+        }
+        out << '\n';
+        at = (at + 2) & c8.address_mask;
+    }
+}
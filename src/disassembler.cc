@@ -0,0 +1,223 @@
+#include "include/disassembler.h"
+
+#include <array>
+#include <iomanip>
+#include <set>
+#include <sstream>
+#include "include/block_cache.h"
+
+namespace {
+
+struct HandlerInfo {
+    CallBack handler;
+    const char* name;
+    // %x/%y are the register nibbles, %n the low nibble, %k the low byte,
+    // %a the address and %o the whole opcode
+    const char* mnemonic;
+};
+
+constexpr std::array<HandlerInfo, 69> handlers = {{
+    {Chip8::cls, "cls", "CLS"},
+    {Chip8::ret, "ret", "RET"},
+    {Chip8::jp_addr, "jp_addr", "JP %a"},
+    {Chip8::call_addr, "call_addr", "CALL %a"},
+    {Chip8::skip_next_ife_vxkk, "skip_next_ife_vxkk", "SE V%x, %k"},
+    {Chip8::skip_next_ifne_vxkk, "skip_next_ifne_vxkk", "SNE V%x, %k"},
+    {Chip8::skip_next_ife_vxvy, "skip_next_ife_vxvy", "SE V%x, V%y"},
+    {Chip8::ld_vx_kk, "ld_vx_kk", "LD V%x, %k"},
+    {Chip8::add_vx_kk, "add_vx_kk", "ADD V%x, %k"},
+    {Chip8::ld_vx_vy, "ld_vx_vy", "LD V%x, V%y"},
+    {Chip8::or_vx_vy, "or_vx_vy", "OR V%x, V%y"},
+    {Chip8::and_vx_vy, "and_vx_vy", "AND V%x, V%y"},
+    {Chip8::xor_vx_vy, "xor_vx_vy", "XOR V%x, V%y"},
+    {Chip8::or_vx_vy_reset_vf, "or_vx_vy_reset_vf", "OR V%x, V%y"},
+    {Chip8::and_vx_vy_reset_vf, "and_vx_vy_reset_vf", "AND V%x, V%y"},
+    {Chip8::xor_vx_vy_reset_vf, "xor_vx_vy_reset_vf", "XOR V%x, V%y"},
+    {Chip8::add_vx_vy, "add_vx_vy", "ADD V%x, V%y"},
+    {Chip8::sub_vx_vy, "sub_vx_vy", "SUB V%x, V%y"},
+    {Chip8::shr_vx_vy, "shr_vx_vy", "SHR V%x, V%y"},
+    {Chip8::subn_vx_vy, "subn_vx_vy", "SUBN V%x, V%y"},
+    {Chip8::shl_vx_vy, "shl_vx_vy", "SHL V%x, V%y"},
+    {Chip8::shr_vx, "shr_vx", "SHR V%x"},
+    {Chip8::shl_vx, "shl_vx", "SHL V%x"},
+    {Chip8::skip_next_ifne_vx_vy, "skip_next_ifne_vx_vy", "SNE V%x, V%y"},
+    {Chip8::ld_iaddr, "ld_iaddr", "LD I, %a"},
+    {Chip8::jp_offset, "jp_offset", "JP V0, %a"},
+    {Chip8::jp_offset_vx, "jp_offset_vx", "JP V%x, %a"},
+    {Chip8::rnd_vx_kk, "rnd_vx_kk", "RND V%x, %k"},
+    {Chip8::draw_vx_vy_nibble, "draw_vx_vy_nibble", "DRW V%x, V%y, %n"},
+    {Chip8::draw_vx_vy_nibble_wrap, "draw_vx_vy_nibble_wrap", "DRW V%x, V%y, %n"},
+    {Chip8::skp_vx, "skp_vx", "SKP V%x"},
+    {Chip8::sknp_vx, "sknp_vx", "SKNP V%x"},
+    {Chip8::ld_vx_dt, "ld_vx_dt", "LD V%x, DT"},
+    {Chip8::ld_vx_key, "ld_vx_key", "LD V%x, K"},
+    {Chip8::ld_dt_vx, "ld_dt_vx", "LD DT, V%x"},
+    {Chip8::ld_st_vx, "ld_st_vx", "LD ST, V%x"},
+    {Chip8::add_i_vx, "add_i_vx", "ADD I, V%x"},
+    {Chip8::ld_f_vx, "ld_f_vx", "LD F, V%x"},
+    {Chip8::ld_b_vx, "ld_b_vx", "LD B, V%x"},
+    {Chip8::ld_i_vx, "ld_i_vx", "LD [I], V%x"},
+    {Chip8::ld_vx_i, "ld_vx_i", "LD V%x, [I]"},
+    {Chip8::ld_i_vx_keep_i, "ld_i_vx_keep_i", "LD [I], V%x"},
+    {Chip8::ld_vx_i_keep_i, "ld_vx_i_keep_i", "LD V%x, [I]"},
+    {Chip8::add_i_vx_wide, "add_i_vx_wide", "ADD I, V%x"},
+    {Chip8::draw_vx_vy_large, "draw_vx_vy_large", "DRW V%x, V%y, 0"},
+    {Chip8::draw_vx_vy_large_wrap, "draw_vx_vy_large_wrap", "DRW V%x, V%y, 0"},
+    {Chip8::scroll_down_n, "scroll_down_n", "SCD %n"},
+    {Chip8::scroll_right, "scroll_right", "SCR"},
+    {Chip8::scroll_left, "scroll_left", "SCL"},
+    {Chip8::exit, "exit", "EXIT"},
+    {Chip8::low_res, "low_res", "LOW"},
+    {Chip8::high_res, "high_res", "HIGH"},
+    {Chip8::ld_hf_vx, "ld_hf_vx", "LD HF, V%x"},
+    {Chip8::ld_r_vx, "ld_r_vx", "LD R, V%x"},
+    {Chip8::ld_vx_r, "ld_vx_r", "LD V%x, R"},
+    {Chip8::scroll_up_n, "scroll_up_n", "SCU %n"},
+    {Chip8::ld_i_vx_vy, "ld_i_vx_vy", "SAVE V%x - V%y"},
+    {Chip8::ld_vx_vy_i, "ld_vx_vy_i", "LOAD V%x - V%y"},
+    {Chip8::ld_i_long, "ld_i_long", "LD I, LONG"},
+    {Chip8::plane_n, "plane_n", "PLANE %x"},
+    {Chip8::ld_audio_i, "ld_audio_i", "AUDIO"},
+    {Chip8::ld_pitch_vx, "ld_pitch_vx", "PITCH V%x"},
+    {Chip8::skip_next_ife_vxkk_long, "skip_next_ife_vxkk_long", "SE V%x, %k"},
+    {Chip8::skip_next_ifne_vxkk_long, "skip_next_ifne_vxkk_long", "SNE V%x, %k"},
+    {Chip8::skip_next_ife_vxvy_long, "skip_next_ife_vxvy_long", "SE V%x, V%y"},
+    {Chip8::skip_next_ifne_vx_vy_long, "skip_next_ifne_vx_vy_long", "SNE V%x, V%y"},
+    {Chip8::skp_vx_long, "skp_vx_long", "SKP V%x"},
+    {Chip8::sknp_vx_long, "sknp_vx_long", "SKNP V%x"},
+    {Chip8::invalid_opcode, "invalid_opcode", "DW %o"},
+}};
+
+const HandlerInfo* info_of(const CallBack handler) {
+    for (const HandlerInfo& info : handlers) {
+        if (info.handler == handler) return &info;
+    }
+    return nullptr;
+}
+
+std::string hex(const unsigned value, const int width) {
+    std::ostringstream out;
+    out << "0x" << std::hex << std::uppercase << std::setw(width) << std::setfill('0') << value;
+    return out.str();
+}
+
+}
+
+const char* handler_name(const CallBack handler) {
+    const HandlerInfo* info = info_of(handler);
+    return info ? info->name : "unknown";
+}
+
+std::string disassemble(const u16 opcode, const QuirkProfile profile) {
+    const HandlerInfo* info = info_of(instruction_tables[static_cast<size_t>(profile)][opcode].handler);
+    if (!info) return "DW " + hex(opcode, 4);
+
+    std::string text;
+    for (const char* c = info->mnemonic; *c; c++) {
+        if (*c != '%') {
+            text += *c;
+            continue;
+        }
+        std::ostringstream field;
+        field << std::hex << std::uppercase;
+        switch (*++c) {
+            case 'x': field << ((opcode >> 8) & 0xF); break;
+            case 'y': field << ((opcode >> 4) & 0xF); break;
+            case 'n': field << (opcode & 0xF); break;
+            case 'k': field << hex(opcode & 0xFF, 2); break;
+            case 'a': field << hex(opcode & 0xFFF, 3); break;
+            case 'o': field << hex(opcode, 4); break;
+        }
+        text += field.str();
+    }
+    return text;
+}
+
+ControlFlowGraph recover_control_flow(std::span<const u8> program, const QuirkProfile profile) {
+    ControlFlowGraph graph;
+    const InstructionTable& table = instruction_tables[static_cast<size_t>(profile)];
+    const u32 program_end = Chip8::program_start + program.size();
+
+    const auto fits = [&](const u32 address) {
+        return address >= Chip8::program_start && address + 2 <= program_end;
+    };
+    const auto opcode_at = [&](const u32 address) -> u16 {
+        return program[address - Chip8::program_start] << 8 | program[address + 1 - Chip8::program_start];
+    };
+    // F000 nnnn takes up the next word as well
+    const auto size_at = [&](const u32 address) -> u32 {
+        return fits(address) && table[opcode_at(address)].handler == Chip8::ld_i_long ? 4 : 2;
+    };
+    // where control can go after the instruction at address, when it ends a
+    // block
+    const auto successors_of = [&](const u32 address, std::vector<u16>& successors) {
+        const u16 opcode = opcode_at(address);
+        const CallBack handler = table[opcode].handler;
+        const u32 next = address + 2;
+        const u16 nnn = opcode & 0xFFF;
+        if (handler == Chip8::jp_addr) {
+            successors = {nnn};
+        } else if (handler == Chip8::call_addr) {
+            successors = {nnn, static_cast<u16>(next)};
+        } else if (handler == Chip8::jp_offset || handler == Chip8::jp_offset_vx) {
+            graph.indirect_jumps = true;
+        } else if (handler == Chip8::ld_i_long) {
+            successors = {static_cast<u16>(address + 4)};
+        } else if (handler == Chip8::ld_vx_key) {
+            successors = {static_cast<u16>(next)};
+        } else if (handler == Chip8::skip_next_ife_vxkk_long || handler == Chip8::skip_next_ifne_vxkk_long ||
+                   handler == Chip8::skip_next_ife_vxvy_long || handler == Chip8::skip_next_ifne_vx_vy_long ||
+                   handler == Chip8::skp_vx_long || handler == Chip8::sknp_vx_long) {
+            successors = {static_cast<u16>(next), static_cast<u16>(next + size_at(next))};
+        } else if (handler != Chip8::ret && handler != Chip8::exit && handler != Chip8::invalid_opcode) {
+            // the plain skips
+            successors = {static_cast<u16>(next), static_cast<u16>(next + 2)};
+        }
+    };
+
+    // first every reachable instruction and every address control arrives
+    // at from somewhere other than the instruction before it
+    std::set<u16> leaders;
+    std::vector<bool> reachable(program.size());
+    std::vector<u32> pending{Chip8::program_start};
+    leaders.insert(Chip8::program_start);
+    while (!pending.empty()) {
+        u32 address = pending.back();
+        pending.pop_back();
+        for (; fits(address) && !reachable[address - Chip8::program_start]; address += 2) {
+            reachable[address - Chip8::program_start] = true;
+            if (!BlockCache::ends_block(table[opcode_at(address)].handler)) continue;
+
+            std::vector<u16> successors;
+            successors_of(address, successors);
+            for (const u16 successor : successors) {
+                leaders.insert(successor);
+                pending.push_back(successor);
+            }
+            break;
+        }
+    }
+
+    // then the blocks, each running up to its last instruction or the next
+    // leader
+    for (const u16 start : leaders) {
+        if (!fits(start)) continue;
+        BasicBlock block;
+        block.start = start;
+        for (u32 address = start;; address += 2) {
+            block.length++;
+            if (BlockCache::ends_block(table[opcode_at(address)].handler)) {
+                block.end = address + size_at(address);
+                successors_of(address, block.successors);
+                break;
+            }
+            if (!fits(address + 2) || leaders.contains(address + 2)) {
+                block.end = address + 2;
+                block.successors = {static_cast<u16>(address + 2)};
+                break;
+            }
+        }
+        graph.blocks.emplace(start, std::move(block));
+    }
+    return graph;
+}
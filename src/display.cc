@@ -1,5 +1,7 @@
 #include "include/display.h"
+#include <bit>
 #include <iostream>
+#include "include/framebuffer.h"
 
 bool Display::initialize() {
     if((SDL_Init(SDL_INIT_VIDEO|SDL_INIT_AUDIO) == -1)) { 
@@ -27,22 +29,59 @@ bool Display::initialize() {
         return false;
     }
 
-    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, display_width, display_height);
+    return resize_texture(false);
+}
+
+// the texture is one texel per pixel of the current mode, SDL scales it to
+// the window
+bool Display::resize_texture(const bool hires) {
+    SDL_DestroyTexture(texture);
+    const int width = hires ? display_width * 2 : display_width;
+    const int height = hires ? display_height * 2 : display_height;
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, width, height);
     if (!texture) {
         std::cerr << "Could not create texture " << SDL_GetError() <<
         '\n';
         return false;
     }
-       
-    return true; 
+    texture_hires = hires;
+    return true;
+}
+
+void Display::update_rows(const Framebuffer& frame, u64 dirty_rows) {
+    if (frame.hires != texture_hires) {
+        if (!resize_texture(frame.hires)) return;
+        // a new texture has nothing in it
+        dirty_rows = ~u64{0};
+    }
+    // low resolution only has 32 rows
+    if (!frame.hires) dirty_rows &= 0xFFFFFFFF;
+    if (!dirty_rows) return;
+
+    // locked texture memory is write only and doesn't have to hold the last
+    // frame, so lock the band from the first to the last dirty row and fill
+    // all of it.
+    const int first = std::countr_zero(dirty_rows);
+    const int last = 63 - std::countl_zero(dirty_rows);
+    const SDL_Rect band{0, first, static_cast<int>(frame.width()), last - first + 1};
+
+    void* pixels;
+    int pitch;
+    if (SDL_LockTexture(texture, &band, &pixels, &pitch) != 0) {
+        std::cerr << "Could not lock texture " << SDL_GetError() << '\n';
+        return;
+    }
+    for (int row = first; row <= last; row++) {
+        u32* line = reinterpret_cast<u32*>(static_cast<u8*>(pixels) + (row - first) * pitch);
+        expand_row(frame.planes[0][row][0], frame.planes[1][row][0], line, palette);
+        if (frame.hires) {
+            expand_row(frame.planes[0][row][1], frame.planes[1][row][1], line + 64, palette);
+        }
+    }
+    SDL_UnlockTexture(texture);
 }
 
 void Display::render_screen() {
-    SDL_UpdateTexture(texture, nullptr, pixel_buf.data(),
-                      // pitch: number of bytes per row = 32 entries
-                      // per row * 4 bytes (int)
-                      display_width * 4);
     SDL_RenderCopy(renderer, texture, nullptr, nullptr);
     SDL_RenderPresent(renderer);
 }
-
@@ -1,57 +1,219 @@
 #include "include/emulator.h"
+#include <cctype>
+#include <iostream>
+#include <thread>
+#include "include/scheduler.h"
 
-void Emulator::poll_events(SDL_Event& event, bool& interrupted) {
-    while (SDL_PollEvent(&event)) {
-        switch(event.type) {
-            case SDL_QUIT: interrupted = true; break;
-            case SDL_KEYDOWN:
-            case SDL_KEYUP:
-                if (auto search = keyboard.key_map.find(event.key.keysym.sym); search != keyboard.key_map.end()) {
-                    // found key pressed in key_map, set it to pressed
-                    keyboard.keys[search->second] = event.type == SDL_KEYDOWN;
-                    if (event.type == SDL_KEYDOWN && (keyboard.waiting_key & 0x80)) {
-                        // obtain vx
-                        keyboard.waiting_key &= 0x7F; 
-                        chip8.registers[keyboard.waiting_key] = search->second;
-                        chip8.program_counter += 2;
-                    }
-                } else {
-                    break;
+void Emulator::handle_event(const SDL_Event& event) {
+    switch(event.type) {
+        case SDL_QUIT:
+            quit = true;
+            wake_machine();
+            break;
+        case SDL_KEYDOWN:
+        case SDL_KEYUP:
+            if (auto search = key_map.find(event.key.keysym.sym); search != key_map.end()) {
+                // repeats are sent too, they can satisfy Fx0A
+                send(event.type == SDL_KEYDOWN ? Command::Kind::key_down : Command::Kind::key_up, search->second);
+            } else if (event.key.keysym.sym == SDLK_BACKSPACE && !recording) {
+                send(event.type == SDL_KEYDOWN ? Command::Kind::rewind_start : Command::Kind::rewind_stop);
+            } else if (event.type == SDL_KEYDOWN && !event.key.repeat) {
+                if (event.key.keysym.sym == SDLK_F5) {
+                    send(Command::Kind::save_state);
+                } else if (event.key.keysym.sym == SDLK_F9 && !recording) {
+                    send(Command::Kind::load_state);
                 }
-                break;
-        }
+            }
+            break;
+        case SDL_WINDOWEVENT:
+            // the window contents are gone, show the last frame again
+            if (event.window.event == SDL_WINDOWEVENT_EXPOSED ||
+                event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+                needs_redraw = true;
+            }
+            break;
+        default:
+            if (event.type == frame_event) {
+                frame_pending = false;
+            }
+    }
+}
+
+void Emulator::set_key_layout(std::string_view layout) {
+    key_map.clear();
+    for (u8 key = 0; key < layout.size() && key < 16; key++) {
+        // SDL's keycodes for letters and digits are their lowercase ASCII
+        key_map[static_cast<SDL_Keycode>(std::tolower(static_cast<unsigned char>(layout[key])))] = key;
     }
 }
 
-void Emulator::update_timers() {
-    if (chip8.timer_delay > 0) {
-        chip8.timer_delay--;
+void Emulator::send(Command::Kind kind, u8 key) {
+    // 256 commands behind means the machine thread is stuck, dropping
+    // input is the least bad thing to do then
+    if (!commands.push({clock::now(), kind, key})) {
+        std::cerr << "Input queue full, dropping input\n";
     }
+    wake_machine();
+}
+
+void Emulator::wake_machine() {
+    wakeups.fetch_add(1, std::memory_order_release);
+    wakeups.notify_one();
+}
+
+// a machine waiting for a key with no timers running doesn't need frames, so
+// neither thread does anything until a command or quit comes in. the window
+// isn't redrawn either, nothing gets published.
+bool Emulator::wait_for_input() {
+    // rewinding steps back every frame, input or not
+    if (rewinding) return false;
+
+    // anything sent after this load changes wakeups, so wait returns at once
+    const u32 seen = wakeups.load(std::memory_order_acquire);
+    if (quit || commands.front()) return true;
+    wakeups.wait(seen, std::memory_order_acquire);
+    return true;
 }
 
-void Emulator::update_screen(std::array<u8, 2048>& display_buf, std::array<u32, 2048>& rgb_buf) {
-    for(u16 pixel_pos = 0; pixel_pos < 2048; pixel_pos++) {
-        rgb_buf[pixel_pos] = 0xFFFFFF * display_buf[pixel_pos];
+bool Emulator::poll(Chip8& c8, const InputTime& now) {
+    if (quit) return false;
+
+    // commands that came in while this poll runs wait for the next frame,
+    // as does the release of a key pressed in this one, so even the
+    // shortest tap is down for a whole frame.
+    const clock::time_point frame_end = clock::now();
+    u16 pressed = 0;
+    while (const Command* command = commands.front()) {
+        if (command->time > frame_end) break;
+        if (command->kind == Command::Kind::key_up && (pressed >> command->key & 1)) break;
+        if (command->kind == Command::Kind::key_down) {
+            pressed |= 1 << command->key;
+        }
+        apply(c8, *command, now);
+        commands.pop();
+    }
+
+    if (recording) {
+        recording->end = recording->time_of(now);
     }
+
+    // one frame back per frame while backspace is held, otherwise remember
+    // this frame
+    if (rewinding) {
+        rewind.step_back(c8);
+    } else {
+        rewind.record(c8);
+    }
+    return true;
 }
 
-// include amount of cycles so it is configurable somewhat
-void Emulator::run(Display& display) {
-    bool interrupted = false;
-    SDL_Event event; 
-    u32 cycles = 10;
-    
-    while (!interrupted) {
-        for (u32 i = 0; i < cycles && !(keyboard.waiting_key & 0x80); i++) {
-            chip8.run_cycle();  
+void Emulator::apply(Chip8& c8, const Command& command, const InputTime& now) {
+    switch (command.kind) {
+        case Command::Kind::key_down:
+        case Command::Kind::key_up: {
+            const bool pressed = command.kind == Command::Kind::key_down;
+            if (pressed) {
+                c8.press_key(command.key);
+            } else {
+                c8.release_key(command.key);
+            }
+            if (recording) {
+                recording->events.push_back({recording->time_of(now), command.key, pressed});
+            }
+            break;
         }
+        case Command::Kind::rewind_start:
+        case Command::Kind::rewind_stop:
+            rewinding = command.kind == Command::Kind::rewind_start;
+            break;
+        case Command::Kind::save_state:
+        case Command::Kind::load_state:
+            try {
+                if (command.kind == Command::Kind::save_state) {
+                    save_state_file(c8, state_path);
+                    std::cout << "Saved state to " << state_path << '\n';
+                } else {
+                    load_state_file(c8, state_path);
+                    std::cout << "Loaded state from " << state_path << '\n';
+                }
+            } catch (const std::runtime_error& e) {
+                std::cerr << e.what();
+            }
+            break;
+    }
+}
+
+void Emulator::present(const Chip8& c8, u64 dirty_rows) {
+    // the SDL thread works out the changed rows itself, it may skip frames
+    // published while it was busy.
+    if (!dirty_rows) return;
 
-        update_screen(chip8.display, display.pixel_buf);
+    frames.back() = c8.display;
+    frames.publish();
+    if (!frame_pending.exchange(true)) {
+        SDL_Event event{};
+        event.type = frame_event;
+        SDL_PushEvent(&event);
+    }
+}
+
+void Emulator::show_latest_frame() {
+    if (!frames.update() && !needs_redraw) return;
+
+    const Framebuffer& latest = frames.front();
+    // a mode switch changes every row, the texture is rebuilt anyway
+    u64 dirty_rows = needs_redraw || latest.hires != shown.hires ? ~u64{0} : 0;
+    for (size_t row = 0; row < latest.height(); row++) {
+        if (latest.planes[0][row] != shown.planes[0][row] || latest.planes[1][row] != shown.planes[1][row]) {
+            dirty_rows |= u64{1} << row;
+        }
+    }
+    // most frames don't draw anything, those cost neither conversion nor a
+    // texture upload.
+    if (dirty_rows) {
+        display.update_rows(latest, dirty_rows);
         display.render_screen();
+        shown = latest;
+    }
+    needs_redraw = false;
+}
 
-        update_timers();
+void Emulator::run() {
+    frame_event = SDL_RegisterEvents(1);
+    if (recording) {
+        recording->cycles_per_frame = cycles_per_frame;
+        recording->quirks = chip8.quirks();
+    }
+
+    running = true;
+    std::thread machine([this] {
+        Scheduler scheduler(chip8, engine, this, this);
+        scheduler.runner.cycles_per_frame = cycles_per_frame;
+        scheduler.runner.audio = audio;
+        if (turbo) {
+            scheduler.mode = Scheduler::Mode::turbo;
+        }
+        scheduler.run();
+
+        running = false;
+        SDL_Event event{};
+        event.type = frame_event;
+        SDL_PushEvent(&event);
+    });
+
+    while (running) {
+        // the timeout only matters if a wakeup got lost
+        SDL_Event event;
+        if (SDL_WaitEventTimeout(&event, 100)) {
+            do {
+                handle_event(event);
+            } while (SDL_PollEvent(&event));
+        }
+        show_latest_frame();
+    }
+    machine.join();
 
-        poll_events(event, interrupted);
-        SDL_Delay(1000/60);
+    if (chip8.trap) {
+        std::cerr << *chip8.trap << '\n';
     }
 }
@@ -0,0 +1,33 @@
+#include "include/engine.h"
+#include <iostream>
+#include "include/aot.h"
+#include "include/block_cache.h"
+#include "include/jit.h"
+
+u64 Interpreter::run(Chip8& c8, u64 budget) {
+    NoHooks hooks;
+    return interpret(c8, budget, hooks);
+}
+
+std::unique_ptr<Engine> make_engine(EngineKind kind) {
+    switch (kind) {
+        case EngineKind::interpreter: return std::make_unique<Interpreter>();
+        case EngineKind::block_cache: return std::make_unique<BlockCache>();
+        case EngineKind::jit:
+            if (!Jit::supported) {
+                std::cerr << "No JIT for this platform, falling back to the interpreter\n";
+                return std::make_unique<Interpreter>();
+            }
+            return std::make_unique<Jit>();
+        case EngineKind::aot: return std::make_unique<Aot>();
+    }
+    return nullptr;
+}
+
+std::optional<EngineKind> parse_engine_kind(std::string_view name) {
+    if (name == "interpreter") return EngineKind::interpreter;
+    if (name == "block") return EngineKind::block_cache;
+    if (name == "jit") return EngineKind::jit;
+    if (name == "aot") return EngineKind::aot;
+    return std::nullopt;
+}
@@ -0,0 +1,275 @@
+#include "include/environment.h"
+
+#include <array>
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// every bit of a low resolution half row twice, for showing it in a 128
+// pixel wide observation
+u64 double_pixels(const u32 bits) {
+    u64 x = bits;
+    x = (x | x << 16) & 0x0000FFFF0000FFFF;
+    x = (x | x << 8) & 0x00FF00FF00FF00FF;
+    x = (x | x << 4) & 0x0F0F0F0F0F0F0F0F;
+    x = (x | x << 2) & 0x3333333333333333;
+    x = (x | x << 1) & 0x5555555555555555;
+    return x | x << 1;
+}
+
+// row y of a plane at the observation's resolution, left word first
+DisplayRow observed_row(const Framebuffer& display, const size_t plane, const size_t y,
+                        const ObservationShape& shape) {
+    if (shape.width == Chip8::display_width || display.hires) return display.planes[plane][y];
+    const u64 row = display.planes[plane][y / 2][0];
+    return {double_pixels(row >> 32), double_pixels(static_cast<u32>(row))};
+}
+
+// the 8 pixels of a byte, one byte each in memory order, leftmost first
+constexpr std::array<u64, 256> byte_pixels = [] {
+    std::array<u64, 256> table{};
+    for (size_t byte = 0; byte < 256; byte++) {
+        std::array<u8, 8> pixels{};
+        for (size_t x = 0; x < 8; x++) {
+            pixels[x] = (byte >> (7 - x)) & 1;
+        }
+        table[byte] = std::bit_cast<u64>(pixels);
+    }
+    return table;
+}();
+
+}
+
+ObservationShape observation_shape(const QuirkProfile profile, const ObservationFormat format) {
+    const Quirks quirks = quirks_of(profile);
+    ObservationShape shape;
+    shape.width = quirks.super_chip ? Chip8::hires_width : Chip8::display_width;
+    shape.height = quirks.super_chip ? Chip8::hires_height : Chip8::display_height;
+    shape.planes = format == ObservationFormat::packed && quirks.xo_chip ? 2 : 1;
+    shape.format = format;
+    return shape;
+}
+
+void write_observation(const Chip8& c8, const ObservationShape& shape, std::span<u8> out) {
+    const size_t words = shape.width / 64;
+    u8* at = out.data();
+    if (shape.format == ObservationFormat::packed) {
+        for (size_t plane = 0; plane < shape.planes; plane++) {
+            for (size_t y = 0; y < shape.height; y++) {
+                const DisplayRow row = observed_row(c8.display, plane, y, shape);
+                for (size_t word = 0; word < words; word++) {
+                    for (int shift = 56; shift >= 0; shift -= 8) {
+                        *at++ = static_cast<u8>(row[word] >> shift);
+                    }
+                }
+            }
+        }
+        return;
+    }
+    // eight pixels at a time, both planes looked up per byte
+    for (size_t y = 0; y < shape.height; y++) {
+        const DisplayRow first = observed_row(c8.display, 0, y, shape);
+        const DisplayRow second = observed_row(c8.display, 1, y, shape);
+        for (size_t word = 0; word < words; word++) {
+            for (int shift = 56; shift >= 0; shift -= 8) {
+                const u64 pixels = byte_pixels[(first[word] >> shift) & 0xFF] |
+                                   byte_pixels[(second[word] >> shift) & 0xFF] << 1;
+                std::memcpy(at, &pixels, sizeof(pixels));
+                at += sizeof(pixels);
+            }
+        }
+    }
+}
+
+Environment::Environment(std::span<const u8> program, const QuirkProfile profile, const EngineKind engine) {
+    auto loaded = std::make_shared<Chip8>();
+    loaded->set_quirks(profile);
+    loaded->load_program(program);
+    boot = std::move(loaded);
+    c8 = std::make_unique<Chip8>(*boot);
+    this->engine = make_engine(engine);
+    runner = std::make_unique<Runner>(*c8, *this->engine);
+}
+
+Environment::Environment(const Environment& other, const EngineKind engine)
+    : cycles_per_frame(other.cycles_per_frame), max_frames(other.max_frames), boot(other.boot) {
+    c8 = std::make_unique<Chip8>(*boot);
+    this->engine = make_engine(engine);
+    runner = std::make_unique<Runner>(*c8, *this->engine);
+}
+
+void Environment::reset(const u32 seed) {
+    restore_state(*boot, 0, 0);
+    c8->seed(seed);
+}
+
+void Environment::restore_state(const Chip8& state, const u64 frames, const u64 instructions) {
+    // the engine's cached code stays valid for every page that reads the same
+    // in both, which for resets and search trees is most of them
+    u16 stale = c8->written_pages;
+    for (size_t page = 0; page < 16; page++) {
+        const size_t address = page * Chip8::page_size;
+        if (std::memcmp(&c8->memory[address], &state.memory[address], Chip8::page_size) != 0) stale |= 1 << page;
+    }
+    *c8 = state;
+    c8->written_pages = stale;
+    runner->frames = frames;
+    runner->instructions = instructions;
+}
+
+void Environment::restore_state(const EnvironmentState& state) {
+    restore_state(*state.c8, state.frames, state.instructions);
+}
+
+void Environment::clone_state(EnvironmentState& out) const {
+    if (out.c8) {
+        *out.c8 = *c8;
+    } else {
+        out.c8 = std::make_unique<Chip8>(*c8);
+    }
+    out.frames = runner->frames;
+    out.instructions = runner->instructions;
+}
+
+EnvironmentState Environment::clone_state() const {
+    EnvironmentState state;
+    clone_state(state);
+    return state;
+}
+
+bool Environment::done() const {
+    return c8->trap || (max_frames && runner->frames >= max_frames);
+}
+
+StepResult Environment::step(const u16 action_mask, const u32 frames) {
+    // only keys that changed, a key held across steps doesn't satisfy another
+    // Fx0A
+    const u16 changed = action_mask ^ c8->held_keys();
+    for (u8 key = 0; key < 16; key++) {
+        if (!(changed & (1 << key))) continue;
+        if (action_mask & (1 << key)) {
+            c8->press_key(key);
+        } else {
+            c8->release_key(key);
+        }
+    }
+
+    runner->cycles_per_frame = cycles_per_frame;
+    for (u32 frame = 0; frame < frames && !done(); frame++) {
+        runner->run_frame();
+    }
+    StepResult result;
+    if (reward) result.reward = reward(*c8);
+    result.done = done();
+    return result;
+}
+
+EnvironmentBatch::EnvironmentBatch(const size_t count, std::span<const u8> program, const QuirkProfile profile,
+                                   const EngineKind engine, const ObservationFormat format)
+    : observation(observation_shape(profile, format)) {
+    environments.reserve(count);
+    if (count) environments.emplace_back(program, profile, engine);
+    // the rest share the first one's loaded program
+    while (environments.size() < count) {
+        environments.emplace_back(environments.front(), engine);
+    }
+}
+
+void EnvironmentBatch::reset(const u32 first_seed) {
+    for (size_t i = 0; i < environments.size(); i++) {
+        environments[i].reset(first_seed + static_cast<u32>(i));
+    }
+}
+
+void EnvironmentBatch::step(std::span<const u16> actions, const u32 frames, std::span<u8> observations,
+                            std::span<float> rewards, std::span<u8> done) {
+    const size_t count = environments.size();
+    if (actions.size() < count || observations.size() < count * observation_size() || rewards.size() < count ||
+        done.size() < count)
+        throw std::runtime_error("Buffers passed to EnvironmentBatch::step are too small\n");
+
+    for (size_t i = 0; i < count; i++) {
+        Environment& environment = environments[i];
+        if (environment.done()) {
+            rewards[i] = 0;
+            done[i] = true;
+        } else {
+            const StepResult result = environment.step(actions[i], frames);
+            rewards[i] = result.reward;
+            done[i] = result.done;
+        }
+        environment.observe(observation, observations.subspan(i * observation_size(), observation_size()));
+    }
+}
+
+void EnvironmentBatch::observe(std::span<u8> observations) const {
+    if (observations.size() < environments.size() * observation_size())
+        throw std::runtime_error("Buffer passed to EnvironmentBatch::observe is too small\n");
+    for (size_t i = 0; i < environments.size(); i++) {
+        environments[i].observe(observation, observations.subspan(i * observation_size(), observation_size()));
+    }
+}
+
+SharedBuffer SharedBuffer::create(const std::string& name, const size_t size) {
+#ifdef __unix__
+    const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+        throw std::runtime_error("Shared memory " + name + " couldn't be created\n");
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        close(fd);
+        shm_unlink(name.c_str());
+        throw std::runtime_error("Shared memory " + name + " couldn't be sized\n");
+    }
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        throw std::runtime_error("Shared memory " + name + " couldn't be mapped\n");
+    }
+    return SharedBuffer(name, static_cast<u8*>(mapping), size, true);
+#else
+    (void)size;
+    throw std::runtime_error("Shared memory " + name + " isn't supported on this platform\n");
+#endif
+}
+
+SharedBuffer SharedBuffer::open(const std::string& name) {
+#ifdef __unix__
+    const int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0)
+        throw std::runtime_error("Shared memory " + name + " couldn't be found\n");
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        throw std::runtime_error("Shared memory " + name + " couldn't be read\n");
+    }
+    void* mapping = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error("Shared memory " + name + " couldn't be mapped\n");
+    return SharedBuffer(name, static_cast<u8*>(mapping), info.st_size, false);
+#else
+    throw std::runtime_error("Shared memory " + name + " isn't supported on this platform\n");
+#endif
+}
+
+SharedBuffer::SharedBuffer(SharedBuffer&& other) noexcept
+    : name(std::move(other.name)), data(std::exchange(other.data, nullptr)), size(std::exchange(other.size, 0)),
+      owner(std::exchange(other.owner, false)) {}
+
+SharedBuffer::~SharedBuffer() {
+#ifdef __unix__
+    if (data) munmap(data, size);
+    if (owner) shm_unlink(name.c_str());
+#endif
+}
@@ -0,0 +1,77 @@
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <span>
+#include <utility>
+
+#include "include/chip8.h"
+#include "include/engine.h"
+#include "include/inputlog.h"
+#include "include/quirks.h"
+#include "include/verify.h"
+
+// libFuzzer target, the engines against the interpreter on random ROMs.
+// the first byte picks the profile and the engine, the second seeds the
+// keys pressed and the rest is the ROM. a divergence is reported and
+// aborts, which is what libFuzzer stops on.
+//
+// aot isn't a candidate, it interprets anything it wasn't built with, which
+// is every ROM here. the lockstep lanes are, each against an interpreted
+// machine of its own.
+
+namespace {
+
+constexpr u64 frames = 120;
+constexpr u32 cycles_per_frame = 50;
+constexpr size_t lanes = 8;
+
+// a key changing now and then, so skips on keys and Fx0A get both ways
+InputLog random_input(const u8 seed) {
+    InputLog log;
+    std::minstd_rand random(seed + 1);
+    for (u64 frame = 1; frame < frames; frame++) {
+        if (random() % 4) continue;
+        log.events.push_back({frame, static_cast<u8>(random() % 16), random() % 2 == 0});
+    }
+    log.end = frames;
+    return log;
+}
+
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const u8* data, size_t size) {
+    if (size < 4) return 0;
+    const QuirkProfile quirks = static_cast<QuirkProfile>(data[0] % 4);
+    // no engine kind is the lockstep lanes
+    static constexpr std::pair<std::optional<EngineKind>, const char*> candidates[] = {
+        {EngineKind::block_cache, "block"}, {EngineKind::jit, "jit"}, {std::nullopt, "lockstep"}};
+    const auto [candidate, name] = candidates[(data[0] / 4) % 3];
+    const InputLog log = random_input(data[1]);
+    std::span<const u8> program(data + 2, size - 2);
+    if (program.size() > Chip8::max_program_size(quirks)) {
+        program = program.first(Chip8::max_program_size(quirks));
+    }
+
+    std::optional<Divergence> divergence;
+    if (candidate) {
+        Chip8 boot;
+        boot.set_quirks(quirks);
+        boot.load_program(program);
+        boot.seed(data[1]);
+
+        Verifier verifier(boot, EngineKind::interpreter, *candidate, &log);
+        verifier.cycles_per_frame = cycles_per_frame;
+        divergence = verifier.run(frames);
+    } else {
+        LockstepVerifier verifier(program, quirks, lanes, data[1], &log);
+        verifier.cycles_per_frame = cycles_per_frame;
+        divergence = verifier.run(frames);
+    }
+    if (divergence) {
+        std::cerr << "profile " << quirk_profile_name(quirks) << ", engine " << name << '\n'
+                  << *divergence;
+        std::abort();
+    }
+    return 0;
+}
@@ -0,0 +1,398 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+#include "include/audio.h"
+#include "include/chip8.h"
+#include "include/engine.h"
+#include "include/inputlog.h"
+#include "include/lockstep.h"
+#include "include/options.h"
+#include "include/profiler.h"
+#include "include/rom.h"
+#include "include/runner.h"
+#include "include/savestate.h"
+#include "include/scheduler.h"
+#include "include/tracer.h"
+#include "include/verify.h"
+
+// runs a ROM without any window, input or frame pacing and reports where it
+// ended up and how long it took to get there.
+
+void print_usage() {
+    std::cout << "Example usage: \n";
+    std::cout << "./chip8_headless [--engine=interpreter|block|jit|aot] [--quirks=legacy|cosmac|schip|xochip]\n";
+    std::cout << "                 [--frames=n | --instructions=n]\n";
+    std::cout << "                 [--cycles-per-frame=n | --ips=n] [--realtime] [--lanes=n] [--load-state=path]\n";
+    std::cout << "                 [--save-state=path] [--seed=n] [--replay=path] [--wav=path] [--profile=prefix]\n";
+    std::cout << "                 [--rom-cache=dir] [--verify=engine|lockstep] [--verify-interval=n]\n";
+    std::cout << "                 [--trace=path] [--trace-pc-only] <file_path_here>\n";
+    std::cout << "frames are a fixed 1/60s of emulated time, --realtime also paces them against the clock\n";
+    std::cout << "--lanes=n runs n copies seeded 0..n-1 in lockstep, --engine is ignored then\n";
+    std::cout << "--replay=path plays back an input log until it ends, with its seed, frame length and quirks\n";
+    std::cout << "--wav=path writes the buzzer to a 48kHz mono WAV file\n";
+    std::cout << "--profile=prefix writes prefix.folded/.heatmap/.summary, needs a CHIP8_PROFILE build\n";
+    std::cout << "--verify=engine runs engine next to --engine and reports the first instruction they disagree on,\n";
+    std::cout << "                comparing state hashes every --verify-interval frames (default 1)\n";
+    std::cout << "--verify=lockstep runs --lanes lanes (default 16) seeded from --seed on up against as many\n";
+    std::cout << "                  interpreted machines, comparing every lane after every frame\n";
+    std::cout << "--trace=path records every instruction with the registers it changed for chip8_tracedump,\n";
+    std::cout << "             running through the interpreter whatever --engine says. --trace-pc-only leaves\n";
+    std::cout << "             out the registers\n";
+    std::cout << "--rom-cache=dir takes the profile and ips from what's known about the ROM unless given\n";
+}
+
+// runs every lane for the same frames/instructions a single machine would
+// get and reports lane 0 plus how many distinct end states the seeds reached.
+int run_lanes(const std::string& rom_path, size_t lanes, u64 frames, u64 instructions, u32 cycles_per_frame,
+              QuirkProfile quirks) {
+    Lockstep lockstep(lanes);
+    lockstep.set_quirks(quirks);
+    lockstep.load_program(rom_path);
+    for (size_t lane = 0; lane < lanes; lane++) {
+        lockstep.seed(lane, lane);
+    }
+
+    u64 executed = 0;
+    u64 frame = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (u64 budget = instructions; instructions ? budget > 0 : frame < frames; frame++) {
+        const u64 cycles = instructions ? std::min<u64>(cycles_per_frame, budget) : cycles_per_frame;
+        executed += lockstep.run(cycles);
+        lockstep.tick_timers();
+        if (instructions) budget -= cycles;
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    auto c8 = std::make_unique<Chip8>();
+    std::unordered_set<u64> states;
+    size_t trapped = 0;
+    for (size_t lane = 0; lane < lanes; lane++) {
+        lockstep.export_lane(lane, *c8);
+        states.insert(c8->state_hash());
+        trapped += c8->crashed();
+    }
+    lockstep.export_lane(0, *c8);
+
+    std::cout << "display hash: " << std::hex << std::setw(16) << std::setfill('0')
+              << c8->display_hash() << std::dec << '\n';
+    std::cout << "lanes: " << lanes << '\n';
+    std::cout << "distinct states: " << states.size() << '\n';
+    std::cout << "trapped lanes: " << trapped << '\n';
+    std::cout << "frames: " << frame << '\n';
+    std::cout << "instructions: " << executed << '\n';
+    std::cout << "seconds: " << elapsed.count() << '\n';
+    std::cout << "instructions per second: " << executed / elapsed.count() << '\n';
+
+    return trapped ? 1 : 0;
+}
+
+// runs candidate next to reference and reports the first instruction where
+// they disagree
+int verify(const Chip8& boot, EngineKind reference, EngineKind candidate, const InputLog* log, u64 frames,
+           u32 cycles_per_frame, u64 interval) {
+    Verifier verifier(boot, reference, candidate, log);
+    verifier.cycles_per_frame = cycles_per_frame;
+    verifier.interval = interval;
+
+    const auto start = std::chrono::steady_clock::now();
+    const std::optional<Divergence> divergence = verifier.run(frames);
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (divergence) {
+        std::cout << *divergence;
+        return 1;
+    }
+    std::cout << "digest: " << std::hex << std::setw(16) << std::setfill('0') << verifier.digest() << std::dec
+              << '\n';
+    std::cout << "frames: " << verifier.frames() << '\n';
+    std::cout << "instructions: " << verifier.instructions() << '\n';
+    std::cout << "seconds: " << elapsed.count() << '\n';
+    return 0;
+}
+
+// every lane next to an interpreted machine with the same seed, see
+// LockstepVerifier
+int verify_lanes(const Rom& rom, QuirkProfile quirks, size_t lanes, u32 first_seed, const InputLog* log, u64 frames,
+                 u32 cycles_per_frame) {
+    LockstepVerifier verifier(rom.bytes(), quirks, lanes, first_seed, log);
+    verifier.cycles_per_frame = cycles_per_frame;
+
+    const auto start = std::chrono::steady_clock::now();
+    const std::optional<Divergence> divergence = verifier.run(frames);
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (divergence) {
+        std::cout << *divergence;
+        return 1;
+    }
+    std::cout << "digest: " << std::hex << std::setw(16) << std::setfill('0') << verifier.digest() << std::dec
+              << '\n';
+    std::cout << "lanes: " << lanes << '\n';
+    std::cout << "frames: " << verifier.frames() << '\n';
+    std::cout << "instructions: " << verifier.instructions() << '\n';
+    std::cout << "seconds: " << elapsed.count() << '\n';
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    EngineKind engine_kind = EngineKind::interpreter;
+    std::optional<QuirkProfile> quirks;
+    u64 frames = 600;
+    u64 instructions = 0;
+    std::optional<u32> cycles_per_frame;
+    bool realtime = false;
+    size_t lanes = 0;
+    std::string load_state_path;
+    std::string save_state_path;
+    std::optional<u32> seed;
+    std::string replay_path;
+    std::string profile_prefix;
+    std::string wav_path;
+    std::string rom_cache_path;
+    std::string trace_path;
+    bool trace_registers = true;
+    std::optional<EngineKind> verify_kind;
+    bool verify_lockstep = false;
+    u64 verify_interval = 1;
+    std::string rom_path;
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        auto value = [&](std::string_view option) { return std::string(arg.substr(option.size())); };
+
+        if (arg.starts_with("--engine=")) {
+            auto kind = parse_engine_kind(value("--engine="));
+            if (!kind) {
+                std::cout << "Unknown engine: " << arg << '\n';
+                print_usage();
+                return 1;
+            }
+            engine_kind = *kind;
+        } else if (arg == "--verify=lockstep") {
+            verify_lockstep = true;
+        } else if (arg.starts_with("--verify=")) {
+            verify_kind = parse_engine_kind(value("--verify="));
+            if (!verify_kind) {
+                std::cout << "Unknown engine: " << arg << '\n';
+                print_usage();
+                return 1;
+            }
+        } else if (arg.starts_with("--verify-interval=")) {
+            if (!parse_option(value("--verify-interval="), verify_interval)) return bad_option(arg, print_usage);
+        } else if (arg.starts_with("--quirks=")) {
+            auto profile = parse_quirk_profile(value("--quirks="));
+            if (!profile) {
+                std::cout << "Unknown quirk profile: " << arg << '\n';
+                print_usage();
+                return 1;
+            }
+            quirks = *profile;
+        } else if (arg.starts_with("--frames=")) {
+            if (!parse_option(value("--frames="), frames)) return bad_option(arg, print_usage);
+            instructions = 0;
+        } else if (arg.starts_with("--instructions=")) {
+            if (!parse_option(value("--instructions="), instructions)) return bad_option(arg, print_usage);
+            frames = 0;
+        } else if (arg.starts_with("--cycles-per-frame=")) {
+            if (!parse_option(value("--cycles-per-frame="), cycles_per_frame)) return bad_option(arg, print_usage);
+        } else if (arg.starts_with("--ips=")) {
+            u32 ips = 0;
+            if (!parse_option(value("--ips="), ips)) return bad_option(arg, print_usage);
+            cycles_per_frame = cycles_for_speed(ips);
+        } else if (arg == "--realtime") {
+            realtime = true;
+        } else if (arg.starts_with("--lanes=")) {
+            if (!parse_option(value("--lanes="), lanes)) return bad_option(arg, print_usage);
+        } else if (arg.starts_with("--seed=")) {
+            if (!parse_option(value("--seed="), seed)) return bad_option(arg, print_usage);
+        } else if (arg.starts_with("--replay=")) {
+            replay_path = value("--replay=");
+        } else if (arg.starts_with("--wav=")) {
+            wav_path = value("--wav=");
+        } else if (arg.starts_with("--profile=")) {
+            profile_prefix = value("--profile=");
+        } else if (arg.starts_with("--rom-cache=")) {
+            rom_cache_path = value("--rom-cache=");
+        } else if (arg.starts_with("--trace=")) {
+            trace_path = value("--trace=");
+        } else if (arg == "--trace-pc-only") {
+            trace_registers = false;
+        } else if (arg.starts_with("--load-state=")) {
+            load_state_path = value("--load-state=");
+        } else if (arg.starts_with("--save-state=")) {
+            save_state_path = value("--save-state=");
+        } else if (rom_path.empty()) {
+            rom_path = arg;
+        } else {
+            std::cout << "Too many arguments passed.\n";
+            print_usage();
+            return 1;
+        }
+    }
+
+    if (rom_path.empty()) {
+        std::cout << "Too few arguments passed.\n";
+        print_usage();
+        return 1;
+    }
+
+#ifndef CHIP8_PROFILE
+    if (!profile_prefix.empty()) {
+        std::cout << "--profile needs a build with CHIP8_PROFILE\n";
+        return 1;
+    }
+#endif
+
+    if (verify_kind && (instructions || realtime || lanes)) {
+        std::cout << "--verify runs for --frames, without --realtime or --lanes\n";
+        return 1;
+    }
+
+    if (verify_lockstep && (verify_kind || instructions || realtime || !load_state_path.empty())) {
+        std::cout << "--verify=lockstep runs for --frames from boot, without --realtime or --load-state\n";
+        return 1;
+    }
+
+    if (!trace_path.empty() && (verify_kind || verify_lockstep || lanes)) {
+        std::cout << "--trace doesn't go with --verify or --lanes\n";
+        return 1;
+    }
+
+    if (realtime && instructions && replay_path.empty()) {
+        std::cout << "--realtime runs for --frames, not --instructions\n";
+        return 1;
+    }
+
+    // bad ROMs, save states, input logs and output paths are reported rather
+    // than thrown
+    try {
+        // what the command line leaves open comes from the cache
+        RomInfo info;
+        if (!rom_cache_path.empty()) {
+            info = RomCache(rom_cache_path).lookup(Rom(rom_path).bytes());
+        }
+        if (!quirks) {
+            quirks = info.quirks;
+        }
+        if (!cycles_per_frame) {
+            cycles_per_frame = info.ips ? cycles_for_speed(info.ips) : 10;
+        }
+
+        if (lanes && !verify_lockstep) {
+            return run_lanes(rom_path, lanes, frames, instructions, *cycles_per_frame, *quirks);
+        }
+
+        std::optional<InputLog> log;
+        std::optional<ReplayInput> replay;
+        if (!replay_path.empty()) {
+            log = InputLog::load(replay_path);
+            if (log->rom_hash && log->rom_hash != rom_file_hash(rom_path)) {
+                std::cerr << "Input log was recorded on a different ROM\n";
+                return 1;
+            }
+            replay.emplace(*log);
+            seed = log->seed;
+            cycles_per_frame = log->cycles_per_frame;
+            quirks = log->quirks;
+        }
+        if (verify_lockstep) {
+            return verify_lanes(Rom(rom_path), *quirks, lanes ? lanes : 16, seed.value_or(0), log ? &*log : nullptr,
+                                replay ? ~u64{0} : frames, *cycles_per_frame);
+        }
+
+        Chip8 chip8;
+        chip8.set_quirks(*quirks);
+        chip8.load_program(rom_path);
+        if (seed) {
+            chip8.seed(*seed);
+        }
+        if (!load_state_path.empty()) {
+            load_state_file(chip8, load_state_path);
+        }
+        if (verify_kind) {
+            return verify(chip8, engine_kind, *verify_kind, log ? &*log : nullptr, replay ? ~u64{0} : frames,
+                          *cycles_per_frame, verify_interval);
+        }
+#ifdef CHIP8_PROFILE
+        std::unique_ptr<Profiler> profiler;
+        if (!profile_prefix.empty()) {
+            profiler = std::make_unique<Profiler>(profile_prefix);
+            Profiler::dump_on_signal();
+            chip8.profiler = profiler.get();
+        }
+#endif
+
+        // traced machines always run through the interpreter
+        std::unique_ptr<Tracer> tracer;
+        std::unique_ptr<Engine> engine;
+        if (!trace_path.empty()) {
+            tracer = std::make_unique<Tracer>(trace_path, chip8.quirks(), trace_registers);
+            engine = std::make_unique<TracingInterpreter>(*tracer);
+        } else {
+            engine = make_engine(engine_kind);
+        }
+        Scheduler scheduler(chip8, *engine, replay ? &*replay : nullptr);
+        Runner& runner = scheduler.runner;
+        runner.cycles_per_frame = *cycles_per_frame;
+        // the buzzer of every frame, written out when it goes out of scope
+        std::optional<WavWriter> wav;
+        if (!wav_path.empty()) {
+            wav.emplace(wav_path);
+            runner.audio = &*wav;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        if (realtime) {
+            scheduler.run(replay ? 0 : frames);
+        } else if (replay) {
+            // the log decides when to stop
+            while (runner.run_frame());
+        } else if (instructions) {
+            // the last frame may be cut short to land on the exact count. there's
+            // no input to end a wait for a key (Fx0A), the count would never be
+            // reached, so that ends the run too
+            while (runner.instructions < instructions && !chip8.halted() &&
+                   runner.run_frame(std::min<u64>(*cycles_per_frame, instructions - runner.instructions)));
+            if (!chip8.trap && chip8.halted()) {
+                std::cerr << "Waiting for a key with no input, stopped after " << runner.instructions
+                          << " instructions\n";
+            }
+        } else {
+            while (runner.frames < frames && runner.run_frame());
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        if (chip8.trap) {
+            std::cerr << *chip8.trap << '\n';
+        }
+        if (!save_state_path.empty()) {
+            save_state_file(chip8, save_state_path);
+        }
+#ifdef CHIP8_PROFILE
+        if (profiler) {
+            profiler->write(chip8);
+        }
+#endif
+
+        std::cout << "display hash: " << std::hex << std::setw(16) << std::setfill('0')
+                  << chip8.display_hash() << std::dec << '\n';
+        std::cout << "frames: " << runner.frames << '\n';
+        std::cout << "instructions: " << runner.instructions << '\n';
+        std::cout << "seconds: " << elapsed.count() << '\n';
+        std::cout << "instructions per second: " << runner.instructions / elapsed.count() << '\n';
+        if (realtime) {
+            std::cout << "late frames: " << scheduler.late_frames << '\n';
+            std::cout << "dropped frames: " << scheduler.dropped_frames << '\n';
+        }
+
+        return chip8.crashed() ? 1 : 0;
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what();
+        return 1;
+    }
+}
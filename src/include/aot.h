@@ -0,0 +1,81 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <array>
+#include <span>
+#include <vector>
+#include "busy_loop.h"
+#include "chip8.h"
+#include "engine.h"
+#include "nums.h"
+#include "quirks.h"
+
+// ROMs compiled ahead of time into C++ by chip8_aot. every basic block of
+// the program becomes a case of one switch working on the machine directly:
+// ALU instructions, I, jumps and skips inline, everything else through the
+// regular handlers. generated files register themselves once linked in, see
+// CHIP8_AOT_ROMS in CMakeLists.txt, and the Aot engine runs whichever module
+// matches the loaded program.
+
+// the parts of the machine generated code works on
+struct AotAccess {
+    static u8* registers(Chip8& c8) { return c8.registers.data(); }
+    static u16& pc(Chip8& c8) { return c8.program_counter; }
+    static u16& index(Chip8& c8) { return c8.index_register; }
+    static const u8* memory(const Chip8& c8) { return c8.memory.data(); }
+    // pages stored to since the engine last looked, see Chip8::take_written_pages
+    static u16 written_pages(const Chip8& c8) { return c8.written_pages; }
+};
+
+// program bytes [first, last) that compiled blocks were decoded from
+struct AotRange {
+    u16 first;
+    u16 last;
+};
+
+// runs compiled blocks from the current pc on. stops at an address without
+// one, at a block on one of stale_pages or longer than what's left of
+// budget, when the machine halts or when it stores to a page with compiled
+// code. returns the instructions executed.
+using AotFn = u64 (*)(Chip8& c8, u64 budget, u16 stale_pages);
+
+struct AotModule {
+    // the ROM it was compiled from, for messages
+    const char* name;
+    // instructions were decoded under this profile, the module is only used
+    // with it
+    QuirkProfile quirks;
+    // the ROM as compiled, it sits at Chip8::program_start
+    std::span<const u8> program;
+    // only ever below 4K, code past that is interpreted
+    std::span<const AotRange> code;
+    AotFn run;
+};
+
+// called by generated files while they're statically initialized, returns
+// true so the call can initialize a variable
+bool register_aot_module(const AotModule& module);
+const std::vector<const AotModule*>& aot_modules();
+
+// runs the compiled module for the loaded program, and the interpreter where
+// there's no compiled code: without a module for the program and profile,
+// for computed jumps, code written at runtime and the last few instructions
+// of a budget too small for a whole block. stores are watched a page at a
+// time, a page whose code no longer matches the ROM is interpreted until it
+// matches again.
+class Aot : public Engine {
+  public:
+    u64 run(Chip8& c8, u64 budget) override;
+
+    // nullptr when no linked in module matches the program
+    const AotModule* module() const { return current; }
+  private:
+    void revalidate(const Chip8& c8, u16 pages);
+    static u16 stale_pages_of(const AotModule& module, const Chip8& c8, u16 pages);
+
+    const AotModule* current = nullptr;
+    // pages with compiled code that no longer matches memory
+    u16 stale_pages = 0;
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <array>
+#include <fstream>
+#include <string>
+#include "io.h"
+#include "nums.h"
+
+// the CHIP-8 buzzer: a square wave for as long as the sound timer runs.
+// samples are produced per emulated frame, never from the host clock, so the
+// same run always sounds the same however fast it was emulated.
+class Beeper {
+  public:
+    static constexpr u32 sample_rate = 48000;
+    // a whole number of samples per 60Hz frame, 800
+    static constexpr size_t samples_per_frame = sample_rate / 60;
+    using Frame = std::array<i16, samples_per_frame>;
+
+    void generate(bool sound_on, Frame& out);
+  private:
+    static constexpr u32 tone = 440;
+    static constexpr i32 amplitude = 6000;
+    // about a millisecond from silence to full volume, hard edges click
+    static constexpr i32 ramp_step = amplitude / 48;
+    // the top bit of phase is the square wave
+    static constexpr u32 phase_step = static_cast<u32>((u64(tone) << 32) / sample_rate);
+
+    u32 phase = 0;
+    i32 level = 0;
+};
+
+// writes the buzzer to a 16 bit mono WAV file, for listening to or checking
+// headless runs. the sizes in the header are filled in on destruction.
+class WavWriter : public AudioSink {
+  public:
+    // throws std::runtime_error when the file can't be created
+    explicit WavWriter(const std::string& path);
+    ~WavWriter();
+    WavWriter(const WavWriter&) = delete;
+    WavWriter& operator=(const WavWriter&) = delete;
+
+    void play_frame(bool sound_on) override;
+  private:
+    void write_header();
+
+    std::ofstream file;
+    Beeper beeper;
+    Beeper::Frame samples;
+    u64 samples_written = 0;
+};
+
+#endif
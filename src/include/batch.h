@@ -0,0 +1,69 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <istream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "chip8.h"
+#include "engine.h"
+#include "nums.h"
+#include "rom.h"
+
+// one independent machine to run from boot, or from a save state, for a
+// fixed amount of frames
+struct BatchJob {
+    std::string rom_path;
+    u64 frames = 600;
+    // left open, the ROM cache's ips decide and otherwise the runner's
+    // default
+    std::optional<u32> cycles_per_frame;
+    // seeds the generator behind Cxkk
+    u32 seed = 0;
+    // when set, keys get pressed and released at random, reproducibly
+    std::optional<u32> input_seed;
+    EngineKind engine = EngineKind::interpreter;
+    // left open, the ROM cache's detected profile decides and otherwise it's
+    // legacy
+    std::optional<QuirkProfile> quirks;
+    // resume from this save state instead of booting, seed is ignored then
+    std::string state_path;
+};
+
+struct BatchResult {
+    u64 state_hash = 0;
+    u64 frames = 0;
+    u64 instructions = 0;
+    std::optional<Trap> trap;
+    // set when the job couldn't run at all
+    std::string error;
+};
+
+// one job per line: the ROM path followed by optional key=value settings,
+// frames, cycles, seed, input_seed, engine, quirks and state. # starts a
+// comment.
+//
+//     roms/pong.ch8 frames=3600 seed=7 input_seed=1 engine=jit
+//     roms/blinky.ch8 quirks=schip
+std::vector<BatchJob> parse_manifest(std::istream& manifest);
+
+// runs jobs on a work-stealing pool: every thread starts out with its own
+// share of the jobs and steals from the others once it runs dry. machines are
+// built in a per-thread arena, so running a job doesn't touch the global
+// allocator for the machine itself.
+class BatchExecutor {
+  public:
+    explicit BatchExecutor(size_t thread_count = std::thread::hardware_concurrency());
+
+    // when set, every ROM is looked up once per run for the settings its
+    // jobs leave open, see BatchJob
+    RomCache* rom_cache = nullptr;
+
+    // results are in the same order as jobs
+    std::vector<BatchResult> run(const std::vector<BatchJob>& jobs);
+  private:
+    size_t thread_count;
+};
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <array>
+#include <memory>
+#include <optional>
+#include <vector>
+#include "busy_loop.h"
+#include "chip8.h"
+#include "engine.h"
+#include "nums.h"
+
+// remembers which pages of memory each cached block was built from, so a
+// store can drop everything built from the page it hit.
+class PageIndex {
+  public:
+    static constexpr size_t memory_size = 4096;
+    static constexpr size_t page_count = memory_size / Chip8::page_size;
+
+    static u16 pages_of(u16 address, size_t length);
+
+    // call every time a block is (re)built at address
+    void insert(u16 address, u16 page_mask);
+
+    // calls drop(address, page_bit) for each block listed under one of pages.
+    // a block can still be listed under a page it is no longer built from,
+    // drop has to check that itself.
+    template <typename Drop>
+    void invalidate(u16 pages, Drop&& drop) {
+        for (size_t page = 0; pages; page++, pages >>= 1) {
+            if (!(pages & 1)) continue;
+
+            const u16 bit = 1 << page;
+            for (const u16 address : page_blocks[page]) {
+                listed_pages[address] &= ~bit;
+                drop(address, bit);
+            }
+            page_blocks[page].clear();
+        }
+    }
+  private:
+    std::array<std::vector<u16>, page_count> page_blocks;
+    std::array<u16, memory_size> listed_pages{};
+};
+
+// a straight-line run of instructions, from its start address up to and
+// including the first instruction that can change control flow.
+struct Block {
+    std::vector<Instruction> instructions;
+    // pages the instructions were decoded from
+    u16 page_mask = 0;
+    // set when the block starts a busy loop, see busy_loop.h
+    std::optional<BusyLoop> busy_loop;
+};
+
+// decodes each block once and then executes the predecoded instructions
+// straight from the cache. blocks are dropped a page at a time whenever the
+// program stores into the memory they were decoded from.
+class BlockCache : public Engine {
+  public:
+    BlockCache();
+
+    u64 run(Chip8& c8, u64 budget) override;
+
+    // longest block that will be decoded, longer runs are split
+    static constexpr size_t max_block_length = 128;
+    static bool ends_block(CallBack handler);
+  private:
+    static constexpr size_t memory_size = PageIndex::memory_size;
+
+    const Block& lookup(const Chip8& c8, u16 address);
+    void decode(const Chip8& c8, u16 address, Block& block);
+    void invalidate(u16 pages);
+
+    // indexed by start address
+    std::unique_ptr<std::array<Block, memory_size>> blocks;
+    PageIndex page_index;
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef BUSY_LOOP_H
+#define BUSY_LOOP_H
+
+#include <optional>
+#include "chip8.h"
+#include "nums.h"
+
+// guest loops that do nothing but poll something only a frame boundary can
+// change, e.g. waiting for the delay timer or a key:
+//
+//     L:   Fx07            L:   Ex9E / ExA1
+//          3xkk / 4xkk          1L
+//          1L
+//
+// the delay timer only ticks and keys only change between frames, so once
+// such a loop doesn't exit it keeps going round until the frame ends. rather
+// than running the iterations, fast_forward works out where the last one
+// stops. registers, pc and the instruction count end up exactly as if every
+// iteration ran.
+struct BusyLoop {
+    enum class Kind : u8 {
+        delay_timer,
+        key
+    };
+
+    Kind kind;
+    // instructions per iteration
+    u8 length;
+    u8 x;
+    u8 kk;
+    // whether the skip that leaves the loop fires on equal (3xkk) or on a
+    // pressed key (Ex9E)
+    bool exit_on_match;
+
+    // recognizes a busy loop starting at address
+    static std::optional<BusyLoop> match(const Chip8& c8, u16 address);
+
+    // with the machine at the start of the loop and the loop not exiting
+    // this frame, executes budget instructions worth of it and returns
+    // budget. otherwise leaves the machine alone and returns 0.
+    u64 fast_forward(Chip8& c8, u16 address, u64 budget) const;
+    // for engines without blocks to keep a match in, matches at the pc and
+    // fast forwards in one go
+    static u64 fast_forward(Chip8& c8, u64 budget);
+};
+
+
+#endif
@@ -4,24 +4,82 @@
 #include <array>
 #include <iostream>
 #include <string>
-#include <unordered_map>
+#include <optional>
 #include <random>
+#include <span>
 #include "nums.h"
+#include "framebuffer.h"
 #include "keyboard.h"
+#include "quirks.h"
 
 struct OpcodeFields;
 class Chip8;
+class Profiler;
 
 using CallBack = void(*)(Chip8&, const OpcodeFields& fields);
-using Mask = u16;
+
+struct OpcodeFields {
+    // x refers to which x register
+    u8 x;
+    // y refers to which y register
+    u8 y;
+    // nnn is the address
+    u16 nnn;
+    // 
+    u8 kk;
+
+    constexpr OpcodeFields(u16 opcode = 0) : x((opcode >> 8) & 0xF), 
+                                    y ((opcode >> 4) & 0xF), 
+                                    nnn(opcode & 0xFFF),
+                                    kk(opcode & 0xFF) {}
+};
+
+// handler and operands for one opcode, decoded ahead of time
+struct Instruction {
+    CallBack handler;
+    OpcodeFields fields;
+};
+
+using InstructionTable = std::array<Instruction, 0x10000>;
+
+// indexed by QuirkProfile and then directly by the 16 bit opcode, see
+// instructions.cc
+extern const std::array<InstructionTable, quirk_profile_count> instruction_tables;
+
+enum class TrapKind : u8 {
+    invalid_opcode,
+    stack_overflow,
+    stack_underflow,
+    // SUPER-CHIP's 00FD, the program is done
+    exit
+};
+
+// raised by the core instead of executing something it can't,
+// the machine stays halted on the offending instruction until reset.
+struct Trap {
+    TrapKind kind;
+    u16 address;
+    u16 opcode;
+};
+
+std::ostream& operator<<(std::ostream& os, const Trap& trap);
 
 class Chip8 {
   public:
+    // low resolution, SUPER-CHIP's hires mode doubles both
     static constexpr size_t display_width = 64;
     static constexpr size_t display_height = 32;
     static constexpr size_t display_size = display_width * display_height;
+    static constexpr size_t hires_width = 128;
+    static constexpr size_t hires_height = 64;
 
-    std::array<u8, display_size> display{};
+    // one bit per pixel, see framebuffer.h
+    Framebuffer display;
+    std::optional<Trap> trap;
+#ifdef CHIP8_PROFILE
+    // counts what the machine does while set, see profiler.h
+    Profiler* profiler = nullptr;
+#endif
 
     static constexpr std::array<u8, 80> font = {
         0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
@@ -42,16 +100,98 @@ class Chip8 {
         0xF0, 0x80, 0xF0, 0x80, 0x80  // F     
     };
 
-    // program starts at address 0x200
-    explicit Chip8(Keyboard& keyboard) : program_counter(0x200), keyboard(keyboard) {}
+    // SUPER-CHIP's 8x10 digits for Fx30, A-F as in XO-CHIP
+    static constexpr std::array<u8, 160> big_font = {
+        0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+        0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+        0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+        0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+        0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+    };
+
+    // programs are loaded and start at 0x200, below is the interpreter's
+    static constexpr u16 program_start = 0x200;
+    // the biggest program that fits into the memory profile sees
+    static constexpr size_t max_program_size(QuirkProfile profile) {
+        return (quirks_of(profile).xo_chip ? memory_size : 0x1000) - program_start;
+    }
+
+    Chip8() : program_counter(program_start) {}
     
-    CallBack fetch_instruction(const u16 instruction);
+    // decoded according to the machine's quirk profile
+    const Instruction& fetch_instruction(const u16 instruction) const;
     u16 fetch_opcode() const; 
+    u16 pc() const { return program_counter; }
+    u16 index() const { return index_register; }
+    u16 opcode_at(const u16 address) const;
     void execute_instruction(const u16 instruction);
     void run_cycle();
+    // the same for a profile known at compile time, dispatches straight
+    // through that profile's table. profile has to be quirks().
+    template <QuirkProfile profile>
+    void run_cycle();
+
+    // picks how the instructions CHIP-8 variants disagree on behave and
+    // which extensions exist, see quirks.h. takes effect with the next
+    // instruction. the rest of the machine is left alone, except that
+    // SUPER-CHIP profiles get the big font loaded and XO-CHIP sees all 64K
+    // of memory instead of the first 4K.
+    void set_quirks(const QuirkProfile profile);
+    QuirkProfile quirks() const { return quirk_profile; }
+    // nothing left to execute until something outside the core happens
+    bool halted() const { return trap || keyboard.waiting; }
+    // trapped on something other than SUPER-CHIP's exit
+    bool crashed() const { return trap && trap->kind != TrapKind::exit; }
+    // blocked on Fx0A with no timer running, nothing at all changes until a
+    // key is pressed. frontends can sleep instead of running frames then.
+    bool idle() const { return keyboard.waiting && !timer_delay && !sound_delay; }
+    // pages of memory stored to since the last call, lets engines that cache
+    // decoded code find out when it was overwritten.
+    u16 take_written_pages();
+    // display rows changed by cls/Dxyn/scrolls since the last call, bit n is
+    // row n. lets frontends skip frames where nothing was drawn.
+    u64 take_dirty_rows();
+    bool display_dirty() const { return dirty_rows != 0; }
+
+    static constexpr size_t page_size = 256;
 
     void load_font();
+    // the profile has to be set first, programs that don't fit into the
+    // memory it sees are rejected with std::runtime_error
     void load_program(const std::string& rom_path);
+    void load_program(std::span<const u8> program);
+    // seeds the generator behind Cxkk
+    void seed(const u32 seed);
+
+    void press_key(const u8 key);
+    void release_key(const u8 key);
+    // bit n set while key n is held
+    u16 held_keys() const;
+    // called at 60Hz, counts down the delay and the sound timer
+    void tick_timers();
+    // the buzzer sounds for as long as the sound timer is running
+    bool sound_on() const { return sound_delay > 0; }
+    u64 display_hash() const;
+    // covers everything that makes up the machine except the generator state
+    u64 state_hash() const;
+    // the same, a word at a time, for comparing states every frame. doesn't
+    // match state_hash.
+    u64 quick_state_hash() const;
+    // read only views for code watching the machine from outside, e.g. the
+    // reward functions of an Environment
+    u8 peek(const u16 address) const { return load(address); }
+    u8 reg(const u8 x) const { return registers[x & 0xF]; }
 
     static void cls(Chip8& c8, const OpcodeFields& fields);
     static void ret(Chip8& c8, const OpcodeFields& fields);
@@ -66,16 +206,23 @@ class Chip8 {
     static void or_vx_vy(Chip8& c8, const OpcodeFields& fields);
     static void and_vx_vy(Chip8& c8, const OpcodeFields& fields);
     static void xor_vx_vy(Chip8& c8, const OpcodeFields& fields);
+    static void or_vx_vy_reset_vf(Chip8& c8, const OpcodeFields& fields);
+    static void and_vx_vy_reset_vf(Chip8& c8, const OpcodeFields& fields);
+    static void xor_vx_vy_reset_vf(Chip8& c8, const OpcodeFields& fields);
     static void add_vx_vy(Chip8& c8, const OpcodeFields& fields);
     static void sub_vx_vy(Chip8& c8, const OpcodeFields& fields);
     static void shr_vx_vy(Chip8& c8, const OpcodeFields& fields);
     static void subn_vx_vy(Chip8& c8, const OpcodeFields& fields);
     static void shl_vx_vy(Chip8& c8, const OpcodeFields& fields);
+    static void shr_vx(Chip8& c8, const OpcodeFields& fields);
+    static void shl_vx(Chip8& c8, const OpcodeFields& fields);
     static void skip_next_ifne_vx_vy(Chip8& c8, const OpcodeFields& fields);
     static void ld_iaddr(Chip8& c8, const OpcodeFields& fields);
     static void jp_offset(Chip8& c8, const OpcodeFields& fields);
+    static void jp_offset_vx(Chip8& c8, const OpcodeFields& fields);
     static void rnd_vx_kk(Chip8& c8, const OpcodeFields& fields);
     static void draw_vx_vy_nibble(Chip8& c8, const OpcodeFields& fields);
+    static void draw_vx_vy_nibble_wrap(Chip8& c8, const OpcodeFields& fields);
     static void skp_vx(Chip8& c8, const OpcodeFields& fields);
     static void sknp_vx(Chip8& c8, const OpcodeFields& fields);
     static void ld_vx_dt(Chip8& c8, const OpcodeFields& fields);
@@ -87,9 +234,53 @@ class Chip8 {
     static void ld_b_vx(Chip8& c8, const OpcodeFields& fields);
     static void ld_i_vx(Chip8& c8, const OpcodeFields& fields);
     static void ld_vx_i(Chip8& c8, const OpcodeFields& fields);
+    static void ld_i_vx_keep_i(Chip8& c8, const OpcodeFields& fields);
+    static void ld_vx_i_keep_i(Chip8& c8, const OpcodeFields& fields);
+    static void add_i_vx_wide(Chip8& c8, const OpcodeFields& fields);
+    static void draw_vx_vy_large(Chip8& c8, const OpcodeFields& fields);
+    static void draw_vx_vy_large_wrap(Chip8& c8, const OpcodeFields& fields);
+    // SUPER-CHIP
+    static void scroll_down_n(Chip8& c8, const OpcodeFields& fields);
+    static void scroll_right(Chip8& c8, const OpcodeFields& fields);
+    static void scroll_left(Chip8& c8, const OpcodeFields& fields);
+    static void exit(Chip8& c8, const OpcodeFields& fields);
+    static void low_res(Chip8& c8, const OpcodeFields& fields);
+    static void high_res(Chip8& c8, const OpcodeFields& fields);
+    static void ld_hf_vx(Chip8& c8, const OpcodeFields& fields);
+    static void ld_r_vx(Chip8& c8, const OpcodeFields& fields);
+    static void ld_vx_r(Chip8& c8, const OpcodeFields& fields);
+    // XO-CHIP
+    static void scroll_up_n(Chip8& c8, const OpcodeFields& fields);
+    static void ld_i_vx_vy(Chip8& c8, const OpcodeFields& fields);
+    static void ld_vx_vy_i(Chip8& c8, const OpcodeFields& fields);
+    static void ld_i_long(Chip8& c8, const OpcodeFields& fields);
+    static void plane_n(Chip8& c8, const OpcodeFields& fields);
+    static void ld_audio_i(Chip8& c8, const OpcodeFields& fields);
+    static void ld_pitch_vx(Chip8& c8, const OpcodeFields& fields);
+    static void skip_next_ife_vxkk_long(Chip8& c8, const OpcodeFields& fields);
+    static void skip_next_ifne_vxkk_long(Chip8& c8, const OpcodeFields& fields);
+    static void skip_next_ife_vxvy_long(Chip8& c8, const OpcodeFields& fields);
+    static void skip_next_ifne_vx_vy_long(Chip8& c8, const OpcodeFields& fields);
+    static void skp_vx_long(Chip8& c8, const OpcodeFields& fields);
+    static void sknp_vx_long(Chip8& c8, const OpcodeFields& fields);
+    static void invalid_opcode(Chip8& c8, const OpcodeFields& fields);
 
   private:
-    static constexpr size_t memory_size = 4096;
+    void raise_trap(const TrapKind kind);
+    template <u64 (*hasher)(const void*, size_t, u64)>
+    u64 hash_state() const;
+    template <bool wrap, bool large>
+    static void draw(Chip8& c8, const OpcodeFields& fields);
+    template <bool wrap, bool large, bool hires>
+    bool draw_plane(BitPlane& pixels, const u16 sprite_data, const u8 x, const u8 y, const u8 rows);
+    // steps over the next instruction, F000 nnnn included
+    void skip_long();
+    void clear_planes(const u8 planes);
+    u8 load(const u16 address) const { return memory[address & address_mask]; }
+    void store(const u16 address, const u8 value);
+
+    // big enough for XO-CHIP, the other profiles only see the first 4K
+    static constexpr size_t memory_size = 65536;
     static constexpr size_t stack_depth = 12;
     
     std::array<u8, memory_size> memory{};
@@ -98,38 +289,44 @@ class Chip8 {
     std::array<u8, 16> registers{};
 
     u16 program_counter;
-    u16 index_register;
+    u16 index_register{};
     u8 stack_pointer = 0;
 
     u8 sound_delay{};
     u8 timer_delay{};
 
     std::mt19937 rnd{};
-    
-    friend class Emulator;
-    Keyboard& keyboard;
-};
+    u16 address_mask = 0xFFF;
+    // XO-CHIP's Fn01, the planes drawn to, cleared and scrolled
+    u8 selected_planes = 1;
+    // SUPER-CHIP's RPL user flags, Fx75/Fx85
+    std::array<u8, 16> flags{};
+    // XO-CHIP's F002 and Fx3A. kept so programs and save states see them,
+    // the buzzer still plays its usual tone
+    std::array<u8, 16> audio_pattern{};
+    u8 pitch = 64;
 
-struct OpcodeFields {
-    // x refers to which x register
-    u8 x;
-    // y refers to which y register
-    u8 y;
-    // nnn is the address
-    u16 nnn;
-    // 
-    u8 kk;
-
-    OpcodeFields(u16 opcode) : x((opcode >> 8) & 0xF), 
-                                    y ((opcode >> 4) & 0xF), 
-                                    nnn(opcode & 0xFFF),
-                                    kk(opcode & 0xFF) {}
+    // one bit per page_size bytes of the first 4K of memory, the engines
+    // don't cache code past that
+    u16 written_pages = 0xFFFF;
+    // one bit per display row
+    u64 dirty_rows = ~u64{0};
+    QuirkProfile quirk_profile = QuirkProfile::legacy;
+    // instruction_tables entry for quirk_profile
+    const InstructionTable* instructions = &instruction_tables[0];
+    
+    friend struct AotAccess;
+    friend class BlockCache;
+    friend struct BusyLoop;
+    friend class DebugConsole;
+    friend class Debugger;
+    friend class Environment;
+    friend class Jit;
+    friend class Lockstep;
+    friend struct StateCodec;
+    friend class Tracer;
+    friend class Verifier;
+    Keyboard keyboard;
 };
 
-extern const std::unordered_map<Mask, CallBack> instruction_table_0; 
-extern const std::unordered_map<Mask, CallBack> instruction_table_8; 
-extern const std::unordered_map<Mask, CallBack> instruction_table_e; 
-extern const std::unordered_map<Mask, CallBack> instruction_table_f; 
-extern const std::unordered_map<Mask, CallBack> instruction_table_rest; 
-
 #endif
@@ -0,0 +1,74 @@
+#ifndef CHIP8_ENV_H
+#define CHIP8_ENV_H
+
+// C interface to EnvironmentBatch (see environment.h), for trainers loading
+// libchip8_env from other languages. nothing here throws, failures return
+// NULL and describe themselves in error.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct chip8_env chip8_env;
+typedef struct chip8_env_state chip8_env_state;
+typedef struct chip8_shared chip8_shared;
+
+// the same order as the C++ enums
+enum { CHIP8_QUIRKS_LEGACY, CHIP8_QUIRKS_COSMAC, CHIP8_QUIRKS_SCHIP, CHIP8_QUIRKS_XOCHIP };
+enum { CHIP8_ENGINE_INTERPRETER, CHIP8_ENGINE_BLOCK, CHIP8_ENGINE_JIT, CHIP8_ENGINE_AOT };
+enum { CHIP8_OBSERVATION_PACKED, CHIP8_OBSERVATION_BYTES };
+
+// count environments on one program. error may be NULL.
+chip8_env* chip8_env_create(const uint8_t* program, size_t size, size_t count, int quirks, int engine,
+                            int observation, char* error, size_t error_size);
+void chip8_env_destroy(chip8_env* env);
+
+size_t chip8_env_count(const chip8_env* env);
+// bytes per observation, width x height x planes for packed ones at a bit
+// per pixel
+size_t chip8_env_observation_size(const chip8_env* env);
+void chip8_env_observation_shape(const chip8_env* env, size_t* width, size_t* height, size_t* planes);
+
+// for every environment
+void chip8_env_set_cycles_per_frame(chip8_env* env, uint32_t cycles);
+void chip8_env_set_max_frames(chip8_env* env, uint64_t frames);
+// called after every step of environment index, read the machine with
+// chip8_env_peek and chip8_env_register. NULL for no reward.
+typedef float (*chip8_env_reward)(const chip8_env* env, size_t index, void* user);
+void chip8_env_set_reward(chip8_env* env, chip8_env_reward reward, void* user);
+
+uint8_t chip8_env_peek(const chip8_env* env, size_t index, uint16_t address);
+uint8_t chip8_env_register(const chip8_env* env, size_t index, uint8_t x);
+uint64_t chip8_env_frames(const chip8_env* env, size_t index);
+
+// environment i is seeded with first_seed + i
+void chip8_env_reset_all(chip8_env* env, uint32_t first_seed);
+void chip8_env_reset(chip8_env* env, size_t index, uint32_t seed);
+// one action mask (bit n holds key n) per environment in, one observation,
+// reward and done flag per environment out, see EnvironmentBatch::step
+void chip8_env_step(chip8_env* env, const uint16_t* actions, uint32_t frames, uint8_t* observations,
+                    float* rewards, uint8_t* done);
+void chip8_env_observe(const chip8_env* env, uint8_t* observations);
+
+// snapshots of single environments. into may be NULL or an earlier
+// snapshot, which is reused.
+chip8_env_state* chip8_env_clone_state(const chip8_env* env, size_t index, chip8_env_state* into);
+void chip8_env_restore_state(chip8_env* env, size_t index, const chip8_env_state* state);
+void chip8_env_free_state(chip8_env_state* state);
+
+// POSIX shared memory, e.g. for the observations. the creator unlinks the
+// name again when it closes it.
+chip8_shared* chip8_shared_create(const char* name, size_t size, char* error, size_t error_size);
+chip8_shared* chip8_shared_open(const char* name, char* error, size_t error_size);
+uint8_t* chip8_shared_data(const chip8_shared* shared);
+size_t chip8_shared_size(const chip8_shared* shared);
+void chip8_shared_close(chip8_shared* shared);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include <atomic>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "chip8.h"
+#include "nums.h"
+
+// a comparison against a register, e.g. V3 == 2 or I >= 0x300
+struct Condition {
+    enum class Op : u8 {
+        equal,
+        not_equal,
+        less,
+        less_equal,
+        greater,
+        greater_equal
+    };
+    // 0-F for V0-VF, index for I
+    static constexpr u8 index = 16;
+
+    u8 target = 0;
+    Op op = Op::equal;
+    u16 value = 0;
+
+    bool holds(const Chip8& c8) const;
+};
+
+// "V3==2", "v3 != 0x10", "I>=300" (numbers are hex, as addresses and
+// values are everywhere in the debugger)
+std::optional<Condition> parse_condition(std::string_view text);
+std::ostream& operator<<(std::ostream& os, const Condition& condition);
+
+// what watchpoints look for, a bit each
+constexpr u8 access_read = 1;
+constexpr u8 access_write = 2;
+
+// why the debugger gave control back
+struct Stop {
+    enum class Reason : u8 {
+        // a single step or step over finished, or finish left the subroutine
+        step,
+        breakpoint,
+        watchpoint,
+        // a register condition became true
+        condition,
+        trap,
+        // blocked on Fx0A, running on needs a key press
+        waiting,
+        // interrupt was set, e.g. by Ctrl-C
+        interrupted,
+        // resume ran the frames it was given
+        frames
+    };
+
+    Reason reason = Reason::step;
+    // the breakpoint, watchpoint or condition that fired
+    u32 id = 0;
+    // for watchpoints, the first address the instruction accesses in the
+    // watched range and how
+    u16 address = 0;
+    u8 access = 0;
+};
+
+// runs a machine under breakpoints on the pc (optionally only when a
+// condition holds), memory watchpoints and register conditions, a 60Hz frame
+// at a time like Runner does. stops happen between instructions, with the pc
+// on the instruction that hit a breakpoint or is about to access watched
+// memory. a stop mid-frame resumes with the rest of the frame, so a debugged
+// run ends up exactly where a regular one would.
+//
+// execution goes through the interpreter loop with the debugger's hooks (see
+// NoHooks in engine.h), the regular engines don't know it exists.
+class Debugger {
+  public:
+    explicit Debugger(Chip8& c8) : c8(c8) {}
+
+    // ids count up from 1 across all three kinds
+    u32 add_breakpoint(u16 address, std::optional<Condition> condition = std::nullopt);
+    // accesses made through I: sprites read by Dxyn, Fx33/Fx55/5xy2 stores,
+    // Fx65/5xy3/F002 loads. first and last are inclusive.
+    u32 add_watchpoint(u16 first, u16 last, u8 access);
+    // stops when the condition turns true, anywhere in the program
+    u32 add_condition(const Condition& condition);
+    bool remove(u32 id);
+    void print_points(std::ostream& os) const;
+    bool has_breakpoint(u16 address) const;
+
+    // until something stops it or, when frames isn't 0, that many frames
+    // ended. the instruction at the pc runs first, even when it's sitting on
+    // a breakpoint, so resuming from a stop moves on.
+    Stop resume(u64 frames = 0);
+    // one instruction
+    Stop step();
+    // one instruction, or a whole subroutine for a call (2nnn), unless a
+    // breakpoint inside stops it earlier
+    Stop step_over();
+    // until the current subroutine returns
+    Stop finish();
+
+    Chip8& machine() { return c8; }
+    u64 frames() const { return frame_count; }
+    u64 instructions() const { return instruction_count; }
+
+    u32 cycles_per_frame = 10;
+    // polled between frames, may be set from a signal handler
+    const std::atomic<bool>* interrupt = nullptr;
+  private:
+    struct Breakpoint {
+        u32 id;
+        u16 address;
+        std::optional<Condition> condition;
+    };
+    struct Watchpoint {
+        u32 id;
+        u16 first;
+        u16 last;
+        u8 access;
+    };
+    struct ConditionPoint {
+        u32 id;
+        Condition condition;
+        // whether it held when last checked, it only fires when it turns true
+        bool held;
+    };
+    // how the current command ends besides hitting something
+    struct Until {
+        // after one instruction
+        bool step = false;
+        // once the pc is here with the stack no deeper than depth (step over)
+        std::optional<u16> address;
+        u8 depth = 0;
+        // once the stack is shallower than this (finish)
+        std::optional<u8> below;
+        // at the end of the frame_count'th frame
+        std::optional<u64> frame;
+    };
+    // the bytes an instruction accesses through I, count 0 for none
+    struct MemoryAccess {
+        u16 start = 0;
+        u16 count = 0;
+        u8 access = 0;
+    };
+    struct Hooks;
+
+    Stop run(const Until& until);
+    // before every instruction, first is the one a command starts on
+    std::optional<Stop> check(const Until& until, bool first);
+    MemoryAccess memory_access() const;
+
+    Chip8& c8;
+    std::vector<Breakpoint> breakpoints;
+    std::vector<Watchpoint> watchpoints;
+    std::vector<ConditionPoint> conditions;
+    u32 next_id = 1;
+
+    u64 frame_count = 0;
+    u64 instruction_count = 0;
+    // instructions run in the current frame so far
+    u64 in_frame = 0;
+};
+
+// the debugger's command line, one command per line, shared by the stdin
+// REPL and the socket server of chip8_debug:
+//
+//     break addr [if cond]   watch first [last] [r|w|rw]   when cond
+//     delete id   info   continue [n]   step   next   finish
+//     regs   stack   mem addr [n]   list [addr] [n]
+//     press key   release key   set Vx|I|pc value
+//
+// numbers are hex, with or without 0x, except ids and frame counts. see
+// help for what each one does.
+class DebugConsole {
+  public:
+    explicit DebugConsole(Debugger& debugger) : debugger(debugger) {}
+
+    // runs one command, writes its output to out. returns false for quit.
+    bool execute(std::string_view line, std::ostream& out);
+    // where the machine is right now, pc and the instructions from there
+    void print_location(std::ostream& out) const;
+  private:
+    void print_registers(std::ostream& out) const;
+    void print_stack(std::ostream& out) const;
+    void print_memory(std::ostream& out, u16 address, u16 count) const;
+    void print_listing(std::ostream& out, u16 address, u16 count) const;
+    void report(std::ostream& out, const Stop& stop) const;
+
+    Debugger& debugger;
+    // an empty line repeats the last command, like gdb
+    std::string last;
+};
+
+#endif
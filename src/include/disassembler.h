@@ -0,0 +1,45 @@
+#ifndef DISASSEMBLER_H
+#define DISASSEMBLER_H
+
+#include <map>
+#include <span>
+#include <string>
+#include <vector>
+#include "chip8.h"
+#include "nums.h"
+#include "quirks.h"
+
+// the handler's name as declared in chip8.h, "unknown" for anything else
+const char* handler_name(CallBack handler);
+
+// one instruction in the usual mnemonics, as decoded under profile. F000's
+// address is the word after it, which isn't part of opcode.
+std::string disassemble(u16 opcode, QuirkProfile profile);
+
+// a straight run of instructions ending in the first one that may not fall
+// through, see BlockCache::ends_block, or right before another block starts
+struct BasicBlock {
+    u16 start = 0;
+    // instructions, all two bytes apart. only a block's last instruction
+    // can be F000 nnnn.
+    u16 length = 0;
+    // one past the last byte, F000's address included
+    u32 end = 0;
+    // where control can go next, in no particular order. a call has its
+    // target and its return address, ret and computed jumps have none.
+    std::vector<u16> successors;
+};
+
+// every block reachable from the entry point. paths leaving the program
+// (into the font, past its end) aren't followed, and computed jumps (Bnnn)
+// can't be, indirect_jumps says whether there were any.
+struct ControlFlowGraph {
+    std::map<u16, BasicBlock> blocks;
+    bool indirect_jumps = false;
+};
+
+// the program sits at Chip8::program_start, instructions are decoded under
+// profile
+ControlFlowGraph recover_control_flow(std::span<const u8> program, QuirkProfile profile);
+
+#endif
@@ -2,8 +2,10 @@
 #define DISPLAY_H
 
 #include "SDL2/SDL.h"
+#include "framebuffer.h"
 #include "nums.h"
 #include <array>
+#include <cstddef>
   
 class Display {
   public:
@@ -20,16 +22,22 @@ class Display {
     };
 
     bool initialize();
+    // expands the packed rows set in dirty_rows into the texture, which
+    // follows the frame's resolution
+    void update_rows(const Framebuffer& frame, u64 dirty_rows);
     void render_screen();
-
-    std::array<u32, 2048> pixel_buf{};
   private:
+    bool resize_texture(bool hires);
+
     SDL_Window* window;
     SDL_Renderer* renderer;
-    SDL_Texture* texture;
+    SDL_Texture* texture = nullptr;
+    bool texture_hires = false;
     
     static constexpr size_t display_width = 64;
     static constexpr size_t display_height = 32;
+    // off, plane 0, plane 1, both. plain CHIP-8 only ever uses the first two
+    static constexpr std::array<u32, 4> palette = {0x000000, 0xFFFFFF, 0xAAAAAA, 0x555555};
 };
 
 #endif
@@ -3,24 +3,107 @@
 #include "SDL2/SDL.h"
 #include "chip8.h"
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include "display.h"
-#include "keyboard.h"
+#include "engine.h"
+#include "inputlog.h"
+#include "io.h"
+#include "savestate.h"
+#include "spsc_queue.h"
+#include "triple_buffer.h"
 
-class Emulator {
+// the SDL frontend, feeds keyboard events into the core and shows its
+// display in a window. F5 saves to state_path, F9 loads it back and holding
+// backspace rewinds frame by frame. while recording, every key change goes
+// into the log and rewinding/loading is off, as the log couldn't replay it.
+//
+// the machine runs on a thread of its own. the calling thread only waits for
+// SDL events and presents: commands go to the machine through a queue, frames
+// come back through a triple buffer, so a present blocking on vsync never
+// holds up emulation and the other way round. poll and present are the
+// machine thread's side, everything else belongs to the SDL thread.
+class Emulator : public InputSource, public FrameSink {
   public:  
     Emulator(const Emulator&) = delete;
     Emulator& operator=(const Emulator&) = delete;
 
-    Emulator(Chip8& c8, Keyboard& keyboard) : keyboard(keyboard), chip8(c8){};
+    Emulator(Chip8& c8, Engine& engine, Display& display, std::string state_path)
+        : chip8(c8), engine(engine), display(display), state_path(std::move(state_path)) {};
         
-    void run(Display& display);
+    void run();
+    // logs key changes from now on, with times in the log's timebase
+    void record_to(InputLog& log) { recording = &log; }
+    // gets the buzzer of every emulated frame, on the machine thread
+    void play_to(AudioSink& sink) { audio = &sink; }
+    // the host keys for keypad keys 0-F, see default_key_layout in rom.h
+    void set_key_layout(std::string_view layout);
+
+    // instructions per 60Hz frame, see cycles_for_speed
+    u32 cycles_per_frame = 10;
+    // run uncapped and only show every few frames
+    bool turbo = false;
+
+    bool poll(Chip8& c8, const InputTime& now) override;
+    bool wait_for_input() override;
+    void present(const Chip8& c8, u64 dirty_rows) override;
   private:
-    void poll_events(SDL_Event& event, bool& interrupted);
-    void update_timers();  
-    void update_screen(std::array<u8, 2048>& display_buf, std::array<u32, 2048>& rgb_buf);
+    using clock = std::chrono::steady_clock;
+
+    // something for the machine thread to do, stamped with when SDL saw it
+    struct Command {
+        enum class Kind : u8 {
+            key_down,
+            key_up,
+            save_state,
+            load_state,
+            rewind_start,
+            rewind_stop
+        };
+        clock::time_point time;
+        Kind kind;
+        u8 key;
+    };
+
+    void handle_event(const SDL_Event& event);
+    void send(Command::Kind kind, u8 key = 0);
+    void wake_machine();
+    void show_latest_frame();
+    void apply(Chip8& c8, const Command& command, const InputTime& now);
+
+    std::unordered_map<SDL_Keycode, u8> key_map {
+      {SDLK_1, 0x1}, {SDLK_2, 0x2}, {SDLK_3, 0x3}, {SDLK_4, 0xC},
+      {SDLK_q, 0x4}, {SDLK_w, 0x5}, {SDLK_e, 0x6}, {SDLK_r, 0xD},
+      {SDLK_a, 0x7}, {SDLK_s, 0x8}, {SDLK_d, 0x9}, {SDLK_f, 0xE},
+      {SDLK_z, 0xA}, {SDLK_x, 0x0}, {SDLK_c, 0xB}, {SDLK_v, 0xF}
+    };
     
-    Keyboard& keyboard;
     Chip8& chip8; 
+    Engine& engine;
+    Display& display;
+    std::string state_path;
+    Rewind rewind;
+    bool rewinding = false;
+    InputLog* recording = nullptr;
+    AudioSink* audio = nullptr;
+
+    SpscQueue<Command, 256> commands;
+    TripleBuffer<Framebuffer> frames;
+    // the display as it's in the window right now
+    Framebuffer shown;
+    // set when the window needs repainting even though nothing was drawn
+    bool needs_redraw = true;
+    // wakes the SDL thread when a frame was published or the machine stopped,
+    // frame_pending keeps turbo from flooding the event queue
+    u32 frame_event = 0;
+    std::atomic<bool> frame_pending = false;
+    std::atomic<bool> quit = false;
+    // bumped for every command and on quit, an idle machine thread sleeps on it
+    std::atomic<u32> wakeups = 0;
+    std::atomic<bool> running = false;
 };
 
 #endif
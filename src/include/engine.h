@@ -0,0 +1,89 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <memory>
+#include <optional>
+#include <string_view>
+#include "busy_loop.h"
+#include "chip8.h"
+#include "nums.h"
+
+enum class EngineKind {
+    interpreter,
+    block_cache,
+    jit,
+    aot
+};
+
+constexpr size_t engine_kind_count = 4;
+
+// an execution strategy for the core. every engine has to produce exactly
+// the same machine state as the interpreter, they only differ in speed.
+class Engine {
+  public:
+    virtual ~Engine() = default;
+
+    // executes at most budget instructions, stopping early when the machine
+    // halts. returns the amount of instructions executed.
+    virtual u64 run(Chip8& c8, u64 budget) = 0;
+};
+
+// what the interpreter loop calls around every instruction, picked at
+// compile time. the interpreter's own do nothing and compile away, so the
+// regular build runs the same loop as without any; the debugger passes its
+// breakpoints and watchpoints (debugger.h), the tracer records every
+// instruction (tracer.h).
+struct NoHooks {
+    // whether busy loops may be run as one step, see busy_loop.h. hooks that
+    // have to see every instruction turn it off.
+    static constexpr bool fast_forward = true;
+    // with the machine about to run the instruction at pc, true stops the
+    // loop without running it
+    static constexpr bool stop(const Chip8&) { return false; }
+    // right after the instruction ran
+    static constexpr void executed(const Chip8&) {}
+};
+
+// executes at most budget instructions under hooks, stopping early when the
+// machine halts or hooks.stop says so
+template <QuirkProfile profile, class Hooks>
+u64 interpret(Chip8& c8, const u64 budget, Hooks& hooks) {
+    u64 executed = 0;
+    while (executed < budget && !c8.halted()) {
+        if (hooks.stop(c8)) break;
+        const u16 pc = c8.pc();
+        c8.run_cycle<profile>();
+        hooks.executed(c8);
+        executed++;
+        // busy loops close with a jump back, don't bother looking otherwise
+        if constexpr (Hooks::fast_forward) {
+            if (c8.pc() < pc) {
+                executed += BusyLoop::fast_forward(c8, budget - executed);
+            }
+        }
+    }
+    return executed;
+}
+
+template <class Hooks>
+u64 interpret(Chip8& c8, const u64 budget, Hooks& hooks) {
+    // one loop per profile, each dispatching straight through its own table
+    switch (c8.quirks()) {
+        case QuirkProfile::legacy: return interpret<QuirkProfile::legacy>(c8, budget, hooks);
+        case QuirkProfile::cosmac: return interpret<QuirkProfile::cosmac>(c8, budget, hooks);
+        case QuirkProfile::schip: return interpret<QuirkProfile::schip>(c8, budget, hooks);
+        case QuirkProfile::xochip: return interpret<QuirkProfile::xochip>(c8, budget, hooks);
+    }
+    return 0;
+}
+
+// decodes and executes one instruction at a time, the reference engine
+class Interpreter : public Engine {
+  public:
+    u64 run(Chip8& c8, u64 budget) override;
+};
+
+std::unique_ptr<Engine> make_engine(EngineKind kind);
+std::optional<EngineKind> parse_engine_kind(std::string_view name);
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+#include "chip8.h"
+#include "engine.h"
+#include "nums.h"
+#include "quirks.h"
+#include "runner.h"
+
+// a ROM as a training environment: reset with a seed, step with the keys to
+// hold, look at the display. no window and no pacing, a step runs its frames
+// as fast as the engine allows.
+
+enum class ObservationFormat : u8 {
+    // one bit per pixel, width / 8 bytes per row with the leftmost pixel in
+    // the top bit, XO-CHIP's second plane after the first
+    packed,
+    // one byte per pixel, plane 0's bit | plane 1's bit << 1
+    bytes
+};
+
+// the layout of one observation. fixed per profile, so observations of a
+// whole batch line up: SUPER-CHIP profiles always get 128x64 and low
+// resolution is shown with every pixel doubled, the others get 64x32.
+struct ObservationShape {
+    size_t width;
+    size_t height;
+    // packed only, bytes folds both planes into one value
+    size_t planes;
+    ObservationFormat format;
+
+    size_t size() const {
+        return format == ObservationFormat::packed ? planes * height * width / 8 : height * width;
+    }
+};
+
+ObservationShape observation_shape(QuirkProfile profile, ObservationFormat format);
+// writes the display straight into out, which has to hold shape.size() bytes
+void write_observation(const Chip8& c8, const ObservationShape& shape, std::span<u8> out);
+
+// called after every step with the machine as the step left it. reads
+// whatever the game keeps its score in, see Chip8::peek and Chip8::reg.
+using RewardHook = std::function<float(const Chip8& c8)>;
+
+struct StepResult {
+    float reward = 0;
+    // the machine trapped (SUPER-CHIP's exit included) or max_frames ran out
+    bool done = false;
+};
+
+// a snapshot taken with Environment::clone_state, only meant to be restored
+// into environments running the same ROM and profile
+struct EnvironmentState {
+    std::unique_ptr<Chip8> c8;
+    u64 frames = 0;
+    u64 instructions = 0;
+};
+
+class Environment {
+  public:
+    // the program is loaded once and every reset starts over from a copy,
+    // the environment starts out booted with the generator's default seed.
+    // throws std::runtime_error when the program doesn't fit the profile.
+    Environment(std::span<const u8> program, QuirkProfile profile = QuirkProfile::legacy,
+                EngineKind engine = EngineKind::interpreter);
+    // shares another environment's loaded program instead of loading it again
+    Environment(const Environment& other, EngineKind engine);
+
+    // boots the program with the generator behind Cxkk seeded with seed
+    void reset(u32 seed);
+    // holds the keys set in action_mask (bit n for key n) and runs up to
+    // frames frames, stopping early when done
+    StepResult step(u16 action_mask, u32 frames = 1);
+
+    void observe(const ObservationShape& shape, std::span<u8> out) const { write_observation(*c8, shape, out); }
+    const Chip8& machine() const { return *c8; }
+    QuirkProfile quirks() const { return boot->quirks(); }
+    u64 frames() const { return runner->frames; }
+    u64 instructions() const { return runner->instructions; }
+    bool done() const;
+
+    // copies the whole machine, into an existing snapshot without allocating
+    void clone_state(EnvironmentState& out) const;
+    EnvironmentState clone_state() const;
+    void restore_state(const EnvironmentState& state);
+
+    RewardHook reward;
+    u32 cycles_per_frame = 10;
+    // steps end with done after this many frames since the reset, 0 for no
+    // limit
+    u64 max_frames = 0;
+  private:
+    void restore_state(const Chip8& state, u64 frames, u64 instructions);
+
+    std::shared_ptr<const Chip8> boot;
+    std::unique_ptr<Chip8> c8;
+    std::unique_ptr<Engine> engine;
+    std::unique_ptr<Runner> runner;
+};
+
+// many environments on one ROM stepped together, observations written
+// straight from each display into one contiguous caller owned buffer (see
+// SharedBuffer to hand it to another process). steps run on the calling
+// thread, batches on separate threads don't share anything.
+class EnvironmentBatch {
+  public:
+    EnvironmentBatch(size_t count, std::span<const u8> program, QuirkProfile profile = QuirkProfile::legacy,
+                     EngineKind engine = EngineKind::interpreter, ObservationFormat format = ObservationFormat::bytes);
+
+    size_t size() const { return environments.size(); }
+    const ObservationShape& shape() const { return observation; }
+    // bytes step writes per environment, and the stride between them
+    size_t observation_size() const { return observation.size(); }
+
+    Environment& operator[](size_t index) { return environments[index]; }
+    const Environment& operator[](size_t index) const { return environments[index]; }
+    // environment i is seeded with first_seed + i
+    void reset(u32 first_seed);
+
+    // steps environment i with actions[i] and writes its observation at
+    // observations[i * observation_size()], its reward and whether it's done.
+    // environments that are already done are left alone, with a done
+    // observation like the step that finished them, until they're reset.
+    void step(std::span<const u16> actions, u32 frames, std::span<u8> observations, std::span<float> rewards,
+              std::span<u8> done);
+    // the observations alone, e.g. right after a reset
+    void observe(std::span<u8> observations) const;
+  private:
+    std::vector<Environment> environments;
+    ObservationShape observation;
+};
+
+// a buffer in POSIX shared memory, so a trainer process on the same host can
+// map the observations without them being copied over. the creator owns the
+// name and unlinks it again when destroyed, others open it by name.
+class SharedBuffer {
+  public:
+    // throws std::runtime_error when it can't be created or opened
+    static SharedBuffer create(const std::string& name, size_t size);
+    static SharedBuffer open(const std::string& name);
+    ~SharedBuffer();
+    SharedBuffer(SharedBuffer&& other) noexcept;
+    SharedBuffer& operator=(SharedBuffer&&) = delete;
+
+    std::span<u8> bytes() const { return {data, size}; }
+  private:
+    SharedBuffer(const std::string& name, u8* data, size_t size, bool owner)
+        : name(name), data(data), size(size), owner(owner) {}
+
+    std::string name;
+    u8* data = nullptr;
+    size_t size = 0;
+    bool owner = false;
+};
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include "nums.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// the display is kept one bit per pixel. a row is two u64 covering 128
+// pixels, the leftmost pixel in the most significant bit of the first one.
+// in low resolution the display is 64x32 and only the first word of the
+// top 32 rows is used, one bit per (big) pixel.
+using DisplayRow = std::array<u64, 2>;
+using BitPlane = std::array<DisplayRow, 64>;
+
+struct Framebuffer {
+    static constexpr size_t plane_count = 2;
+
+    // XO-CHIP's two bitplanes, everything else only ever draws to the first
+    std::array<BitPlane, plane_count> planes{};
+    // SUPER-CHIP's 128x64 mode
+    bool hires = false;
+
+    size_t width() const { return hires ? 128 : 64; }
+    size_t height() const { return hires ? 64 : 32; }
+    bool operator==(const Framebuffer&) const = default;
+};
+
+// xors up to 16 sprite pixels into a 64 pixel row starting at column x. the
+// leftmost sprite pixel is the top bit, 8 pixel sprites come in as data << 8.
+// the part past the right edge is shifted out, i.e. clipped, unless wrap is
+// set, then it comes back in on the left. returns whether a lit pixel got
+// turned off.
+template <bool wrap>
+inline bool draw_sprite_row(u64& row, const u16 sprite, const u8 x) {
+    const u64 sprite_bits = static_cast<u64>(sprite) << 48;
+    const u64 bits = wrap ? std::rotr(sprite_bits, x) : sprite_bits >> x;
+    const bool collision = (row & bits) != 0;
+    row ^= bits;
+    return collision;
+}
+
+// the same for a 128 pixel row split into its left and right word
+template <bool wrap>
+inline bool draw_sprite_row(u64& left, u64& right, const u16 sprite, const u8 x) {
+    const u64 sprite_bits = static_cast<u64>(sprite) << 48;
+    u64 left_bits = 0;
+    u64 right_bits = 0;
+    if (x < 64) {
+        left_bits = sprite_bits >> x;
+        right_bits = x ? sprite_bits << (64 - x) : 0;
+    } else {
+        right_bits = sprite_bits >> (x - 64);
+    }
+    // whatever went past column 127
+    if (wrap && x > 112) {
+        left_bits |= sprite_bits << (128 - x);
+    }
+    const bool collision = (left & left_bits) != 0 || (right & right_bits) != 0;
+    left ^= left_bits;
+    right ^= right_bits;
+    return collision;
+}
+
+// moves a 128 pixel row 0 < n < 64 pixels sideways, pixels pushed past the
+// edge are lost
+inline void shift_row_right(u64& left, u64& right, const unsigned n) {
+    right = right >> n | left << (64 - n);
+    left >>= n;
+}
+
+inline void shift_row_left(u64& left, u64& right, const unsigned n) {
+    left = left << n | right >> (64 - n);
+    right <<= n;
+}
+
+// expands 64 pixels of both planes into colors, palette is indexed by
+// plane 0's bit | plane 1's bit << 1
+#ifdef __SSE2__
+inline void expand_row(const u64 plane0, const u64 plane1, u32* out, const std::array<u32, 4>& palette) {
+    const __m128i off = _mm_set1_epi32(static_cast<int>(palette[0]));
+    const __m128i first = _mm_set1_epi32(static_cast<int>(palette[1]));
+    const __m128i second = _mm_set1_epi32(static_cast<int>(palette[2]));
+    const __m128i both = _mm_set1_epi32(static_cast<int>(palette[3]));
+    // four pixels per step, the leftmost one is the top bit of the nibble
+    const __m128i pixel_bits = _mm_set_epi32(1, 2, 4, 8);
+    for (size_t x = 0; x < 64; x += 4) {
+        const __m128i nibble0 = _mm_set1_epi32(static_cast<int>((plane0 >> (60 - x)) & 0xF));
+        const __m128i nibble1 = _mm_set1_epi32(static_cast<int>((plane1 >> (60 - x)) & 0xF));
+        const __m128i lit0 = _mm_cmpeq_epi32(_mm_and_si128(nibble0, pixel_bits), pixel_bits);
+        const __m128i lit1 = _mm_cmpeq_epi32(_mm_and_si128(nibble1, pixel_bits), pixel_bits);
+        // pick by plane 1 first, then by plane 0 within each half
+        const __m128i unlit1 = _mm_or_si128(_mm_and_si128(lit0, first), _mm_andnot_si128(lit0, off));
+        const __m128i set1 = _mm_or_si128(_mm_and_si128(lit0, both), _mm_andnot_si128(lit0, second));
+        const __m128i pixels = _mm_or_si128(_mm_and_si128(lit1, set1), _mm_andnot_si128(lit1, unlit1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), pixels);
+    }
+}
+#else
+inline void expand_row(const u64 plane0, const u64 plane1, u32* out, const std::array<u32, 4>& palette) {
+    for (size_t x = 0; x < 64; x++) {
+        out[x] = palette[((plane0 >> (63 - x)) & 1) | ((plane1 >> (63 - x)) & 1) << 1];
+    }
+}
+#endif
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include "nums.h"
+
+// 64 bit FNV-1a, cheap and good enough to tell machine states apart
+constexpr u64 fnv1a_offset = 0xcbf29ce484222325;
+
+inline u64 fnv1a(const void* data, size_t size, u64 hash = fnv1a_offset) {
+    const u8* bytes = static_cast<const u8*>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+// eight bytes per step (rustc's FxHash), for hashing whole machine states
+// often. not as well mixed as FNV-1a, plenty for telling two states apart.
+inline u64 fxhash(const void* data, size_t size, u64 hash = fnv1a_offset) {
+    const u8* bytes = static_cast<const u8*>(data);
+    const auto mix = [&](const u64 word) { hash = (std::rotl(hash, 5) ^ word) * 0x517cc1b727220a95; };
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        u64 word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        mix(word);
+    }
+    for (; i < size; i++) {
+        mix(bytes[i]);
+    }
+    return hash;
+}
+
+#endif
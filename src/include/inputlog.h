@@ -0,0 +1,79 @@
+#ifndef INPUTLOG_H
+#define INPUTLOG_H
+
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+#include "chip8.h"
+#include "io.h"
+#include "nums.h"
+
+// everything needed to play a session again: the RNG seed, the ROM it was
+// recorded on, the quirk profile it ran with and every key change with the
+// time it happened.
+//
+// on disk:
+//
+//     "C8IN" u8 version, u8 timebase, u32 seed, u64 rom hash, u32 cycles per frame,
+//            u8 quirk profile (from version 2 on, version 1 logs are legacy)
+//     events: varint time since the previous event, u8 key | pressed << 4
+//     end:    varint time since the previous event, u8 0xFF
+//
+// numbers are little endian, varints are LEB128. frame times reproduce a run
+// exactly. instruction times survive a different frame length, but frames
+// spent waiting for a key collapse, so timers see less time pass.
+enum class Timebase : u8 {
+    frame,
+    instruction
+};
+
+struct KeyEvent {
+    u64 time;
+    u8 key;
+    bool pressed;
+};
+
+struct InputLog {
+    static constexpr u8 version = 2;
+
+    Timebase timebase = Timebase::frame;
+    u32 seed = std::mt19937::default_seed;
+    // fnv1a of the ROM file, 0 when unknown
+    u64 rom_hash = 0;
+    u32 cycles_per_frame = 10;
+    QuirkProfile quirks = QuirkProfile::legacy;
+    // in time order
+    std::vector<KeyEvent> events;
+    // when the recording stopped
+    u64 end = 0;
+
+    u64 time_of(const InputTime& now) const {
+        return timebase == Timebase::frame ? now.frame : now.instructions;
+    }
+
+    std::vector<u8> encode() const;
+    // throws std::runtime_error on malformed logs
+    static InputLog decode(std::span<const u8> bytes);
+
+    void save(const std::string& path) const;
+    static InputLog load(const std::string& path);
+};
+
+// fnv1a of a ROM file, to tell whether a log belongs to it
+u64 rom_file_hash(const std::string& path);
+
+// drives the keypad from a log. keys change at the first poll at or after
+// their recorded time, which is exactly when they were recorded as long as
+// the frame length matches. runs out once the recording ended.
+class ReplayInput : public InputSource {
+  public:
+    explicit ReplayInput(const InputLog& log) : log(log) {}
+
+    bool poll(Chip8& c8, const InputTime& now) override;
+  private:
+    const InputLog& log;
+    size_t next = 0;
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef IO_H
+#define IO_H
+
+#include "chip8.h"
+
+// how far the machine got when input is polled, frames and instructions
+// completed since boot
+struct InputTime {
+    u64 frame;
+    u64 instructions;
+};
+
+// where key presses come from, polled once per frame
+class InputSource {
+  public:
+    virtual ~InputSource() = default;
+
+    // applies whatever changed since the last poll to the keypad.
+    // returns false once there is no more input, e.g. the window was closed.
+    virtual bool poll(Chip8& c8, const InputTime& now) = 0;
+    // called while the machine is idle(), may block until there is input to
+    // poll and returns whether it did. the default doesn't, idle frames then
+    // run as usual.
+    virtual bool wait_for_input() { return false; }
+};
+
+// receives the display after every frame
+class FrameSink {
+  public:
+    virtual ~FrameSink() = default;
+
+    // dirty_rows has bit n set when display row n changed since the last
+    // frame, 0 means the display is the same as last time.
+    virtual void present(const Chip8& c8, u64 dirty_rows) = 0;
+};
+
+// receives the buzzer state after every frame, see audio.h
+class AudioSink {
+  public:
+    virtual ~AudioSink() = default;
+
+    // one call per emulated frame, presented or not
+    virtual void play_frame(bool sound_on) = 0;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <array>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <vector>
+#include "block_cache.h"
+#include "busy_loop.h"
+#include "chip8.h"
+#include "engine.h"
+#include "nums.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+#define CHIP8_JIT_SUPPORTED 1
+#else
+#define CHIP8_JIT_SUPPORTED 0
+#endif
+
+// executable memory the compiled blocks are written into. it is only ever
+// writable or executable, never both at the same time.
+class CodeArena {
+  public:
+    explicit CodeArena(size_t size);
+    ~CodeArena();
+    CodeArena(const CodeArena&) = delete;
+    CodeArena& operator=(const CodeArena&) = delete;
+
+    // copies code into the arena, returns nullptr when it's full or the host
+    // won't let its pages change protection
+    const u8* append(const std::vector<u8>& code);
+    void clear() { used = 0; }
+    // the host refused to make pages writable or executable (SELinux
+    // deny_execmem, hardened kernels), nothing can be compiled
+    bool refused() const { return protection_refused; }
+  private:
+    u8* base = nullptr;
+    size_t size;
+    size_t used = 0;
+    bool protection_refused = false;
+};
+
+// compiled entry point of a block: returns the amount of guest instructions
+// it executed, which may be more than the block length when it loops back
+// into itself, but never more than budget.
+using BlockFn = u64(*)(Chip8* c8, u64 budget);
+
+struct CompiledBlock {
+    BlockFn code = nullptr;
+    // instructions executed by the longest path through the block
+    u8 max_length = 0;
+    // false until compilation was attempted, code stays nullptr for blocks
+    // that start with an instruction the compiler doesn't handle.
+    bool compiled = false;
+    u16 page_mask = 0;
+    // set when the block starts a busy loop, see busy_loop.h
+    std::optional<BusyLoop> busy_loop;
+};
+
+// translates blocks into x86-64 code. guest V registers and I live in host
+// registers for the duration of a block, the program counter is known at
+// compile time and only written back on exit.
+//
+// only register/ALU instructions, jumps and skips are compiled. everything
+// else (draws, key waits, timer reads, stores to memory, calls) returns to
+// the runtime and runs through the interpreter, so compiled code never has
+// to worry about writes to code pages.
+class Jit : public Engine {
+  public:
+    // block_limit caps the amount of blocks that get compiled, the rest is
+    // interpreted. bisecting over it narrows a divergence down to one block.
+    explicit Jit(size_t block_limit = std::numeric_limits<size_t>::max());
+
+    u64 run(Chip8& c8, u64 budget) override;
+
+    static constexpr bool supported = CHIP8_JIT_SUPPORTED;
+  private:
+    static constexpr size_t memory_size = PageIndex::memory_size;
+    static constexpr size_t arena_size = 8 * 1024 * 1024;
+
+    const CompiledBlock& lookup(const Chip8& c8, u16 address);
+    void compile(const Chip8& c8, u16 address, CompiledBlock& block);
+    void invalidate(u16 pages);
+    void flush();
+
+    CodeArena arena;
+    std::unique_ptr<std::array<CompiledBlock, memory_size>> blocks;
+    PageIndex page_index;
+    size_t block_limit;
+    size_t blocks_compiled = 0;
+};
+
+#endif
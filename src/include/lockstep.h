@@ -0,0 +1,109 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+#include "chip8.h"
+#include "nums.h"
+
+// runs many copies of one program side by side, with every piece of machine
+// state stored lane-major: registers[16][lanes], memory[4096][lanes] and so
+// on. each step picks the first lane that still has work, gathers every lane
+// sitting on the same instruction into a mask and executes it for all of them
+// at once, 16 or 32 lanes per vector instruction. lanes that diverged simply
+// end up in smaller groups, down to executing on their own.
+//
+// meant for sweeping seeds/inputs over one ROM, where lanes mostly agree.
+class Lockstep {
+  public:
+    explicit Lockstep(size_t lanes);
+
+    size_t lanes() const { return lane_count; }
+
+    // resets every lane and loads the same program into all of them
+    void load_program(const std::string& rom_path);
+    void load_program(std::span<const u8> program);
+    void seed(size_t lane, u32 seed);
+    void press_key(size_t lane, u8 key);
+    void release_key(size_t lane, u8 key);
+    // the same for every lane, see Chip8::set_quirks. meant to be called
+    // before running: memory only grows to XO-CHIP's 64K per lane when the
+    // profile asks for it, and the new part is filled from the loaded program.
+    void set_quirks(QuirkProfile profile);
+    QuirkProfile quirks() const { return quirk_profile; }
+
+    // every lane executes at most budget instructions, lanes that halt stop
+    // early. returns the instructions executed over all lanes.
+    u64 run(u64 budget);
+    // called at 60Hz
+    void tick_timers();
+
+    bool halted(size_t lane) const { return halted_lanes[lane]; }
+    const std::optional<Trap>& trap(size_t lane) const { return traps[lane]; }
+    // copies one lane out into a regular machine, e.g. to hash or inspect it
+    void export_lane(size_t lane, Chip8& c8) const;
+  private:
+    static constexpr size_t stack_depth = 12;
+    static constexpr size_t display_words = Framebuffer::plane_count * Chip8::hires_height * 2;
+
+    void load_machine(const Chip8& c8);
+    std::optional<size_t> find_leader() const;
+    u64 step(size_t leader);
+    void execute_vector(u16 address, u16 opcode, CallBack handler);
+    void execute_scalar(size_t lane, const Instruction& instruction);
+    void draw(size_t lane, const Instruction& instruction);
+    void scroll(size_t lane, CallBack handler, u8 n);
+    // steps over the next instruction, XO-CHIP's F000 nnnn included
+    void skip_long(size_t lane);
+    void raise_trap(size_t lane, TrapKind kind);
+
+    u8& reg(size_t lane, u8 x) { return registers[x * stride + lane]; }
+    u8& mem(size_t lane, u16 address) { return memory[(address & address_mask) * stride + lane]; }
+    u64& pixels(size_t lane, size_t plane, size_t row, size_t word) {
+        return display[((plane * Chip8::hires_height + row) * 2 + word) * stride + lane];
+    }
+
+    size_t lane_count;
+    // lanes rounded up to a whole number of vectors, the padding never runs
+    size_t stride;
+
+    // [4096][lanes], [65536][lanes] for XO-CHIP
+    std::vector<u8> memory;
+    // packed rows like Chip8::display, [2 planes][64 rows][2 words][lanes]
+    std::vector<u64> display;
+    std::vector<u8> hires;
+    std::vector<u8> selected_planes;
+    std::vector<u8> flags;
+    std::vector<u8> audio_pattern;
+    std::vector<u8> pitch;
+    std::vector<u16> stack;
+    std::vector<u8> registers;
+    std::vector<u16> program_counter;
+    std::vector<u16> index_register;
+    std::vector<u8> stack_pointer;
+    std::vector<u8> sound_delay;
+    std::vector<u8> timer_delay;
+    std::vector<u8> keys;
+    // 0x80 | register while Fx0A waits
+    std::vector<u8> waiting_key;
+    std::vector<std::mt19937> rnd;
+    std::vector<std::optional<Trap>> traps;
+
+    QuirkProfile quirk_profile = QuirkProfile::legacy;
+    const InstructionTable* instructions = &instruction_tables[0];
+    u16 address_mask = 0xFFF;
+    // what the loaded program put past the first 4K, for set_quirks
+    std::vector<u8> upper_memory;
+
+    // 0xFF for lanes that are trapped, waiting for a key or padding
+    std::vector<u8> halted_lanes;
+    // instructions each lane may still execute in the current run
+    std::vector<u16> remaining;
+    // 0xFF for the lanes taking part in the current step
+    std::vector<u8> group;
+};
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <span>
+#include <string>
+#include <vector>
+#include "nums.h"
+
+// a whole file mapped read only, so big or shared inputs are never copied.
+// what names the file in errors, e.g. "ROM couldn't be found". an empty file
+// maps to no bytes.
+class MappedFile {
+  public:
+    MappedFile(const std::string& path, const std::string& what);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::span<const u8> bytes() const { return {data, size}; }
+  private:
+    const u8* data = nullptr;
+    size_t size = 0;
+    // hosts without mmap read the file instead
+    std::vector<u8> buffer;
+};
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <charconv>
+#include <iostream>
+#include <optional>
+#include <string_view>
+
+// the value of a numeric command line option, the 600 of --frames=600.
+// returns false and leaves out alone unless all of text is a number that
+// fits T, so "abc", "-1" and "12x" are all rejected.
+template<class T>
+bool parse_option(const std::string_view text, T& out) {
+    T value{};
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (text.empty() || error != std::errc() || end != text.data() + text.size()) return false;
+    out = value;
+    return true;
+}
+
+template<class T>
+bool parse_option(const std::string_view text, std::optional<T>& out) {
+    T value{};
+    if (!parse_option(text, value)) return false;
+    out = value;
+    return true;
+}
+
+// what the frontends print for an option parse_option rejected, returns the
+// exit code
+inline int bad_option(const std::string_view arg, void (*print_usage)()) {
+    std::cout << "Bad value in " << arg << '\n';
+    print_usage();
+    return 1;
+}
+
+#endif
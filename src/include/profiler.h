@@ -0,0 +1,87 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <array>
+#include <string>
+#include <vector>
+#include "chip8.h"
+#include "nums.h"
+
+// only exists when built with CHIP8_PROFILE (cmake -DCHIP8_PROFILE=ON). the
+// core calls into it through PROFILE(), which compiles to nothing otherwise,
+// so a regular build pays neither a branch nor a byte for it.
+//
+// counting only touches plain arrays, every file is written from write(),
+// at exit or on SIGUSR1 once the current frame ends.
+#ifdef CHIP8_PROFILE
+
+class Profiler {
+  public:
+    // files go to prefix.folded, prefix.heatmap and prefix.summary
+    explicit Profiler(std::string prefix);
+
+    void count_instruction(const u16 address, const u16 opcode) {
+        // the heatmap covers 4K, XO-CHIP code past that folds onto it
+        addresses[address & 0xFFF]++;
+        opcodes[opcode]++;
+        contexts[context].instructions++;
+    }
+    void count_draw() { frame_draws++; }
+    // call_addr/ret, subroutines are told apart by their address
+    void enter(const u16 target);
+    void leave();
+    // from tick_timers, writes the files here if a signal asked for them
+    void end_frame(const Chip8& c8);
+
+    void write(const Chip8& c8) const;
+    // SIGUSR1 makes the next profiler to end a frame write its files
+    static void dump_on_signal();
+  private:
+    // one node of the calling context tree, 0 is the root (the program
+    // outside of any subroutine)
+    struct Context {
+        u16 target;
+        u32 parent;
+        u32 first_child;
+        u32 next_sibling;
+        u64 calls;
+        u64 instructions;
+    };
+    // bounds the tree on programs that call from everywhere to everywhere,
+    // calls past it are counted towards the caller
+    static constexpr size_t max_contexts = 1 << 16;
+
+    void write_folded(const std::string& path) const;
+    void write_heatmap(const std::string& path, const Chip8& c8) const;
+    void write_summary(const std::string& path, const Chip8& c8) const;
+    std::string context_name(u32 index) const;
+
+    std::string prefix;
+
+    std::array<u64, 4096> addresses{};
+    std::array<u64, 0x10000> opcodes{};
+
+    std::vector<Context> contexts;
+    u32 context = 0;
+    // calls entered while the tree was full, their rets don't pop anything
+    u32 untracked_depth = 0;
+
+    u32 frame_draws = 0;
+    u64 frames = 0;
+    // frames by draw calls made during them, the last bucket takes the rest
+    std::array<u64, 64> draw_histogram{};
+};
+
+#define PROFILE(c8, call) do { if ((c8).profiler) (c8).profiler->call; } while (0)
+
+inline bool profiling(const Chip8& c8) { return c8.profiler != nullptr; }
+
+#else
+
+#define PROFILE(c8, call) do {} while (0)
+
+constexpr bool profiling(const Chip8&) { return false; }
+
+#endif
+
+#endif
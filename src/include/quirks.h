@@ -0,0 +1,57 @@
+#ifndef QUIRKS_H
+#define QUIRKS_H
+
+#include <optional>
+#include <string_view>
+#include "nums.h"
+
+// the interpreters CHIP-8 programs were written for disagree on a handful of
+// instructions, and programs rely on whichever behavior they were tested
+// with. a profile picks one set of behaviors, and with it which of the later
+// extensions exist, see quirks_of.
+enum class QuirkProfile : u8 {
+    // what this emulator always did, the default so old logs still replay
+    legacy,
+    // the original interpreter on the COSMAC VIP
+    cosmac,
+    // SUPER-CHIP 1.1 on the HP 48
+    schip,
+    // XO-CHIP, as in Octo
+    xochip
+};
+
+constexpr size_t quirk_profile_count = 4;
+
+struct Quirks {
+    // 8xy6/8xyE shift Vy into Vx, otherwise Vx is shifted in place
+    bool shift_vy;
+    // Fx55/Fx65 leave I pointing past the last register
+    bool increment_i;
+    // Bnnn jumps to nnn + Vx (x being the top nibble of nnn) instead of nnn + V0
+    bool jump_vx;
+    // 8xy1/8xy2/8xy3 clear VF
+    bool reset_vf;
+    // Dxyn wraps sprites around the edges of the display instead of clipping
+    bool wrap_sprites;
+    // SUPER-CHIP's additions: hires mode, scrolling, 16x16 sprites, the big
+    // font and the RPL flags
+    bool super_chip;
+    // XO-CHIP's on top of those: two bitplanes, 64K of memory, F000 nnnn,
+    // 5xy2/5xy3 and the audio pattern
+    bool xo_chip;
+};
+
+constexpr Quirks quirks_of(QuirkProfile profile) {
+    switch (profile) {
+        case QuirkProfile::legacy: return {true, true, false, false, false, false, false};
+        case QuirkProfile::cosmac: return {true, true, false, true, false, false, false};
+        case QuirkProfile::schip: return {false, false, true, false, false, true, false};
+        case QuirkProfile::xochip: return {true, true, false, false, true, true, true};
+    }
+    return {};
+}
+
+std::optional<QuirkProfile> parse_quirk_profile(std::string_view name);
+const char* quirk_profile_name(QuirkProfile profile);
+
+#endif
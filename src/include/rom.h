@@ -0,0 +1,75 @@
+#ifndef ROM_H
+#define ROM_H
+
+#include <filesystem>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "chip8.h"
+#include "hash.h"
+#include "mapped_file.h"
+#include "nums.h"
+#include "quirks.h"
+
+// a ROM file, mapped instead of read. throws std::runtime_error when it
+// can't be read, is empty or is too big for even XO-CHIP's memory, whether it
+// fits the profile it's run with is up to Chip8::load_program.
+class Rom {
+  public:
+    explicit Rom(const std::string& path);
+
+    std::span<const u8> bytes() const { return file.bytes(); }
+    // what the ROM cache and input logs know it by
+    u64 hash() const { return fnv1a(bytes().data(), bytes().size()); }
+  private:
+    MappedFile file;
+};
+
+// the keypad layout frontends use unless told otherwise, the host key for
+// keys 0-F in order
+constexpr std::string_view default_key_layout = "x123qweasdzc4rfv";
+
+// what's known about a ROM without running it, plus the settings it's best
+// run with
+struct RomInfo {
+    u64 hash = 0;
+    size_t size = 0;
+    // the profile whose instructions it uses, legacy when it sticks to plain
+    // CHIP-8 since nothing tells the quirks of those apart statically
+    QuirkProfile quirks = QuirkProfile::legacy;
+    // instructions per second, 0 leaves it to the frontend
+    u32 ips = 0;
+    // host keys for 0-F like default_key_layout, empty for the default
+    std::string keys;
+    // byte ranges [first, last) reachable as code from the entry point,
+    // sorted. Bnnn jumps can't be followed, indirect_jumps says whether
+    // there were any and the ranges may be missing code behind them.
+    std::vector<std::pair<u32, u32>> code;
+    bool indirect_jumps = false;
+};
+
+// follows every path from 0x200 through the program, decoding as XO-CHIP so
+// every extension is recognized, and picks the profile from what it finds
+RomInfo analyze_rom(std::span<const u8> program);
+
+// rom info on disk, one small key=value text file per ROM named after its
+// content hash, so a library of thousands of ROMs is analyzed once and not
+// on every run. ips and keys can be edited in there by hand, they survive
+// the ROM being analyzed again after the analysis changed.
+class RomCache {
+  public:
+    // creates the directory when it isn't there
+    explicit RomCache(const std::string& directory);
+
+    // the cached info, on a miss the program is analyzed and the result
+    // stored
+    RomInfo lookup(std::span<const u8> program);
+  private:
+    std::filesystem::path path_of(u64 hash) const;
+
+    std::filesystem::path directory;
+};
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef RUNNER_H
+#define RUNNER_H
+
+#include "chip8.h"
+#include "engine.h"
+#include "io.h"
+#include "nums.h"
+
+// drives a machine one 60Hz frame at a time, without any notion of wall
+// clock time. input and output are optional, a runner without either runs
+// the machine as fast as the engine allows.
+class Runner {
+  public:
+    Runner(Chip8& c8, Engine& engine, InputSource* input = nullptr, FrameSink* output = nullptr)
+        : c8(c8), engine(engine), input(input), output(output) {}
+
+    // executes one frame, returns false when the machine trapped or the
+    // input ran out.
+    bool run_frame();
+    // same as run_frame, but executes at most budget instructions
+    bool run_frame(u64 budget);
+    // nothing but input can change the machine right now
+    bool idle() const { return c8.idle(); }
+
+    u32 cycles_per_frame = 10;
+    // optional, gets every frame's sound
+    AudioSink* audio = nullptr;
+
+    u64 frames = 0;
+    u64 instructions = 0;
+  private:
+    Chip8& c8;
+    Engine& engine;
+    InputSource* input;
+    FrameSink* output;
+};
+
+#endif
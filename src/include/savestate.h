@@ -0,0 +1,93 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include <array>
+#include <span>
+#include <string>
+#include <vector>
+#include "chip8.h"
+#include "mapped_file.h"
+#include "nums.h"
+
+// save states are a fixed size little endian blob:
+//
+//     "C8SS" u16 version, u16 quirk profile
+//     memory (64K), both display planes (64 rows of two u64 each)
+//     hires, selected planes, pitch (u8), RPL flags, audio pattern
+//     stack, registers, keys
+//     pc, I (u16), sp, sound, timer, waiting key (u8, 0x80 | register while Fx0A waits)
+//     trap: u8 present, u8 kind, u16 address, u16 opcode
+//     rng: u16 length, std::mt19937 written with operator<<, zero padded
+//
+// the version goes up whenever the layout or meaning changes, states that
+// can't be converted are rejected rather than misread. version 1 left the pc
+// on a waiting Fx0A, 2 points past it. 1 and 2 had 4K of memory and a single
+// 64x32 plane and nothing between the display and the stack, and were all
+// legacy. a state only loads into a machine with the profile it was saved
+// with, memory size and handlers depend on it.
+constexpr u16 save_state_version = 3;
+constexpr size_t save_state_rng_size = 6880;
+// from the stack on, every version is the same
+constexpr size_t save_state_tail_size = 12 * 2 + 16 + 16 + 2 + 2 + 4 + 6 + 2 + save_state_rng_size;
+constexpr size_t save_state_v2_size = 8 + 4096 + Chip8::display_height * 8 + save_state_tail_size;
+constexpr size_t save_state_size =
+    8 + 65536 + Framebuffer::plane_count * Chip8::hires_height * 16 + 3 + 16 + 16 + save_state_tail_size;
+
+using SaveState = std::array<u8, save_state_size>;
+
+void save_state(const Chip8& c8, SaveState& out);
+// throws std::runtime_error when the data isn't a save state of this version
+// or c8's quirk profile
+void load_state(Chip8& c8, std::span<const u8> in);
+
+void save_state_file(const Chip8& c8, const std::string& path);
+void load_state_file(Chip8& c8, const std::string& path);
+
+// a save state file mapped read only, so resuming from a checkpoint doesn't
+// copy the file first and many jobs can share one mapping.
+class MappedState {
+  public:
+    explicit MappedState(const std::string& path);
+
+    std::span<const u8> bytes() const { return file.bytes(); }
+  private:
+    MappedFile file;
+};
+
+// history of per-frame snapshots in a fixed amount of memory. only the
+// newest snapshot is kept whole, every older one is stored as the xor with
+// its successor, run length encoded, so frames that change little cost a few
+// bytes. the oldest frames are dropped when the buffer runs full.
+class Rewind {
+  public:
+    explicit Rewind(size_t capacity = 4 * 1024 * 1024);
+
+    // call once per frame
+    void record(const Chip8& c8);
+    // restores the frame recorded before the newest one and makes it the
+    // newest. returns false when there is no older frame left.
+    bool step_back(Chip8& c8);
+    // frames step_back can go back
+    size_t frames() const { return deltas; }
+    size_t bytes_used() const { return used; }
+  private:
+    void push_record(std::span<const u8> record);
+    void drop_oldest();
+    u32 read_length(size_t at) const;
+    void write_bytes(size_t at, std::span<const u8> bytes);
+    void read_bytes(size_t at, std::span<u8> bytes) const;
+
+    SaveState newest{};
+    bool has_newest = false;
+    SaveState scratch{};
+    std::vector<u8> encoded;
+
+    // records are [u32 length][delta][u32 length] back to back, so the ring
+    // can be trimmed from the old end and popped from the new end.
+    std::vector<u8> ring;
+    size_t head = 0;
+    size_t used = 0;
+    size_t deltas = 0;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <chrono>
+#include <ratio>
+#include "chip8.h"
+#include "engine.h"
+#include "io.h"
+#include "nums.h"
+#include "runner.h"
+
+// paces a Runner against the wall clock. emulated time still advances in
+// 60Hz frames of runner.cycles_per_frame instructions and timers tick once
+// per emulated frame, however long the host took for it. deadlines are
+// counted from the start instead of sleeping a frame after each one, so
+// oversleeping never adds up to drift.
+//
+// sits between the runner and the real frame sink, which lets it leave out
+// frames nobody will get to see: ones run to catch up and most of turbo.
+class Scheduler : public FrameSink {
+  public:
+    using clock = std::chrono::steady_clock;
+    // exactly 1/60s, no rounding to nanoseconds
+    using frames = std::chrono::duration<i64, std::ratio<1, 60>>;
+
+    enum class Mode : u8 {
+        // one frame per 1/60s, late frames are run back to back to catch up
+        realtime,
+        // uncapped, only every present_every-th frame is shown
+        turbo
+    };
+
+    Scheduler(Chip8& c8, Engine& engine, InputSource* input = nullptr, FrameSink* output = nullptr)
+        : runner(c8, engine, input, this), input(input), output(output) {}
+
+    // runs until the machine traps, the input runs out or frame_limit frames
+    // ran, 0 for no limit. an idle machine waits for the input's
+    // wait_for_input instead of running frames, if the input can wait.
+    void run(u64 frame_limit = 0);
+
+    void present(const Chip8& c8, u64 dirty_rows) override;
+
+    Runner runner;
+    Mode mode = Mode::realtime;
+    u32 present_every = 8;
+    // being further behind than this means the host stalled (suspended,
+    // stopped in a debugger), those frames are dropped and the schedule
+    // starts over from now.
+    u32 max_late_frames = 6;
+
+    // frames run late and not shown
+    u64 late_frames = 0;
+    // frames skipped entirely after a stall
+    u64 dropped_frames = 0;
+  private:
+    InputSource* input;
+    FrameSink* output;
+    bool presenting = true;
+    // rows drawn during frames that weren't shown
+    u64 pending_rows = 0;
+};
+
+// instructions per 60Hz frame for a speed in instructions per second. frames
+// hold whole instructions so runs stay reproducible frame by frame, the speed
+// is rounded to the nearest multiple of 60.
+constexpr u32 cycles_for_speed(u32 instructions_per_second) {
+    const u32 cycles = (instructions_per_second + 30) / 60;
+    return cycles ? cycles : 1;
+}
+
+#endif
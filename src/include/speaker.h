@@ -0,0 +1,42 @@
+#ifndef SPEAKER_H
+#define SPEAKER_H
+
+#include "SDL2/SDL.h"
+#include "audio.h"
+#include "io.h"
+#include "nums.h"
+#include "spsc_queue.h"
+
+// plays the buzzer through SDL audio. the machine thread generates a frame of
+// samples at a time into a ring, SDL's audio thread drains it from its
+// callback, neither side ever locks or waits. playback starts once a few
+// frames are buffered, so the machine running slightly ahead never lets the
+// device run dry. when it runs far ahead (turbo), samples that don't fit are
+// dropped.
+class Speaker : public AudioSink {
+  public:
+    Speaker() {}
+    Speaker(const Speaker&) = delete;
+    Speaker& operator=(const Speaker&) = delete;
+    ~Speaker() {
+        if (device) SDL_CloseAudioDevice(device);
+    }
+
+    // needs SDL_INIT_AUDIO, returns false without a usable device
+    bool initialize();
+    void play_frame(bool sound_on) override;
+  private:
+    static void fill(void* userdata, Uint8* stream, int length);
+
+    // frames buffered before playback starts, about 33ms
+    static constexpr size_t prefill_frames = 2;
+
+    // about 85ms at 48kHz
+    SpscQueue<i16, 4096> ring;
+    Beeper beeper;
+    Beeper::Frame samples;
+    SDL_AudioDeviceID device = 0;
+    size_t frames_played = 0;
+};
+
+#endif
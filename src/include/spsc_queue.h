@@ -0,0 +1,83 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <span>
+
+// bounded queue between exactly one producer and one consumer thread, neither
+// side ever blocks or takes a lock. push fails when the queue is full.
+//
+// head and tail only ever grow and wrap through the mask, each side keeps a
+// copy of the other's index and only reloads it when it looks full/empty.
+template <typename T, size_t capacity>
+class SpscQueue {
+    static_assert(std::has_single_bit(capacity), "capacity has to be a power of two");
+  public:
+    // producer side
+    bool push(const T& value) {
+        const size_t tail_now = tail.load(std::memory_order_relaxed);
+        if (tail_now - head_seen == capacity) {
+            head_seen = head.load(std::memory_order_acquire);
+            if (tail_now - head_seen == capacity) return false;
+        }
+        slots[tail_now & mask] = value;
+        tail.store(tail_now + 1, std::memory_order_release);
+        return true;
+    }
+
+    // pushes as many values as fit, returns how many that was
+    size_t push(std::span<const T> values) {
+        const size_t tail_now = tail.load(std::memory_order_relaxed);
+        if (capacity - (tail_now - head_seen) < values.size()) {
+            head_seen = head.load(std::memory_order_acquire);
+        }
+        const size_t count = std::min(values.size(), capacity - (tail_now - head_seen));
+        for (size_t i = 0; i < count; i++) {
+            slots[(tail_now + i) & mask] = values[i];
+        }
+        tail.store(tail_now + count, std::memory_order_release);
+        return count;
+    }
+
+    // consumer side, nullptr when empty. the element stays valid until pop
+    const T* front() {
+        const size_t head_now = head.load(std::memory_order_relaxed);
+        if (head_now == tail_seen) {
+            tail_seen = tail.load(std::memory_order_acquire);
+            if (head_now == tail_seen) return nullptr;
+        }
+        return &slots[head_now & mask];
+    }
+    void pop() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+    // pops up to values.size() values into values, returns how many
+    size_t pop(std::span<T> values) {
+        const size_t head_now = head.load(std::memory_order_relaxed);
+        if (tail_seen - head_now < values.size()) {
+            tail_seen = tail.load(std::memory_order_acquire);
+        }
+        const size_t count = std::min(values.size(), tail_seen - head_now);
+        for (size_t i = 0; i < count; i++) {
+            values[i] = slots[(head_now + i) & mask];
+        }
+        head.store(head_now + count, std::memory_order_release);
+        return count;
+    }
+  private:
+    static constexpr size_t mask = capacity - 1;
+
+    std::array<T, capacity> slots{};
+    // written by the consumer
+    alignas(64) std::atomic<size_t> head = 0;
+    size_t tail_seen = 0;
+    // written by the producer
+    alignas(64) std::atomic<size_t> tail = 0;
+    size_t head_seen = 0;
+};
+
+#endif
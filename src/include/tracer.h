@@ -0,0 +1,177 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+#include "chip8.h"
+#include "engine.h"
+#include "mapped_file.h"
+#include "nums.h"
+#include "quirks.h"
+#include "spsc_queue.h"
+
+// one executed instruction, as the machine thread hands it to the flush
+// thread. the registers are the ones after the instruction ran, all zero
+// when the trace leaves them out.
+struct TraceRecord {
+    // instructions traced before this one
+    u64 instruction = 0;
+    u16 pc = 0;
+    u16 opcode = 0;
+    u16 index = 0;
+    std::array<u8, 16> registers{};
+};
+static_assert(sizeof(TraceRecord) == 32, "records should stay a power of two bytes");
+
+// records on disk, each as what changed since the one before it:
+//
+//     u8 tag, then the fields its bits ask for, in this order:
+//       trace_gap       varint instructions since the previous record, when not 1
+//       trace_jump      varint pc, when it isn't the previous pc + 2
+//       trace_opcode    u16 opcode, big endian, when it isn't the last one seen
+//                       at this pc
+//       trace_index     varint I
+//       trace_registers varint mask of the changed V0-VE, then a byte for each
+//       trace_flag      u8 VF
+//
+// varints are LEB128. straight line code takes 2-4 bytes an instruction
+// instead of the 32 of a record.
+constexpr u8 trace_gap = 1;
+constexpr u8 trace_jump = 2;
+constexpr u8 trace_opcode = 4;
+constexpr u8 trace_index = 8;
+constexpr u8 trace_registers = 16;
+constexpr u8 trace_flag = 32;
+
+class TraceEncoder {
+  public:
+    // the most bytes a record can take
+    static constexpr size_t max_size = 1 + 10 + 3 + 2 + 3 + 3 + 15 + 1;
+
+    TraceEncoder();
+    // writes record to out, which has room for max_size bytes, and returns
+    // where it ended
+    u8* encode(const TraceRecord& record, u8* out);
+  private:
+    TraceRecord previous;
+    // the last opcode seen at every address
+    std::vector<u16> opcodes;
+};
+
+class TraceDecoder {
+  public:
+    TraceDecoder();
+    // the record at bytes[at], moving at past it. nullopt at the end, throws
+    // std::runtime_error on a record that's cut off.
+    std::optional<TraceRecord> decode(std::span<const u8> bytes, size_t& at);
+  private:
+    TraceRecord previous;
+    std::vector<u16> opcodes;
+};
+
+// records every instruction the machine runs into a file, for diagnosing runs
+// too long to step through. the machine's thread only fills fixed size
+// records into a lock free ring, a thread of the tracer's own encodes and
+// writes them, and the machine thread only waits when that thread falls a
+// whole ring behind. one tracer per machine: the ring has exactly one
+// producer, machines on other threads get tracers (and files) of their own.
+//
+// traced machines run through the interpreter loop with Hooks, see
+// TracingInterpreter. every iteration of a busy loop is traced rather than
+// skipped, the machine still ends up exactly where an untraced run would.
+class Tracer {
+  public:
+    // profile is only stored for disassembling the trace later. without
+    // registers only pc and opcode are recorded. throws std::runtime_error
+    // when path can't be written.
+    Tracer(const std::string& path, QuirkProfile profile, bool registers = true);
+    // writes whatever is still queued
+    ~Tracer();
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    u64 instructions() const { return count; }
+
+    struct Hooks {
+        static constexpr bool fast_forward = false;
+
+        bool stop(const Chip8& c8) {
+            record.pc = c8.program_counter;
+            record.opcode = c8.load(c8.program_counter) << 8 | c8.load(c8.program_counter + 1);
+            return false;
+        }
+        void executed(const Chip8& c8) {
+            if (tracer.registers) {
+                record.index = c8.index_register;
+                record.registers = c8.registers;
+            }
+            record.instruction = tracer.count++;
+            tracer.push(record);
+        }
+
+        Tracer& tracer;
+        TraceRecord record;
+    };
+
+    // the file starts with "C8TR" u8 version, u8 flags, u8 quirk profile,
+    // then the records
+    static constexpr std::array<u8, 4> magic = {'C', '8', 'T', 'R'};
+    static constexpr u8 version = 1;
+    static constexpr size_t header_size = magic.size() + 3;
+    // I and the V registers are recorded
+    static constexpr u8 flag_registers = 1;
+  private:
+    // 2MB of records
+    static constexpr size_t ring_size = 1 << 16;
+
+    void push(const TraceRecord& record) {
+        while (!ring->push(record)) std::this_thread::yield();
+    }
+    void flush();
+
+    std::ofstream out;
+    bool registers;
+    u64 count = 0;
+    std::unique_ptr<SpscQueue<TraceRecord, ring_size>> ring;
+    std::atomic<bool> stopping = false;
+    std::thread flusher;
+};
+
+// a trace file written by a Tracer, decoded a record at a time
+class TraceReader {
+  public:
+    // throws std::runtime_error when path isn't a trace
+    explicit TraceReader(const std::string& path);
+
+    std::optional<TraceRecord> next() { return decoder.decode(file.bytes(), at); }
+    bool registers() const { return flags & Tracer::flag_registers; }
+    QuirkProfile profile() const { return quirks; }
+  private:
+    MappedFile file;
+    size_t at = Tracer::header_size;
+    u8 flags = 0;
+    QuirkProfile quirks = QuirkProfile::legacy;
+    TraceDecoder decoder;
+};
+
+// the interpreter with a tracer attached. every engine runs traced machines
+// this way, compiled code has nowhere to record from.
+class TracingInterpreter : public Engine {
+  public:
+    explicit TracingInterpreter(Tracer& tracer) : tracer(tracer) {}
+    u64 run(Chip8& c8, u64 budget) override {
+        Tracer::Hooks hooks{tracer, {}};
+        return interpret(c8, budget, hooks);
+    }
+  private:
+    Tracer& tracer;
+};
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <array>
+#include <atomic>
+#include "nums.h"
+
+// hands the latest value from one writer thread to one reader thread without
+// either ever waiting. the writer fills back() and publishes it, the reader
+// picks up whatever was published last, values published in between are
+// simply replaced.
+//
+// three slots: one the writer owns, one the reader owns and one in the middle
+// that the two swap theirs with.
+template <typename T>
+class TripleBuffer {
+  public:
+    // writer side
+    T& back() { return slots[back_index]; }
+    void publish() {
+        back_index = middle.exchange(back_index | fresh, std::memory_order_acq_rel) & index_mask;
+    }
+
+    // reader side, returns false when nothing new was published since the
+    // last update and front() is still the latest value
+    bool update() {
+        if (!(middle.load(std::memory_order_relaxed) & fresh)) return false;
+        front_index = middle.exchange(front_index, std::memory_order_acq_rel) & index_mask;
+        return true;
+    }
+    const T& front() const { return slots[front_index]; }
+  private:
+    static constexpr u8 index_mask = 0x3;
+    // set on the middle slot while the reader hasn't taken it yet
+    static constexpr u8 fresh = 0x4;
+
+    std::array<T, 3> slots{};
+    alignas(64) u8 back_index = 0;
+    alignas(64) std::atomic<u8> middle = 1;
+    alignas(64) u8 front_index = 2;
+};
+
+#endif
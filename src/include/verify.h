@@ -0,0 +1,132 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <span>
+#include "chip8.h"
+#include "engine.h"
+#include "hash.h"
+#include "inputlog.h"
+#include "nums.h"
+#include "quirks.h"
+#include "runner.h"
+
+// where a candidate engine first stopped agreeing with the reference
+struct Divergence {
+    // frames completed before the one it happened in
+    u64 frame = 0;
+    // instructions executed from boot, and within the frame, before the
+    // first one that differs
+    u64 instruction = 0;
+    u64 in_frame = 0;
+    // every instruction of the frame agreed, it's the timers or input at the
+    // end of it that didn't
+    bool after_frame = false;
+    // the lane, for divergences LockstepVerifier found
+    std::optional<size_t> lane;
+    // the machine right before it, and right after on either engine
+    std::unique_ptr<Chip8> before;
+    std::unique_ptr<Chip8> reference;
+    std::unique_ptr<Chip8> candidate;
+};
+
+// runs a candidate engine side by side with a reference one, both starting
+// from the same machine (ROM, profile, RNG seed, save state) and fed the same
+// input log. every interval frames the states are hashed into a rolling
+// digest per engine, and every few checkpoints the agreeing machine is
+// copied. when the digests part, both engines go back to the last copy and
+// the frames since are bisected down to the first frame and then the first
+// instruction whose state differs.
+class Verifier {
+  public:
+    Verifier(const Chip8& boot, EngineKind reference, EngineKind candidate, const InputLog* log = nullptr);
+    ~Verifier();
+
+    // runs at most frames frames, less when the reference traps or the log
+    // runs out. returns the first divergence, if any.
+    std::optional<Divergence> run(u64 frames);
+
+    u64 frames() const;
+    u64 instructions() const;
+    // hash of every checkpoint's state so far, equal on both engines until
+    // they diverge
+    u64 digest() const { return reference_digest; }
+
+    // frames between checkpoints, at least 1
+    u64 interval = 1;
+    u32 cycles_per_frame = 10;
+
+    // both states side by side, with the instruction they diverged on
+    static void print(std::ostream& os, const Divergence& divergence);
+  private:
+    struct Side;
+    // both sides agreed here, one machine and input position describe them
+    struct Checkpoint {
+        std::unique_ptr<Chip8> c8;
+        std::optional<ReplayInput> input;
+        u64 frames = 0;
+        u64 instructions = 0;
+    };
+
+    void take(Checkpoint& checkpoint) const;
+    void restore(const Checkpoint& checkpoint);
+    bool step(Side& side);
+    // everything the engines have to agree on, state, instruction count and
+    // trap
+    static u64 checkpoint_hash(const Side& side);
+    bool agree() const;
+    Divergence bisect(u64 frames);
+
+    std::unique_ptr<Side> reference_side;
+    std::unique_ptr<Side> candidate_side;
+    // the latest agreeing state kept, and the frames run since
+    Checkpoint last;
+    u64 since_last = 0;
+    static constexpr u64 frames_per_copy = 64;
+    u64 reference_digest = fnv1a_offset;
+    u64 candidate_digest = fnv1a_offset;
+};
+
+// Lockstep isn't an Engine, it runs many machines booted from a ROM at once
+// rather than one from any state, so it's checked a lane at a time: lane n,
+// seeded with first_seed + n, against an interpreter machine seeded the same
+// and fed the same input, after every frame. when one differs, everything
+// runs again from boot to that frame and then an instruction at a time to
+// the first one that differs.
+class LockstepVerifier {
+  public:
+    // log has to be timed in frames, lanes don't count their own instructions
+    LockstepVerifier(std::span<const u8> program, QuirkProfile profile, size_t lanes, u32 first_seed,
+                     const InputLog* log = nullptr);
+    ~LockstepVerifier();
+
+    // runs at most frames frames, less when the log runs out. returns the
+    // first divergence on any lane, if any.
+    std::optional<Divergence> run(u64 frames);
+
+    u64 frames() const;
+    // over all lanes
+    u64 instructions() const;
+    // hash of every lane's state after every frame so far
+    u64 digest() const { return lane_digest; }
+
+    u32 cycles_per_frame = 10;
+  private:
+    struct Lanes;
+
+    Divergence locate(size_t lane, u64 frame) const;
+
+    std::span<const u8> program;
+    QuirkProfile profile;
+    size_t lane_count;
+    u32 first_seed;
+    const InputLog* log;
+    std::unique_ptr<Lanes> lanes;
+    u64 lane_digest = fnv1a_offset;
+};
+
+std::ostream& operator<<(std::ostream& os, const Divergence& divergence);
+
+#endif
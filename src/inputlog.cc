@@ -0,0 +1,142 @@
+#include "include/inputlog.h"
+
+#include <array>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include "include/rom.h"
+
+namespace {
+
+constexpr std::array<u8, 4> magic = {'C', '8', 'I', 'N'};
+constexpr u8 end_marker = 0xFF;
+
+void put_number(std::vector<u8>& out, const u64 value, const size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) out.push_back(value >> (8 * i));
+}
+
+void put_varint(std::vector<u8>& out, u64 value) {
+    while (value >= 0x80) {
+        out.push_back(0x80 | (value & 0x7F));
+        value >>= 7;
+    }
+    out.push_back(value);
+}
+
+class Reader {
+  public:
+    explicit Reader(std::span<const u8> in) : in(in) {}
+
+    u8 byte() {
+        if (at == in.size()) throw std::runtime_error("input log is truncated\n");
+        return in[at++];
+    }
+    u64 number(const size_t bytes) {
+        u64 value = 0;
+        for (size_t i = 0; i < bytes; i++) value |= static_cast<u64>(byte()) << (8 * i);
+        return value;
+    }
+    u64 varint() {
+        u64 value = 0;
+        for (size_t shift = 0; shift < 64; shift += 7) {
+            const u8 next = byte();
+            value |= static_cast<u64>(next & 0x7F) << shift;
+            if (!(next & 0x80)) return value;
+        }
+        throw std::runtime_error("input log has a bad number\n");
+    }
+  private:
+    std::span<const u8> in;
+    size_t at = 0;
+};
+
+}
+
+std::vector<u8> InputLog::encode() const {
+    std::vector<u8> out(magic.begin(), magic.end());
+    out.push_back(version);
+    out.push_back(static_cast<u8>(timebase));
+    put_number(out, seed, 4);
+    put_number(out, rom_hash, 8);
+    put_number(out, cycles_per_frame, 4);
+    out.push_back(static_cast<u8>(quirks));
+
+    u64 time = 0;
+    for (const KeyEvent& event : events) {
+        put_varint(out, event.time - time);
+        out.push_back((event.key & 0xF) | (event.pressed << 4));
+        time = event.time;
+    }
+    put_varint(out, end - time);
+    out.push_back(end_marker);
+    return out;
+}
+
+InputLog InputLog::decode(std::span<const u8> bytes) {
+    Reader reader(bytes);
+    for (const u8 expected : magic) {
+        if (reader.byte() != expected) throw std::runtime_error("not an input log\n");
+    }
+    const u8 log_version = reader.byte();
+    if (log_version != 1 && log_version != version) throw std::runtime_error("input log is from an unsupported version\n");
+
+    InputLog log;
+    const u8 timebase = reader.byte();
+    if (timebase > static_cast<u8>(Timebase::instruction)) throw std::runtime_error("input log has a bad timebase\n");
+    log.timebase = static_cast<Timebase>(timebase);
+    log.seed = reader.number(4);
+    log.rom_hash = reader.number(8);
+    log.cycles_per_frame = reader.number(4);
+    if (log_version >= 2) {
+        const u8 quirks = reader.byte();
+        if (quirks >= quirk_profile_count) throw std::runtime_error("input log has a bad quirk profile\n");
+        log.quirks = static_cast<QuirkProfile>(quirks);
+    }
+
+    u64 time = 0;
+    while (true) {
+        time += reader.varint();
+        const u8 code = reader.byte();
+        if (code == end_marker) break;
+        if (code >> 5) throw std::runtime_error("input log has a bad event\n");
+        log.events.push_back({time, static_cast<u8>(code & 0xF), static_cast<bool>(code >> 4)});
+    }
+    log.end = time;
+    return log;
+}
+
+void InputLog::save(const std::string& path) const {
+    const std::vector<u8> bytes = encode();
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    if (!file.good())
+        throw std::runtime_error("input log couldn't be written\n");
+}
+
+InputLog InputLog::load(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.good())
+        throw std::runtime_error("input log couldn't be found\n");
+    const std::vector<u8> bytes{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+    return decode(bytes);
+}
+
+u64 rom_file_hash(const std::string& path) {
+    return Rom(path).hash();
+}
+
+bool ReplayInput::poll(Chip8& c8, const InputTime& now) {
+    const u64 time = log.time_of(now);
+    for (; next < log.events.size() && log.events[next].time <= time; next++) {
+        const KeyEvent& event = log.events[next];
+        if (event.pressed) {
+            c8.press_key(event.key);
+        } else {
+            c8.release_key(event.key);
+        }
+    }
+    // instructions stand still while the machine waits for a key. if no key
+    // is due at this point, this isn't the run that got recorded.
+    if (log.timebase == Timebase::instruction && c8.halted() && time < log.end) return false;
+    return time < log.end;
+}
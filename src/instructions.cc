@@ -1,54 +1,120 @@
-#include <stdint.h>
-#include <unordered_map>
+#include <array>
 #include "include/chip8.h"
 #include "include/instructions.h"
 
-const std::unordered_map<Mask, CallBack> instruction_table_0 = {
-    {0x0, Chip8::cls},
-    {0xE, Chip8::ret}
-};
+namespace {
 
-const std::unordered_map<Mask, CallBack> instruction_table_8 = {
-    {0x0, Chip8::ld_vx_vy},
-    {0x1, Chip8::or_vx_vy},
-    {0x2, Chip8::and_vx_vy},
-    {0x3, Chip8::xor_vx_vy},
-    {0x4, Chip8::add_vx_vy},
-    {0x5, Chip8::sub_vx_vy},
-    {0x6, Chip8::shr_vx_vy},
-    {0x7, Chip8::subn_vx_vy},
-    {0xE, Chip8::shl_vx_vy}
-};
+// mirrors the layout of the opcode families: the most significant nibble picks
+// the family, and within 0x0, 0x8, 0xE and 0xF the low nibble/byte picks the
+// instruction. anything else is not a valid instruction and traps. where the
+// variants disagree the profile picks a handler, the handlers themselves
+// never look at it. the same goes for SUPER-CHIP and XO-CHIP instructions,
+// they only decode under profiles that have them.
+template <QuirkProfile profile>
+constexpr CallBack decode(const u16 opcode) {
+    constexpr Quirks quirks = quirks_of(profile);
+    const u8 most_significant_nibble = opcode >> 12;
+    const u8 least_significant_nibble = opcode & 0x000F;
+    const u8 least_significant_byte = opcode & 0x00FF;
 
-const std::unordered_map<Mask, CallBack> instruction_table_e = {
-    {0x9E, Chip8::skp_vx},
-    {0xA1, Chip8::sknp_vx}
-};
+    switch (most_significant_nibble) {
+        case 0x0:
+            if (opcode == 0x00E0) return Chip8::cls;
+            if (opcode == 0x00EE) return Chip8::ret;
+            if (quirks.super_chip) {
+                if ((opcode & 0xFFF0) == 0x00C0) return Chip8::scroll_down_n;
+                if (opcode == 0x00FB) return Chip8::scroll_right;
+                if (opcode == 0x00FC) return Chip8::scroll_left;
+                if (opcode == 0x00FD) return Chip8::exit;
+                if (opcode == 0x00FE) return Chip8::low_res;
+                if (opcode == 0x00FF) return Chip8::high_res;
+            }
+            if (quirks.xo_chip && (opcode & 0xFFF0) == 0x00D0) return Chip8::scroll_up_n;
+            break;
+        case 0x1: return Chip8::jp_addr;
+        case 0x2: return Chip8::call_addr;
+        case 0x3: return quirks.xo_chip ? Chip8::skip_next_ife_vxkk_long : Chip8::skip_next_ife_vxkk;
+        case 0x4: return quirks.xo_chip ? Chip8::skip_next_ifne_vxkk_long : Chip8::skip_next_ifne_vxkk;
+        case 0x5:
+            if (least_significant_nibble == 0x0) return quirks.xo_chip ? Chip8::skip_next_ife_vxvy_long : Chip8::skip_next_ife_vxvy;
+            if (quirks.xo_chip && least_significant_nibble == 0x2) return Chip8::ld_i_vx_vy;
+            if (quirks.xo_chip && least_significant_nibble == 0x3) return Chip8::ld_vx_vy_i;
+            break;
+        case 0x6: return Chip8::ld_vx_kk;
+        case 0x7: return Chip8::add_vx_kk;
+        case 0x8:
+            switch (least_significant_nibble) {
+                case 0x0: return Chip8::ld_vx_vy;
+                case 0x1: return quirks.reset_vf ? Chip8::or_vx_vy_reset_vf : Chip8::or_vx_vy;
+                case 0x2: return quirks.reset_vf ? Chip8::and_vx_vy_reset_vf : Chip8::and_vx_vy;
+                case 0x3: return quirks.reset_vf ? Chip8::xor_vx_vy_reset_vf : Chip8::xor_vx_vy;
+                case 0x4: return Chip8::add_vx_vy;
+                case 0x5: return Chip8::sub_vx_vy;
+                case 0x6: return quirks.shift_vy ? Chip8::shr_vx_vy : Chip8::shr_vx;
+                case 0x7: return Chip8::subn_vx_vy;
+                case 0xE: return quirks.shift_vy ? Chip8::shl_vx_vy : Chip8::shl_vx;
+            }
+            break;
+        case 0x9:
+            if (least_significant_nibble == 0x0) return quirks.xo_chip ? Chip8::skip_next_ifne_vx_vy_long : Chip8::skip_next_ifne_vx_vy;
+            break;
+        case 0xA: return Chip8::ld_iaddr;
+        case 0xB: return quirks.jump_vx ? Chip8::jp_offset_vx : Chip8::jp_offset;
+        case 0xC: return Chip8::rnd_vx_kk;
+        case 0xD:
+            if (quirks.super_chip && least_significant_nibble == 0x0) {
+                return quirks.wrap_sprites ? Chip8::draw_vx_vy_large_wrap : Chip8::draw_vx_vy_large;
+            }
+            return quirks.wrap_sprites ? Chip8::draw_vx_vy_nibble_wrap : Chip8::draw_vx_vy_nibble;
+        case 0xE:
+            if (least_significant_byte == 0x9E) return quirks.xo_chip ? Chip8::skp_vx_long : Chip8::skp_vx;
+            if (least_significant_byte == 0xA1) return quirks.xo_chip ? Chip8::sknp_vx_long : Chip8::sknp_vx;
+            break;
+        case 0xF:
+            if (quirks.xo_chip) {
+                if (opcode == 0xF000) return Chip8::ld_i_long;
+                if (opcode == 0xF002) return Chip8::ld_audio_i;
+                if (least_significant_byte == 0x01) return Chip8::plane_n;
+                if (least_significant_byte == 0x3A) return Chip8::ld_pitch_vx;
+                if (least_significant_byte == 0x1E) return Chip8::add_i_vx_wide;
+            }
+            if (quirks.super_chip) {
+                if (least_significant_byte == 0x30) return Chip8::ld_hf_vx;
+                if (least_significant_byte == 0x75) return Chip8::ld_r_vx;
+                if (least_significant_byte == 0x85) return Chip8::ld_vx_r;
+            }
+            switch (least_significant_byte) {
+                case 0x07: return Chip8::ld_vx_dt;
+                case 0x0A: return Chip8::ld_vx_key;
+                case 0x15: return Chip8::ld_dt_vx;
+                case 0x18: return Chip8::ld_st_vx;
+                case 0x1E: return Chip8::add_i_vx;
+                case 0x29: return Chip8::ld_f_vx;
+                case 0x33: return Chip8::ld_b_vx;
+                case 0x55: return quirks.increment_i ? Chip8::ld_i_vx : Chip8::ld_i_vx_keep_i;
+                case 0x65: return quirks.increment_i ? Chip8::ld_vx_i : Chip8::ld_vx_i_keep_i;
+            }
+            break;
+    }
+    return Chip8::invalid_opcode;
+}
 
-const std::unordered_map<Mask, CallBack> instruction_table_f = {
-    {0x07, Chip8::ld_vx_dt},
-    {0x0A, Chip8::ld_vx_key},
-    {0x15, Chip8::ld_dt_vx},
-    {0x18, Chip8::ld_st_vx},
-    {0x1E, Chip8::add_i_vx},
-    {0x29, Chip8::ld_f_vx},
-    {0x33, Chip8::ld_b_vx},
-    {0x55, Chip8::ld_i_vx},
-    {0x65, Chip8::ld_vx_i}
-};
+template <QuirkProfile profile>
+constexpr InstructionTable make_instruction_table() {
+    InstructionTable table{};
+    for (u32 opcode = 0; opcode < table.size(); opcode++) {
+        table[opcode] = {decode<profile>(opcode), OpcodeFields(opcode)};
+    }
+    return table;
+}
 
-const std::unordered_map<Mask, CallBack> instruction_table_rest = {
-    {0x1, Chip8::jp_addr},
-    {0x2, Chip8::call_addr},
-    {0x3, Chip8::skip_next_ife_vxkk},
-    {0x4, Chip8::skip_next_ifne_vxkk},
-    {0x5, Chip8::skip_next_ife_vxvy},
-    {0x6, Chip8::ld_vx_kk},
-    {0x7, Chip8::add_vx_kk},
-    {0x9, Chip8::skip_next_ifne_vx_vy},
-    {0xA, Chip8::ld_iaddr},
-    {0xB, Chip8::jp_offset},
-    {0xC, Chip8::rnd_vx_kk},
-    {0xD, Chip8::draw_vx_vy_nibble}
-};
+}
 
+// built at compile time, so dispatching an opcode is a single indexed load
+// instead of a hash lookup. one table per profile, in QuirkProfile order.
+constexpr std::array<InstructionTable, quirk_profile_count> instruction_tables = {
+    make_instruction_table<QuirkProfile::legacy>(),
+    make_instruction_table<QuirkProfile::cosmac>(),
+    make_instruction_table<QuirkProfile::schip>(),
+    make_instruction_table<QuirkProfile::xochip>(),
+};
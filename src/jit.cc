@@ -0,0 +1,531 @@
+#include "include/jit.h"
+#include "include/profiler.h"
+
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+
+#if CHIP8_JIT_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+enum Reg : u8 { rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi, r8, r9, r10, r11, r12, r13, r14, r15 };
+
+enum Condition : u8 {
+    below_equal = 0x6,
+    above = 0x7,
+    equal = 0x4,
+    not_equal = 0x5
+};
+
+// 32 bit ALU instructions, in their "op r/m32, r32" form and the /digit of
+// their "op r/m32, imm32" form.
+struct Alu {
+    u8 opcode;
+    u8 digit;
+};
+constexpr Alu add{0x01, 0};
+constexpr Alu or_{0x09, 1};
+constexpr Alu and_{0x21, 4};
+constexpr Alu sub{0x29, 5};
+constexpr Alu xor_{0x31, 6};
+constexpr Alu cmp{0x39, 7};
+constexpr Alu mov{0x89, 0};
+
+// just enough of an x86-64 assembler for what the block compiler emits.
+// all memory operands are [rbx + disp32], rbx always holds the Chip8*.
+class Assembler {
+  public:
+    std::vector<u8> code;
+
+    size_t position() const { return code.size(); }
+
+    void alu(Alu op, Reg dst, Reg src) { rex(false, src, dst); byte(op.opcode); modrm(3, src, dst); }
+    void alu(Alu op, Reg dst, u32 imm) { rex(false, 0, dst); byte(0x81); modrm(3, op.digit, dst); dword(imm); }
+    void mov_imm(Reg dst, u32 imm) { rex(false, 0, dst); byte(0xB8 + (dst & 7)); dword(imm); }
+    void shr(Reg dst, u8 count) { rex(false, 0, dst); byte(0xC1); modrm(3, 5, dst); byte(count); }
+    void shl(Reg dst, u8 count) { rex(false, 0, dst); byte(0xC1); modrm(3, 4, dst); byte(count); }
+    void imul(Reg dst, Reg src, u8 imm) { rex(false, dst, src); byte(0x6B); modrm(3, dst, src); byte(imm); }
+
+    // dst = condition ? 1 : 0, dst has to be rax or rcx
+    void set(Condition condition, Reg dst) {
+        byte(0x0F); byte(0x90 | condition); modrm(3, 0, dst);
+        byte(0x0F); byte(0xB6); modrm(3, dst, dst);
+    }
+
+    void load_u8(Reg dst, i32 offset) { rex(false, dst, rbx); byte(0x0F); byte(0xB6); memory(dst, offset); }
+    void load_u16(Reg dst, i32 offset) { rex(false, dst, rbx); byte(0x0F); byte(0xB7); memory(dst, offset); }
+    // always with a rex prefix, so sil/dil/bpl are addressable
+    void store_u8(i32 offset, Reg src) { rex(false, src, rbx, true); byte(0x88); memory(src, offset); }
+    void store_u16(i32 offset, Reg src) { byte(0x66); rex(false, src, rbx); byte(0x89); memory(src, offset); }
+    void store_u16(i32 offset, u16 imm) { byte(0x66); byte(0xC7); memory(0, offset); byte(imm); byte(imm >> 8); }
+
+    void push(Reg reg) { rex(false, 0, reg); byte(0x50 + (reg & 7)); }
+    void pop(Reg reg) { rex(false, 0, reg); byte(0x58 + (reg & 7)); }
+    void mov64(Reg dst, Reg src) { rex(true, src, dst); byte(0x89); modrm(3, src, dst); }
+    void add64(Reg dst, u32 imm) { rex(true, 0, dst); byte(0x81); modrm(3, 0, dst); dword(imm); }
+    void cmp64(Reg lhs, Reg rhs) { rex(true, rhs, lhs); byte(0x39); modrm(3, rhs, lhs); }
+    // base can't be rsp or r12, those need a SIB byte
+    void lea64(Reg dst, Reg base, i32 offset) { rex(true, dst, base); byte(0x8D); modrm(2, dst, base); dword(offset); }
+    void ret() { byte(0xC3); }
+
+    // returns the position of the rel32 to patch once the target is known
+    size_t jump_if(Condition condition) { byte(0x0F); byte(0x80 | condition); dword(0); return position() - 4; }
+    void jump_if(Condition condition, size_t target) { patch(jump_if(condition), target); }
+    void patch(size_t at, size_t target) {
+        const i32 relative = static_cast<i32>(target) - static_cast<i32>(at + 4);
+        std::memcpy(code.data() + at, &relative, sizeof(relative));
+    }
+  private:
+    void byte(u8 value) { code.push_back(value); }
+    void dword(u32 value) { for (int i = 0; i < 4; i++) byte(value >> (8 * i)); }
+    void modrm(u8 mod, u8 reg, u8 rm) { byte(mod << 6 | (reg & 7) << 3 | (rm & 7)); }
+    void memory(u8 reg, i32 offset) { modrm(2, reg, rbx); dword(offset); }
+    void rex(bool wide, u8 reg, u8 rm, bool force = false) {
+        const u8 prefix = 0x40 | wide << 3 | (reg >> 3) << 2 | (rm >> 3);
+        if (prefix != 0x40 || force) byte(prefix);
+    }
+};
+
+// where the guest state lives inside a Chip8
+struct Offsets {
+    i32 registers;
+    i32 index_register;
+    i32 program_counter;
+    i32 timer_delay;
+    i32 sound_delay;
+};
+
+// host registers guest registers get assigned to, everything the compiled
+// code doesn't need for itself. rbx holds the Chip8*, r14 the budget and r15
+// the amount of instructions executed so far, rax and rcx are scratch.
+constexpr std::array<Reg, 10> register_pool = {rdx, rsi, rdi, r8, r9, r10, r11, rbp, r12, r13};
+constexpr std::array<Reg, 6> saved_registers = {rbx, rbp, r12, r13, r14, r15};
+
+constexpr u32 guest_i = 1 << 16;
+constexpr u32 not_compiled = ~0u;
+
+// guest registers an instruction uses, one bit per V register and bit 16 for
+// I. not_compiled for instructions the compiler leaves to the interpreter.
+u32 guest_registers(const Instruction& instruction) {
+    const CallBack handler = instruction.handler;
+    const u32 vx = 1 << instruction.fields.x;
+    const u32 vy = 1 << instruction.fields.y;
+    const u32 vf = 1 << 0xF;
+
+    if (handler == Chip8::jp_addr) return 0;
+    if (handler == Chip8::ld_vx_kk || handler == Chip8::add_vx_kk ||
+        handler == Chip8::skip_next_ife_vxkk || handler == Chip8::skip_next_ifne_vxkk ||
+        handler == Chip8::ld_dt_vx || handler == Chip8::ld_st_vx)
+        return vx;
+    if (handler == Chip8::ld_vx_vy || handler == Chip8::or_vx_vy ||
+        handler == Chip8::and_vx_vy || handler == Chip8::xor_vx_vy ||
+        handler == Chip8::skip_next_ife_vxvy || handler == Chip8::skip_next_ifne_vx_vy)
+        return vx | vy;
+    if (handler == Chip8::add_vx_vy || handler == Chip8::sub_vx_vy ||
+        handler == Chip8::shr_vx_vy || handler == Chip8::subn_vx_vy ||
+        handler == Chip8::shl_vx_vy || handler == Chip8::or_vx_vy_reset_vf ||
+        handler == Chip8::and_vx_vy_reset_vf || handler == Chip8::xor_vx_vy_reset_vf)
+        return vx | vy | vf;
+    if (handler == Chip8::shr_vx || handler == Chip8::shl_vx) return vx | vf;
+    if (handler == Chip8::ld_iaddr) return guest_i;
+    if (handler == Chip8::add_i_vx) return vx | vf | guest_i;
+    if (handler == Chip8::ld_f_vx) return vx | guest_i;
+    return not_compiled;
+}
+
+bool is_skip(CallBack handler) {
+    return handler == Chip8::skip_next_ife_vxkk || handler == Chip8::skip_next_ifne_vxkk ||
+           handler == Chip8::skip_next_ife_vxvy || handler == Chip8::skip_next_ifne_vx_vy;
+}
+
+struct GuestOp {
+    u16 address;
+    Instruction instruction;
+};
+
+class BlockCompiler {
+  public:
+    BlockCompiler(u16 start, const Offsets& offsets) : start(start), offsets(offsets) {}
+
+    // collects the instructions of the block, returns false when not even the
+    // first one can be compiled.
+    bool decode(const Chip8& c8);
+    std::vector<u8> emit();
+
+    u8 max_length() const { return ops.size(); }
+    size_t byte_length() const { return ops.back().address + 2 - start; }
+  private:
+    static constexpr size_t memory_size = PageIndex::memory_size;
+
+    Reg host(u8 guest) const { return host_registers[guest]; }
+    void emit_op(const Instruction& instruction);
+    void emit_exit(u16 target, u8 executed);
+
+    u16 start;
+    Offsets offsets;
+    std::vector<GuestOp> ops;
+    // whether the last op was followed by a jump that got folded into it
+    bool folded_jump = false;
+    bool ends_in_branch = false;
+    u32 used_registers = 0;
+    // indexed by guest register, 16 is I
+    std::array<Reg, 17> host_registers{};
+    size_t loop_start = 0;
+    Assembler assembler;
+};
+
+bool BlockCompiler::decode(const Chip8& c8) {
+    for (u16 pc = start; ops.size() < BlockCache::max_block_length; pc += 2) {
+        const Instruction& instruction = c8.fetch_instruction(c8.opcode_at(pc));
+        const u32 registers = guest_registers(instruction);
+        if (registers == not_compiled ||
+            std::popcount(used_registers | registers) > static_cast<int>(register_pool.size()))
+            break;
+
+        used_registers |= registers;
+        ops.push_back({pc, instruction});
+
+        if (instruction.handler == Chip8::jp_addr) {
+            ends_in_branch = true;
+            break;
+        }
+        if (is_skip(instruction.handler)) {
+            // "skip; jp" is how conditional jumps are spelled, compile the
+            // pair as one branch.
+            const u16 next = pc + 2;
+            if (next < memory_size) {
+                const Instruction& following = c8.fetch_instruction(c8.opcode_at(next));
+                if (following.handler == Chip8::jp_addr) {
+                    ops.push_back({next, following});
+                    folded_jump = true;
+                }
+            }
+            ends_in_branch = true;
+            break;
+        }
+        if (size_t(pc) + 2 >= memory_size) break;
+    }
+    return !ops.empty();
+}
+
+void BlockCompiler::emit_exit(u16 target, u8 executed) {
+    Assembler& a = assembler;
+    a.add64(r15, executed);
+    if (target == start) {
+        // loop straight back into the block while the budget allows it
+        a.lea64(rax, r15, max_length());
+        a.cmp64(rax, r14);
+        a.jump_if(below_equal, loop_start);
+    }
+
+    for (u8 guest = 0; guest < 16; guest++) {
+        if (used_registers & (1 << guest)) a.store_u8(offsets.registers + guest, host(guest));
+    }
+    if (used_registers & guest_i) a.store_u16(offsets.index_register, host(16));
+    a.store_u16(offsets.program_counter, target);
+
+    a.mov64(rax, r15);
+    for (auto reg = saved_registers.rbegin(); reg != saved_registers.rend(); reg++) a.pop(*reg);
+    a.ret();
+}
+
+void BlockCompiler::emit_op(const Instruction& instruction) {
+    Assembler& a = assembler;
+    const CallBack handler = instruction.handler;
+    const OpcodeFields& fields = instruction.fields;
+    const Reg vx = host(fields.x);
+    const Reg vy = host(fields.y);
+    const Reg vf = host(0xF);
+    const Reg i = host(16);
+
+    // each sequence mirrors the order of reads and writes in the matching
+    // handler in chip8.cc, which matters when x or y is F.
+    if (handler == Chip8::ld_vx_kk) {
+        a.mov_imm(vx, fields.kk);
+    } else if (handler == Chip8::add_vx_kk) {
+        a.alu(add, vx, fields.kk);
+        a.alu(and_, vx, 0xFF);
+    } else if (handler == Chip8::ld_vx_vy) {
+        a.alu(mov, vx, vy);
+    } else if (handler == Chip8::or_vx_vy) {
+        a.alu(or_, vx, vy);
+    } else if (handler == Chip8::and_vx_vy) {
+        a.alu(and_, vx, vy);
+    } else if (handler == Chip8::xor_vx_vy) {
+        a.alu(xor_, vx, vy);
+    } else if (handler == Chip8::or_vx_vy_reset_vf) {
+        a.alu(or_, vx, vy);
+        a.mov_imm(vf, 0);
+    } else if (handler == Chip8::and_vx_vy_reset_vf) {
+        a.alu(and_, vx, vy);
+        a.mov_imm(vf, 0);
+    } else if (handler == Chip8::xor_vx_vy_reset_vf) {
+        a.alu(xor_, vx, vy);
+        a.mov_imm(vf, 0);
+    } else if (handler == Chip8::add_vx_vy) {
+        a.alu(mov, rax, vx);
+        a.alu(add, rax, vy);
+        a.alu(mov, vx, rax);
+        a.alu(and_, vx, 0xFF);
+        a.shr(rax, 8);
+        a.alu(mov, vf, rax);
+    } else if (handler == Chip8::sub_vx_vy) {
+        a.alu(mov, rcx, vy);
+        a.alu(cmp, vx, rcx);
+        a.set(above, rax);
+        a.alu(mov, vf, rax);
+        a.alu(sub, vx, rcx);
+        a.alu(and_, vx, 0xFF);
+    } else if (handler == Chip8::shr_vx_vy) {
+        a.alu(mov, rcx, vy);
+        a.alu(mov, vx, rcx);
+        a.shr(vx, 1);
+        a.alu(mov, vf, rcx);
+        a.alu(and_, vf, 1);
+    } else if (handler == Chip8::subn_vx_vy) {
+        a.alu(mov, rax, vy);
+        a.alu(sub, rax, vx);
+        a.alu(and_, rax, 0xFF);
+        a.alu(mov, vx, rax);
+        a.alu(cmp, vy, vx);
+        a.set(above, rax);
+        a.alu(mov, vf, rax);
+    } else if (handler == Chip8::shl_vx_vy) {
+        a.alu(mov, rcx, vy);
+        a.alu(mov, vx, rcx);
+        a.shl(vx, 1);
+        a.alu(and_, vx, 0xFF);
+        a.alu(mov, vf, rcx);
+        a.shr(vf, 7);
+    } else if (handler == Chip8::shr_vx) {
+        a.alu(mov, rcx, vx);
+        a.shr(vx, 1);
+        a.alu(mov, vf, rcx);
+        a.alu(and_, vf, 1);
+    } else if (handler == Chip8::shl_vx) {
+        a.alu(mov, rcx, vx);
+        a.shl(vx, 1);
+        a.alu(and_, vx, 0xFF);
+        a.alu(mov, vf, rcx);
+        a.shr(vf, 7);
+    } else if (handler == Chip8::ld_iaddr) {
+        a.mov_imm(i, fields.nnn);
+    } else if (handler == Chip8::add_i_vx) {
+        a.alu(mov, rax, i);
+        a.alu(and_, rax, 0xFFF);
+        a.alu(add, rax, vx);
+        a.alu(mov, i, rax);
+        a.shr(rax, 12);
+        a.alu(mov, vf, rax);
+    } else if (handler == Chip8::ld_f_vx) {
+        a.imul(i, vx, 5);
+        a.alu(add, i, 0x50);
+    } else if (handler == Chip8::ld_dt_vx) {
+        a.store_u8(offsets.timer_delay, vx);
+    } else if (handler == Chip8::ld_st_vx) {
+        a.store_u8(offsets.sound_delay, vx);
+    }
+}
+
+std::vector<u8> BlockCompiler::emit() {
+    Assembler& a = assembler;
+
+    size_t next_host = 0;
+    for (u8 guest = 0; guest < host_registers.size(); guest++) {
+        if (used_registers & (1 << guest)) host_registers[guest] = register_pool[next_host++];
+    }
+
+    for (const Reg reg : saved_registers) a.push(reg);
+    a.mov64(rbx, rdi);
+    a.mov64(r14, rsi);
+    a.alu(xor_, r15, r15);
+    for (u8 guest = 0; guest < 16; guest++) {
+        if (used_registers & (1 << guest)) a.load_u8(host(guest), offsets.registers + guest);
+    }
+    if (used_registers & guest_i) a.load_u16(host(16), offsets.index_register);
+    loop_start = a.position();
+
+    const size_t body_length = ops.size() - (folded_jump ? 1 : 0);
+    for (size_t index = 0; index < body_length; index++) {
+        emit_op(ops[index].instruction);
+    }
+
+    const GuestOp& last = ops[body_length - 1];
+    const CallBack handler = last.instruction.handler;
+    const OpcodeFields& fields = last.instruction.fields;
+    if (!ends_in_branch) {
+        emit_exit(last.address + 2, body_length);
+    } else if (handler == Chip8::jp_addr) {
+        emit_exit(fields.nnn, body_length);
+    } else {
+        Condition skip_when = equal;
+        if (handler == Chip8::skip_next_ife_vxkk || handler == Chip8::skip_next_ifne_vxkk) {
+            a.alu(cmp, host(fields.x), fields.kk);
+        } else {
+            a.alu(cmp, host(fields.x), host(fields.y));
+        }
+        if (handler == Chip8::skip_next_ifne_vxkk || handler == Chip8::skip_next_ifne_vx_vy) {
+            skip_when = not_equal;
+        }
+
+        const size_t skip = a.jump_if(skip_when);
+        if (folded_jump) {
+            emit_exit(ops.back().instruction.fields.nnn, body_length + 1);
+        } else {
+            emit_exit(last.address + 2, body_length);
+        }
+        a.patch(skip, a.position());
+        emit_exit(last.address + 4, body_length);
+    }
+    return std::move(a.code);
+}
+
+}
+
+CodeArena::CodeArena(size_t size) : size(size) {
+#if CHIP8_JIT_SUPPORTED
+    void* memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        throw std::runtime_error("Couldn't map memory for compiled code\n");
+    base = static_cast<u8*>(memory);
+#endif
+}
+
+CodeArena::~CodeArena() {
+#if CHIP8_JIT_SUPPORTED
+    munmap(base, size);
+#endif
+}
+
+const u8* CodeArena::append(const std::vector<u8>& code) {
+#if CHIP8_JIT_SUPPORTED
+    if (protection_refused || used + code.size() > size) return nullptr;
+
+    // only the pages being written to are made writable, and only for as
+    // long as it takes to copy the code in.
+    const size_t page = sysconf(_SC_PAGESIZE);
+    u8* first_page = base + used / page * page;
+    const size_t length = base + used + code.size() - first_page;
+    if (mprotect(first_page, length, PROT_READ | PROT_WRITE) != 0) {
+        protection_refused = true;
+        return nullptr;
+    }
+    std::memcpy(base + used, code.data(), code.size());
+    if (mprotect(first_page, length, PROT_READ | PROT_EXEC) != 0) {
+        // at least don't leave it writable
+        mprotect(first_page, length, PROT_READ);
+        protection_refused = true;
+        return nullptr;
+    }
+
+    const u8* start = base + used;
+    // keep blocks 16 byte aligned
+    used = (used + code.size() + 15) & ~size_t(15);
+    return start;
+#else
+    return nullptr;
+#endif
+}
+
+Jit::Jit(size_t block_limit)
+    : arena(arena_size), blocks(std::make_unique<std::array<CompiledBlock, memory_size>>()), block_limit(block_limit) {}
+
+void Jit::compile(const Chip8& c8, u16 address, CompiledBlock& block) {
+    block = CompiledBlock{};
+    block.compiled = true;
+    block.page_mask = PageIndex::pages_of(address, 2);
+
+    // a host that refuses executable memory gets the interpreter
+    if (supported && !arena.refused() && blocks_compiled < block_limit) {
+        const u8* base = reinterpret_cast<const u8*>(&c8);
+        const Offsets offsets = {
+            static_cast<i32>(reinterpret_cast<const u8*>(c8.registers.data()) - base),
+            static_cast<i32>(reinterpret_cast<const u8*>(&c8.index_register) - base),
+            static_cast<i32>(reinterpret_cast<const u8*>(&c8.program_counter) - base),
+            static_cast<i32>(reinterpret_cast<const u8*>(&c8.timer_delay) - base),
+            static_cast<i32>(reinterpret_cast<const u8*>(&c8.sound_delay) - base),
+        };
+
+        BlockCompiler compiler(address, offsets);
+        if (compiler.decode(c8)) {
+            const std::vector<u8> code = compiler.emit();
+            const u8* entry = arena.append(code);
+            if (!entry && !arena.refused()) {
+                // out of space, start over with an empty arena
+                flush();
+                entry = arena.append(code);
+                block.compiled = true;
+                block.page_mask = PageIndex::pages_of(address, 2);
+            }
+            if (entry) {
+                block.code = reinterpret_cast<BlockFn>(const_cast<u8*>(entry));
+                block.max_length = compiler.max_length();
+                block.page_mask = PageIndex::pages_of(address, compiler.byte_length());
+                blocks_compiled++;
+            }
+        }
+    }
+    // compiled or not, the loop may reach past the block
+    block.busy_loop = BusyLoop::match(c8, address);
+    if (block.busy_loop) {
+        block.page_mask |= PageIndex::pages_of(address, block.busy_loop->length * 2);
+    }
+    page_index.insert(address, block.page_mask);
+}
+
+const CompiledBlock& Jit::lookup(const Chip8& c8, u16 address) {
+    CompiledBlock& block = (*blocks)[address];
+    if (!block.compiled) {
+        compile(c8, address, block);
+    }
+    return block;
+}
+
+void Jit::invalidate(u16 pages) {
+    page_index.invalidate(pages, [this](u16 address, u16 page_bit) {
+        CompiledBlock& block = (*blocks)[address];
+        if (block.page_mask & page_bit) {
+            block = CompiledBlock{};
+        }
+    });
+}
+
+void Jit::flush() {
+    blocks->fill(CompiledBlock{});
+    page_index = PageIndex{};
+    arena.clear();
+}
+
+u64 Jit::run(Chip8& c8, u64 budget) {
+    u64 executed = 0;
+    invalidate(c8.take_written_pages());
+
+    while (executed < budget && !c8.halted()) {
+        // compiled code isn't instrumented, a profiled machine is interpreted
+        if (c8.program_counter < memory_size && !profiling(c8)) {
+            const CompiledBlock& block = lookup(c8, c8.program_counter);
+            if (block.busy_loop) {
+                if (const u64 skipped = block.busy_loop->fast_forward(c8, c8.program_counter, budget - executed)) {
+                    executed += skipped;
+                    continue;
+                }
+            }
+            if (block.code && budget - executed >= block.max_length) {
+                executed += block.code(&c8, budget - executed);
+                continue;
+            }
+        }
+
+        // whatever the compiler doesn't handle goes through the interpreter
+        c8.run_cycle();
+        executed++;
+        if (c8.written_pages) {
+            invalidate(c8.take_written_pages());
+        }
+    }
+    return executed;
+}
@@ -0,0 +1,656 @@
+#include "include/lockstep.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <memory>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// a vector of u8 lanes and the matching pair of u16 vectors covering the
+// same lanes. masks are 0xFF/0xFFFF for set lanes, like the compare
+// instructions produce them.
+#if defined(__AVX2__)
+
+constexpr size_t vector_width = 32;
+
+struct Bytes { __m256i v; };
+struct Words { __m256i lo, hi; };
+
+inline Bytes load(const u8* p) { return {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))}; }
+inline void store(u8* p, Bytes a) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), a.v); }
+inline Bytes splat(u8 value) { return {_mm256_set1_epi8(static_cast<char>(value))}; }
+inline Bytes operator+(Bytes a, Bytes b) { return {_mm256_add_epi8(a.v, b.v)}; }
+inline Bytes operator-(Bytes a, Bytes b) { return {_mm256_sub_epi8(a.v, b.v)}; }
+inline Bytes operator&(Bytes a, Bytes b) { return {_mm256_and_si256(a.v, b.v)}; }
+inline Bytes operator|(Bytes a, Bytes b) { return {_mm256_or_si256(a.v, b.v)}; }
+inline Bytes operator^(Bytes a, Bytes b) { return {_mm256_xor_si256(a.v, b.v)}; }
+inline Bytes and_not(Bytes mask, Bytes a) { return {_mm256_andnot_si256(mask.v, a.v)}; }
+inline Bytes equal(Bytes a, Bytes b) { return {_mm256_cmpeq_epi8(a.v, b.v)}; }
+inline Bytes minimum(Bytes a, Bytes b) { return {_mm256_min_epu8(a.v, b.v)}; }
+inline Bytes shift_right(Bytes a, int count) { return {_mm256_and_si256(_mm256_srli_epi16(a.v, count), _mm256_set1_epi8(static_cast<char>(0xFF >> count)))}; }
+inline u32 bits(Bytes mask) { return static_cast<u32>(_mm256_movemask_epi8(mask.v)); }
+
+inline Words load(const u16* p) { return {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 16))}; }
+inline void store(u16* p, Words a) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), a.lo); _mm256_storeu_si256(reinterpret_cast<__m256i*>(p + 16), a.hi); }
+inline Words splat_words(u16 value) { return {_mm256_set1_epi16(static_cast<short>(value)), _mm256_set1_epi16(static_cast<short>(value))}; }
+inline Words operator+(Words a, Words b) { return {_mm256_add_epi16(a.lo, b.lo), _mm256_add_epi16(a.hi, b.hi)}; }
+inline Words operator&(Words a, Words b) { return {_mm256_and_si256(a.lo, b.lo), _mm256_and_si256(a.hi, b.hi)}; }
+inline Words operator|(Words a, Words b) { return {_mm256_or_si256(a.lo, b.lo), _mm256_or_si256(a.hi, b.hi)}; }
+inline Words and_not(Words mask, Words a) { return {_mm256_andnot_si256(mask.lo, a.lo), _mm256_andnot_si256(mask.hi, a.hi)}; }
+inline Words equal(Words a, Words b) { return {_mm256_cmpeq_epi16(a.lo, b.lo), _mm256_cmpeq_epi16(a.hi, b.hi)}; }
+inline Words widen(Bytes mask) {
+    return {_mm256_cvtepi8_epi16(_mm256_castsi256_si128(mask.v)), _mm256_cvtepi8_epi16(_mm256_extracti128_si256(mask.v, 1))};
+}
+inline Words extend(Bytes a) {
+    return {_mm256_cvtepu8_epi16(_mm256_castsi256_si128(a.v)), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(a.v, 1))};
+}
+inline Bytes narrow(Words mask) {
+    // packs works per 128 bit half, put the quarters back in lane order
+    return {_mm256_permute4x64_epi64(_mm256_packs_epi16(mask.lo, mask.hi), 0xD8)};
+}
+
+#elif defined(__SSE2__)
+
+constexpr size_t vector_width = 16;
+
+struct Bytes { __m128i v; };
+struct Words { __m128i lo, hi; };
+
+inline Bytes load(const u8* p) { return {_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))}; }
+inline void store(u8* p, Bytes a) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), a.v); }
+inline Bytes splat(u8 value) { return {_mm_set1_epi8(static_cast<char>(value))}; }
+inline Bytes operator+(Bytes a, Bytes b) { return {_mm_add_epi8(a.v, b.v)}; }
+inline Bytes operator-(Bytes a, Bytes b) { return {_mm_sub_epi8(a.v, b.v)}; }
+inline Bytes operator&(Bytes a, Bytes b) { return {_mm_and_si128(a.v, b.v)}; }
+inline Bytes operator|(Bytes a, Bytes b) { return {_mm_or_si128(a.v, b.v)}; }
+inline Bytes operator^(Bytes a, Bytes b) { return {_mm_xor_si128(a.v, b.v)}; }
+inline Bytes and_not(Bytes mask, Bytes a) { return {_mm_andnot_si128(mask.v, a.v)}; }
+inline Bytes equal(Bytes a, Bytes b) { return {_mm_cmpeq_epi8(a.v, b.v)}; }
+inline Bytes minimum(Bytes a, Bytes b) { return {_mm_min_epu8(a.v, b.v)}; }
+inline Bytes shift_right(Bytes a, int count) { return {_mm_and_si128(_mm_srli_epi16(a.v, count), _mm_set1_epi8(static_cast<char>(0xFF >> count)))}; }
+inline u32 bits(Bytes mask) { return static_cast<u32>(_mm_movemask_epi8(mask.v)); }
+
+inline Words load(const u16* p) { return {_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 8))}; }
+inline void store(u16* p, Words a) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), a.lo); _mm_storeu_si128(reinterpret_cast<__m128i*>(p + 8), a.hi); }
+inline Words splat_words(u16 value) { return {_mm_set1_epi16(static_cast<short>(value)), _mm_set1_epi16(static_cast<short>(value))}; }
+inline Words operator+(Words a, Words b) { return {_mm_add_epi16(a.lo, b.lo), _mm_add_epi16(a.hi, b.hi)}; }
+inline Words operator&(Words a, Words b) { return {_mm_and_si128(a.lo, b.lo), _mm_and_si128(a.hi, b.hi)}; }
+inline Words operator|(Words a, Words b) { return {_mm_or_si128(a.lo, b.lo), _mm_or_si128(a.hi, b.hi)}; }
+inline Words and_not(Words mask, Words a) { return {_mm_andnot_si128(mask.lo, a.lo), _mm_andnot_si128(mask.hi, a.hi)}; }
+inline Words equal(Words a, Words b) { return {_mm_cmpeq_epi16(a.lo, b.lo), _mm_cmpeq_epi16(a.hi, b.hi)}; }
+inline Words widen(Bytes mask) { return {_mm_unpacklo_epi8(mask.v, mask.v), _mm_unpackhi_epi8(mask.v, mask.v)}; }
+inline Words extend(Bytes a) { return {_mm_unpacklo_epi8(a.v, _mm_setzero_si128()), _mm_unpackhi_epi8(a.v, _mm_setzero_si128())}; }
+inline Bytes narrow(Words mask) { return {_mm_packs_epi16(mask.lo, mask.hi)}; }
+
+#else
+
+// plain loops for hosts without SSE2, the compiler can still vectorize these
+constexpr size_t vector_width = 16;
+
+struct Bytes { std::array<u8, vector_width> v; };
+struct Words { std::array<u16, vector_width> v; };
+
+template <typename T, typename F>
+inline T lanewise(const T& a, const T& b, F f) {
+    T result;
+    for (size_t i = 0; i < vector_width; i++) result.v[i] = f(a.v[i], b.v[i]);
+    return result;
+}
+
+inline Bytes load(const u8* p) { Bytes a; std::copy_n(p, vector_width, a.v.begin()); return a; }
+inline void store(u8* p, Bytes a) { std::copy(a.v.begin(), a.v.end(), p); }
+inline Bytes splat(u8 value) { Bytes a; a.v.fill(value); return a; }
+inline Bytes operator+(Bytes a, Bytes b) { return lanewise(a, b, [](u8 x, u8 y) -> u8 { return x + y; }); }
+inline Bytes operator-(Bytes a, Bytes b) { return lanewise(a, b, [](u8 x, u8 y) -> u8 { return x - y; }); }
+inline Bytes operator&(Bytes a, Bytes b) { return lanewise(a, b, [](u8 x, u8 y) -> u8 { return x & y; }); }
+inline Bytes operator|(Bytes a, Bytes b) { return lanewise(a, b, [](u8 x, u8 y) -> u8 { return x | y; }); }
+inline Bytes operator^(Bytes a, Bytes b) { return lanewise(a, b, [](u8 x, u8 y) -> u8 { return x ^ y; }); }
+inline Bytes and_not(Bytes mask, Bytes a) { return lanewise(mask, a, [](u8 m, u8 x) -> u8 { return ~m & x; }); }
+inline Bytes equal(Bytes a, Bytes b) { return lanewise(a, b, [](u8 x, u8 y) -> u8 { return x == y ? 0xFF : 0; }); }
+inline Bytes minimum(Bytes a, Bytes b) { return lanewise(a, b, [](u8 x, u8 y) -> u8 { return std::min(x, y); }); }
+inline Bytes shift_right(Bytes a, int count) { for (u8& x : a.v) x >>= count; return a; }
+inline u32 bits(Bytes mask) { u32 result = 0; for (size_t i = 0; i < vector_width; i++) result |= (mask.v[i] >> 7) << i; return result; }
+
+inline Words load(const u16* p) { Words a; std::copy_n(p, vector_width, a.v.begin()); return a; }
+inline void store(u16* p, Words a) { std::copy(a.v.begin(), a.v.end(), p); }
+inline Words splat_words(u16 value) { Words a; a.v.fill(value); return a; }
+inline Words operator+(Words a, Words b) { return lanewise(a, b, [](u16 x, u16 y) -> u16 { return x + y; }); }
+inline Words operator&(Words a, Words b) { return lanewise(a, b, [](u16 x, u16 y) -> u16 { return x & y; }); }
+inline Words operator|(Words a, Words b) { return lanewise(a, b, [](u16 x, u16 y) -> u16 { return x | y; }); }
+inline Words and_not(Words mask, Words a) { return lanewise(mask, a, [](u16 m, u16 x) -> u16 { return ~m & x; }); }
+inline Words equal(Words a, Words b) { return lanewise(a, b, [](u16 x, u16 y) -> u16 { return x == y ? 0xFFFF : 0; }); }
+inline Words widen(Bytes mask) { Words a; for (size_t i = 0; i < vector_width; i++) a.v[i] = mask.v[i] ? 0xFFFF : 0; return a; }
+inline Words extend(Bytes a) { Words b; std::copy(a.v.begin(), a.v.end(), b.v.begin()); return b; }
+inline Bytes narrow(Words mask) { Bytes a; for (size_t i = 0; i < vector_width; i++) a.v[i] = mask.v[i] ? 0xFF : 0; return a; }
+
+#endif
+
+inline Bytes operator~(Bytes a) { return a ^ splat(0xFF); }
+inline Bytes select(Bytes mask, Bytes when_set, Bytes otherwise) { return (mask & when_set) | and_not(mask, otherwise); }
+inline Words select(Words mask, Words when_set, Words otherwise) { return (mask & when_set) | and_not(mask, otherwise); }
+// unsigned a > b, as 0/1 instead of a mask
+inline Bytes greater(Bytes a, Bytes b) { return and_not(equal(minimum(a, b), a), splat(1)); }
+
+}
+
+Lockstep::Lockstep(size_t lanes)
+    : lane_count(lanes),
+      stride((lanes + vector_width - 1) / vector_width * vector_width),
+      memory(0x1000 * stride),
+      display(display_words * stride),
+      hires(stride),
+      selected_planes(stride),
+      flags(16 * stride),
+      audio_pattern(16 * stride),
+      pitch(stride),
+      stack(stack_depth * stride),
+      registers(16 * stride),
+      program_counter(stride),
+      index_register(stride),
+      stack_pointer(stride),
+      sound_delay(stride),
+      timer_delay(stride),
+      keys(16 * stride),
+      waiting_key(stride),
+      rnd(stride),
+      traps(stride),
+      halted_lanes(stride),
+      remaining(stride),
+      group(stride) {
+    load_program(std::span<const u8>{});
+}
+
+// both loaders build one machine the regular way and copy it into every
+// lane, that way loading can't drift from Chip8::load_program.
+void Lockstep::load_program(const std::string& rom_path) {
+    auto c8 = std::make_unique<Chip8>();
+    c8->set_quirks(quirk_profile);
+    c8->load_program(rom_path);
+    load_machine(*c8);
+}
+
+void Lockstep::load_program(std::span<const u8> program) {
+    auto c8 = std::make_unique<Chip8>();
+    c8->set_quirks(quirk_profile);
+    c8->load_program(program);
+    load_machine(*c8);
+}
+
+void Lockstep::load_machine(const Chip8& c8) {
+    for (size_t address = 0; address < memory.size() / stride; address++) {
+        std::fill_n(&memory[address * stride], stride, c8.memory[address]);
+    }
+    upper_memory.assign(c8.memory.begin() + 0x1000, c8.memory.end());
+    std::fill(display.begin(), display.end(), 0);
+    std::fill(hires.begin(), hires.end(), 0);
+    std::fill(selected_planes.begin(), selected_planes.end(), 1);
+    std::fill(flags.begin(), flags.end(), 0);
+    std::fill(audio_pattern.begin(), audio_pattern.end(), 0);
+    std::fill(pitch.begin(), pitch.end(), c8.pitch);
+    std::fill(stack.begin(), stack.end(), 0);
+    std::fill(registers.begin(), registers.end(), 0);
+    std::fill(program_counter.begin(), program_counter.end(), c8.program_counter);
+    std::fill(index_register.begin(), index_register.end(), c8.index_register);
+    std::fill(stack_pointer.begin(), stack_pointer.end(), 0);
+    std::fill(sound_delay.begin(), sound_delay.end(), 0);
+    std::fill(timer_delay.begin(), timer_delay.end(), 0);
+    std::fill(keys.begin(), keys.end(), 0);
+    std::fill(waiting_key.begin(), waiting_key.end(), 0);
+    std::fill(rnd.begin(), rnd.end(), c8.rnd);
+    std::fill(traps.begin(), traps.end(), std::nullopt);
+    std::fill(halted_lanes.begin(), halted_lanes.end(), 0);
+    std::fill(halted_lanes.begin() + lane_count, halted_lanes.end(), 0xFF);
+}
+
+void Lockstep::set_quirks(QuirkProfile profile) {
+    quirk_profile = profile;
+    instructions = &instruction_tables[static_cast<size_t>(profile)];
+    address_mask = quirks_of(profile).xo_chip ? 0xFFFF : 0xFFF;
+    if (quirks_of(profile).super_chip) {
+        for (size_t n = 0; n < Chip8::big_font.size(); n++) {
+            std::fill_n(&memory[(0xA0 + n) * stride], stride, Chip8::big_font[n]);
+        }
+    }
+
+    // memory is address-major, so growing appends the new addresses and
+    // shrinking drops them
+    const size_t old_size = memory.size() / stride;
+    memory.resize((size_t(address_mask) + 1) * stride);
+    for (size_t address = old_size; address < memory.size() / stride; address++) {
+        std::fill_n(&memory[address * stride], stride, upper_memory[address - 0x1000]);
+    }
+}
+
+void Lockstep::seed(size_t lane, u32 seed) {
+    rnd[lane].seed(seed);
+}
+
+void Lockstep::press_key(size_t lane, u8 key) {
+    keys[key * stride + lane] = 1;
+    if (waiting_key[lane] & 0x80) {
+        reg(lane, waiting_key[lane] & 0x7F) = key;
+        waiting_key[lane] = 0;
+        halted_lanes[lane] = traps[lane] ? 0xFF : 0;
+    }
+}
+
+void Lockstep::release_key(size_t lane, u8 key) {
+    keys[key * stride + lane] = 0;
+}
+
+void Lockstep::tick_timers() {
+    for (size_t lane = 0; lane < lane_count; lane++) {
+        if (timer_delay[lane] > 0) timer_delay[lane]--;
+        if (sound_delay[lane] > 0) sound_delay[lane]--;
+    }
+}
+
+void Lockstep::export_lane(size_t lane, Chip8& c8) const {
+    // first, it may load fonts that the lane's memory then overwrites
+    c8.set_quirks(quirk_profile);
+    c8.memory.fill(0);
+    for (size_t address = 0; address < memory.size() / stride; address++) {
+        c8.memory[address] = memory[address * stride + lane];
+    }
+    for (size_t word = 0; word < display_words; word++) {
+        c8.display.planes[word / (Chip8::hires_height * 2)][word / 2 % Chip8::hires_height][word % 2] =
+            display[word * stride + lane];
+    }
+    c8.display.hires = hires[lane];
+    c8.selected_planes = selected_planes[lane];
+    for (size_t n = 0; n < 16; n++) {
+        c8.flags[n] = flags[n * stride + lane];
+        c8.audio_pattern[n] = audio_pattern[n * stride + lane];
+    }
+    c8.pitch = pitch[lane];
+    for (size_t depth = 0; depth < stack_depth; depth++) {
+        c8.stack[depth] = stack[depth * stride + lane];
+    }
+    for (size_t x = 0; x < 16; x++) {
+        c8.registers[x] = registers[x * stride + lane];
+        c8.keyboard.keys[x] = keys[x * stride + lane];
+    }
+    c8.program_counter = program_counter[lane];
+    c8.index_register = index_register[lane];
+    c8.stack_pointer = stack_pointer[lane];
+    c8.sound_delay = sound_delay[lane];
+    c8.timer_delay = timer_delay[lane];
+    c8.keyboard.waiting = waiting_key[lane] & 0x80;
+    c8.keyboard.wait_register = waiting_key[lane] & 0x7F;
+    c8.rnd = rnd[lane];
+    c8.trap = traps[lane];
+    c8.written_pages = 0xFFFF;
+    c8.dirty_rows = ~u64{0};
+}
+
+u64 Lockstep::run(u64 budget) {
+    u64 executed = 0;
+    while (budget) {
+        // budgets are counted down 16 bits wide, in the same vectors as the
+        // program counters.
+        const u16 slice = std::min<u64>(budget, 0xFFFF);
+        std::fill_n(remaining.begin(), lane_count, slice);
+        budget -= slice;
+
+        while (const auto leader = find_leader()) {
+            executed += step(*leader);
+        }
+    }
+    return executed;
+}
+
+std::optional<size_t> Lockstep::find_leader() const {
+    for (size_t offset = 0; offset < stride; offset += vector_width) {
+        const Bytes has_budget = ~narrow(equal(load(&remaining[offset]), splat_words(0)));
+        const u32 active = bits(and_not(load(&halted_lanes[offset]), has_budget));
+        if (active) return offset + std::countr_zero(active);
+    }
+    return std::nullopt;
+}
+
+u64 Lockstep::step(size_t leader) {
+    const u16 pc = program_counter[leader];
+    const u8 high = mem(leader, pc);
+    const u8 low = mem(leader, pc + 1);
+    const u16 opcode = high << 8 | low;
+    const u8* high_row = &memory[(pc & address_mask) * stride];
+    const u8* low_row = &memory[((pc + 1) & address_mask) * stride];
+
+    // every lane at the same address with the same opcode there (memory may
+    // differ between lanes) joins in. they all move past the instruction
+    // before it executes, like Chip8::execute_instruction.
+    u64 lanes_in_group = 0;
+    for (size_t offset = 0; offset < stride; offset += vector_width) {
+        const Words pcs = load(&program_counter[offset]);
+        const Words budgets = load(&remaining[offset]);
+        const Words same_pc = and_not(equal(budgets, splat_words(0)), equal(pcs, splat_words(pc)));
+        const Bytes mask = and_not(load(&halted_lanes[offset]), narrow(same_pc)) &
+                           equal(load(high_row + offset), splat(high)) &
+                           equal(load(low_row + offset), splat(low));
+        store(&group[offset], mask);
+
+        const Words wide_mask = widen(mask);
+        store(&program_counter[offset], pcs + (wide_mask & splat_words(2)));
+        // adding the all ones mask subtracts one
+        store(&remaining[offset], budgets + wide_mask);
+        lanes_in_group += std::popcount(bits(mask));
+    }
+
+    const Instruction& instruction = (*instructions)[opcode];
+    const u8 family = opcode >> 12;
+    // XO-CHIP's 5xy2/5xy3 go through memory
+    const bool vectorized =
+        (family >= 0x1 && family <= 0x9 && family != 0x2 && (family != 0x5 || (opcode & 0xF) == 0)) || family == 0xA ||
+        (family == 0xF && (low == 0x07 || low == 0x15 || low == 0x18 || low == 0x29));
+
+    if (instruction.handler != Chip8::invalid_opcode && vectorized) {
+        execute_vector(pc, opcode, instruction.handler);
+    } else {
+        for (size_t offset = 0; offset < stride; offset += vector_width) {
+            for (u32 lanes = bits(load(&group[offset])); lanes; lanes &= lanes - 1) {
+                execute_scalar(offset + std::countr_zero(lanes), instruction);
+            }
+        }
+    }
+    return lanes_in_group;
+}
+
+void Lockstep::execute_vector(u16 address, u16 opcode, CallBack handler) {
+    const OpcodeFields fields(opcode);
+    const u8 family = opcode >> 12;
+    // XO-CHIP's skips step over all four bytes of an F000 nnnn, which lanes
+    // may or may not have next
+    const bool long_skips = quirks_of(quirk_profile).xo_chip;
+    const u8* next_high_row = &memory[((address + 2) & address_mask) * stride];
+    const u8* next_low_row = &memory[((address + 3) & address_mask) * stride];
+    u8* vx_row = &registers[fields.x * stride];
+    u8* vy_row = &registers[fields.y * stride];
+    u8* vf_row = &registers[0xF * stride];
+
+    for (size_t offset = 0; offset < stride; offset += vector_width) {
+        const Bytes mask = load(&group[offset]);
+        if (!bits(mask)) continue;
+
+        u8* vx_p = vx_row + offset;
+        u8* vy_p = vy_row + offset;
+        u8* vf_p = vf_row + offset;
+        const Bytes vx = load(vx_p);
+        const Bytes vy = load(vy_p);
+        // lanes whose skip condition holds, see the end of the loop
+        Bytes skip = splat(0);
+
+        // the order of loads and stores follows the handlers in chip8.cc,
+        // which matters when x or y is F.
+        switch (family) {
+            case 0x1: {
+                u16* pc = &program_counter[offset];
+                store(pc, select(widen(mask), splat_words(fields.nnn), load(pc)));
+                break;
+            }
+            case 0x3: skip = equal(vx, splat(fields.kk)); break;
+            case 0x4: skip = ~equal(vx, splat(fields.kk)); break;
+            case 0x5: skip = equal(vx, vy); break;
+            case 0x9: skip = ~equal(vx, vy); break;
+            case 0x6: store(vx_p, select(mask, splat(fields.kk), vx)); break;
+            case 0x7: store(vx_p, select(mask, vx + splat(fields.kk), vx)); break;
+            case 0x8:
+                switch (opcode & 0xF) {
+                    case 0x0: store(vx_p, select(mask, vy, vx)); break;
+                    case 0x1: store(vx_p, select(mask, vx | vy, vx)); break;
+                    case 0x2: store(vx_p, select(mask, vx & vy, vx)); break;
+                    case 0x3: store(vx_p, select(mask, vx ^ vy, vx)); break;
+                    case 0x4: {
+                        const Bytes sum = vx + vy;
+                        store(vx_p, select(mask, sum, vx));
+                        store(vf_p, select(mask, greater(vx, sum), load(vf_p)));
+                        break;
+                    }
+                    case 0x5: {
+                        store(vf_p, select(mask, greater(vx, vy), load(vf_p)));
+                        const Bytes current = load(vx_p);
+                        store(vx_p, select(mask, current - vy, current));
+                        break;
+                    }
+                    case 0x6: {
+                        // the shifts take Vy or Vx depending on the profile
+                        const Bytes source = handler == Chip8::shr_vx ? vx : vy;
+                        store(vx_p, select(mask, shift_right(source, 1), vx));
+                        store(vf_p, select(mask, source & splat(1), load(vf_p)));
+                        break;
+                    }
+                    case 0x7: {
+                        store(vx_p, select(mask, vy - vx, vx));
+                        store(vf_p, select(mask, greater(load(vy_p), load(vx_p)), load(vf_p)));
+                        break;
+                    }
+                    case 0xE: {
+                        const Bytes source = handler == Chip8::shl_vx ? vx : vy;
+                        store(vx_p, select(mask, source + source, vx));
+                        store(vf_p, select(mask, shift_right(source, 7), load(vf_p)));
+                        break;
+                    }
+                }
+                if (handler == Chip8::or_vx_vy_reset_vf || handler == Chip8::and_vx_vy_reset_vf ||
+                    handler == Chip8::xor_vx_vy_reset_vf) {
+                    store(vf_p, select(mask, splat(0), load(vf_p)));
+                }
+                break;
+            case 0xA: {
+                u16* i = &index_register[offset];
+                store(i, select(widen(mask), splat_words(fields.nnn), load(i)));
+                break;
+            }
+            case 0xF: {
+                u8* delay = &timer_delay[offset];
+                switch (fields.kk) {
+                    case 0x07: store(vx_p, select(mask, load(delay), vx)); break;
+                    case 0x15: store(delay, select(mask, vx, load(delay))); break;
+                    case 0x18: store(&sound_delay[offset], select(mask, vx, load(&sound_delay[offset]))); break;
+                    case 0x29: {
+                        u16* i = &index_register[offset];
+                        const Words digit = extend(vx);
+                        const Words sprite = splat_words(0x50) + digit + digit + digit + digit + digit;
+                        store(i, select(widen(mask), sprite, load(i)));
+                        break;
+                    }
+                }
+                break;
+            }
+        }
+
+        if (family == 0x3 || family == 0x4 || family == 0x5 || family == 0x9) {
+            u16* pc = &program_counter[offset];
+            Words distance = widen(skip & mask) & splat_words(2);
+            if (long_skips) {
+                const Bytes next_is_long = equal(load(next_high_row + offset), splat(0xF0)) &
+                                           equal(load(next_low_row + offset), splat(0x00));
+                distance = distance + (widen(skip & mask & next_is_long) & splat_words(2));
+            }
+            store(pc, load(pc) + distance);
+        }
+    }
+}
+
+void Lockstep::raise_trap(size_t lane, TrapKind kind) {
+    program_counter[lane] -= 2;
+    const u16 pc = program_counter[lane];
+    traps[lane] = Trap{kind, pc, static_cast<u16>(mem(lane, pc) << 8 | mem(lane, pc + 1))};
+    halted_lanes[lane] = 0xFF;
+}
+
+void Lockstep::skip_long(size_t lane) {
+    u16& pc = program_counter[lane];
+    pc += mem(lane, pc) == 0xF0 && mem(lane, pc + 1) == 0x00 ? 4 : 2;
+}
+
+// Chip8::draw for one lane
+void Lockstep::draw(size_t lane, const Instruction& instruction) {
+    const CallBack handler = instruction.handler;
+    const OpcodeFields& fields = instruction.fields;
+    const bool wide = hires[lane];
+    const u8 width = wide ? Chip8::hires_width : Chip8::display_width;
+    const u8 height = wide ? Chip8::hires_height : Chip8::display_height;
+    const u8 x = reg(lane, fields.x) % width;
+    const u8 y = reg(lane, fields.y) % height;
+    reg(lane, 0xF) = 0;
+
+    const bool wrap = handler == Chip8::draw_vx_vy_nibble_wrap || handler == Chip8::draw_vx_vy_large_wrap;
+    const bool large = handler == Chip8::draw_vx_vy_large || handler == Chip8::draw_vx_vy_large_wrap;
+    const u8 sprite_height = large ? 16 : fields.kk & 0xF;
+    const u8 row_bytes = large ? 2 : 1;
+    const u8 rows = wrap ? sprite_height : std::min<u8>(sprite_height, height - y);
+    bool collision = false;
+    u16 sprite_data = index_register[lane];
+    for (size_t plane = 0; plane < Framebuffer::plane_count; plane++) {
+        if (!(selected_planes[lane] & (1 << plane))) continue;
+
+        for (u8 n = 0; n < rows; n++) {
+            const u16 address = sprite_data + n * row_bytes;
+            const u16 sprite = large ? mem(lane, address) << 8 | mem(lane, address + 1) : mem(lane, address) << 8;
+            const u8 row = (y + n) % height;
+            u64& left = pixels(lane, plane, row, 0);
+            if (wide) {
+                u64& right = pixels(lane, plane, row, 1);
+                collision |= wrap ? draw_sprite_row<true>(left, right, sprite, x)
+                                  : draw_sprite_row<false>(left, right, sprite, x);
+            } else {
+                collision |= wrap ? draw_sprite_row<true>(left, sprite, x) : draw_sprite_row<false>(left, sprite, x);
+            }
+        }
+        sprite_data += sprite_height * row_bytes;
+    }
+    reg(lane, 0xF) = collision;
+}
+
+// Chip8's scrolls for one lane, the rows aren't next to each other here
+void Lockstep::scroll(size_t lane, CallBack handler, u8 n) {
+    const size_t height = hires[lane] ? Chip8::hires_height : Chip8::display_height;
+    for (size_t plane = 0; plane < Framebuffer::plane_count; plane++) {
+        if (!(selected_planes[lane] & (1 << plane))) continue;
+
+        for (size_t step = 0; step < height; step++) {
+            // down walks up from the bottom so rows move before they're overwritten
+            const size_t row = handler == Chip8::scroll_down_n ? height - 1 - step : step;
+            u64& left = pixels(lane, plane, row, 0);
+            u64& right = pixels(lane, plane, row, 1);
+            if (handler == Chip8::scroll_down_n || handler == Chip8::scroll_up_n) {
+                const size_t from = handler == Chip8::scroll_down_n ? row - n : row + n;
+                const bool inside = handler == Chip8::scroll_down_n ? row >= n : from < height;
+                left = inside ? pixels(lane, plane, from, 0) : 0;
+                right = inside ? pixels(lane, plane, from, 1) : 0;
+            } else if (!hires[lane]) {
+                left = handler == Chip8::scroll_right ? left >> 4 : left << 4;
+            } else if (handler == Chip8::scroll_right) {
+                shift_row_right(left, right, 4);
+            } else {
+                shift_row_left(left, right, 4);
+            }
+        }
+    }
+}
+
+void Lockstep::execute_scalar(size_t lane, const Instruction& instruction) {
+    // lane by lane versions of the handlers in chip8.cc that don't map onto
+    // vectors: anything that indexes memory, the stack, keys or the display
+    // through a register.
+    const CallBack handler = instruction.handler;
+    const OpcodeFields& fields = instruction.fields;
+    u8& vx = reg(lane, fields.x);
+    u8& vf = reg(lane, 0xF);
+    u16& pc = program_counter[lane];
+    u16& i = index_register[lane];
+    u8& sp = stack_pointer[lane];
+
+    if (handler == Chip8::ret) {
+        if (sp == 0) return raise_trap(lane, TrapKind::stack_underflow);
+        pc = stack[--sp * stride + lane];
+    } else if (handler == Chip8::call_addr) {
+        if (sp == stack_depth) return raise_trap(lane, TrapKind::stack_overflow);
+        stack[sp++ * stride + lane] = pc;
+        pc = fields.nnn;
+    } else if (handler == Chip8::jp_offset) {
+        pc = fields.nnn + reg(lane, 0);
+    } else if (handler == Chip8::jp_offset_vx) {
+        pc = fields.nnn + vx;
+    } else if (handler == Chip8::rnd_vx_kk) {
+        vx = std::uniform_int_distribution<>(0, 255)(rnd[lane]) & fields.kk;
+    } else if (handler == Chip8::cls || handler == Chip8::low_res || handler == Chip8::high_res) {
+        // switching modes clears both planes, cls the selected ones
+        const u8 planes = handler == Chip8::cls ? selected_planes[lane] : 0x3;
+        for (size_t word = 0; word < display_words; word++) {
+            if (planes & (1 << (word / (Chip8::hires_height * 2)))) display[word * stride + lane] = 0;
+        }
+        if (handler != Chip8::cls) hires[lane] = handler == Chip8::high_res;
+    } else if (handler == Chip8::draw_vx_vy_nibble || handler == Chip8::draw_vx_vy_nibble_wrap ||
+               handler == Chip8::draw_vx_vy_large || handler == Chip8::draw_vx_vy_large_wrap) {
+        draw(lane, instruction);
+    } else if (handler == Chip8::scroll_down_n || handler == Chip8::scroll_up_n ||
+               handler == Chip8::scroll_right || handler == Chip8::scroll_left) {
+        scroll(lane, handler, fields.kk & 0xF);
+    } else if (handler == Chip8::skp_vx) {
+        if (keys[(vx & 0xF) * stride + lane]) pc += 2;
+    } else if (handler == Chip8::sknp_vx) {
+        if (!keys[(vx & 0xF) * stride + lane]) pc += 2;
+    } else if (handler == Chip8::skp_vx_long) {
+        if (keys[(vx & 0xF) * stride + lane]) skip_long(lane);
+    } else if (handler == Chip8::sknp_vx_long) {
+        if (!keys[(vx & 0xF) * stride + lane]) skip_long(lane);
+    } else if (handler == Chip8::ld_vx_key) {
+        waiting_key[lane] = 0x80 | fields.x;
+        halted_lanes[lane] = 0xFF;
+    } else if (handler == Chip8::add_i_vx) {
+        const auto res = (i & 0xFFF) + vx;
+        vf = res >> 12;
+        i = res;
+    } else if (handler == Chip8::ld_b_vx) {
+        const u8 value = vx;
+        mem(lane, i) = value / 100;
+        mem(lane, i + 1) = (value / 10) % 10;
+        mem(lane, i + 2) = value % 10;
+    } else if (handler == Chip8::ld_i_vx) {
+        for (u8 x = 0; x <= fields.x; x++) mem(lane, i++) = reg(lane, x);
+    } else if (handler == Chip8::ld_vx_i) {
+        for (u8 x = 0; x <= fields.x; x++) reg(lane, x) = mem(lane, i++);
+    } else if (handler == Chip8::ld_i_vx_keep_i) {
+        for (u8 x = 0; x <= fields.x; x++) mem(lane, i + x) = reg(lane, x);
+    } else if (handler == Chip8::ld_vx_i_keep_i) {
+        for (u8 x = 0; x <= fields.x; x++) reg(lane, x) = mem(lane, i + x);
+    } else if (handler == Chip8::add_i_vx_wide) {
+        i += vx;
+    } else if (handler == Chip8::exit) {
+        raise_trap(lane, TrapKind::exit);
+    } else if (handler == Chip8::ld_hf_vx) {
+        i = 0xA0 + 10 * (vx & 0xF);
+    } else if (handler == Chip8::ld_r_vx) {
+        for (u8 x = 0; x <= fields.x; x++) flags[x * stride + lane] = reg(lane, x);
+    } else if (handler == Chip8::ld_vx_r) {
+        for (u8 x = 0; x <= fields.x; x++) reg(lane, x) = flags[x * stride + lane];
+    } else if (handler == Chip8::ld_i_vx_vy || handler == Chip8::ld_vx_vy_i) {
+        const int step = fields.x <= fields.y ? 1 : -1;
+        const int count = std::abs(fields.y - fields.x);
+        for (int n = 0; n <= count; n++) {
+            u8& v = reg(lane, fields.x + n * step);
+            if (handler == Chip8::ld_i_vx_vy) {
+                mem(lane, i + n) = v;
+            } else {
+                v = mem(lane, i + n);
+            }
+        }
+    } else if (handler == Chip8::ld_i_long) {
+        i = mem(lane, pc) << 8 | mem(lane, pc + 1);
+        pc += 2;
+    } else if (handler == Chip8::plane_n) {
+        selected_planes[lane] = fields.x & 0x3;
+    } else if (handler == Chip8::ld_audio_i) {
+        for (size_t n = 0; n < 16; n++) audio_pattern[n * stride + lane] = mem(lane, i + n);
+    } else if (handler == Chip8::ld_pitch_vx) {
+        pitch[lane] = vx;
+    } else {
+        raise_trap(lane, TrapKind::invalid_opcode);
+    }
+}
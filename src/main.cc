@@ -1,33 +1,192 @@
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 
 #include "include/nums.h"
 #include "include/chip8.h"
 #include "include/display.h"
-#include "include/keyboard.h"
 #include "include/emulator.h"
+#include "include/engine.h"
+#include "include/inputlog.h"
+#include "include/jit.h"
+#include "include/options.h"
+#include "include/profiler.h"
+#include "include/rom.h"
+#include "include/scheduler.h"
+#include "include/speaker.h"
+#include "include/tracer.h"
+
+void print_usage() {
+    std::cout << "Example usage: \n";
+    std::cout << "./chip8 [--engine=interpreter|block|jit|aot] [--jit-block-limit=n] [--seed=n] [--record=path]\n";
+    std::cout << "        [--quirks=legacy|cosmac|schip|xochip] [--ips=n] [--turbo] [--profile=prefix]\n";
+    std::cout << "        [--rom-cache=dir] [--trace=path] <file_path_here>\n";
+    std::cout << "./chip8 my_dir/my_chip8_rom.ch8\n";
+}
 
 int main(int argc, char** argv) {
-    if (argc < 2 || argc > 2) {
-        std::cout << "Too few arguments passed.\n";
-        std::cout << "Example usage: \n";
-        std::cout << "./chip8 <file_path_here>\n";
-        std::cout << "./chip8 my_dir/my_chip8_rom.ch8\n";
+    EngineKind engine_kind = EngineKind::interpreter;
+    std::optional<size_t> jit_block_limit;
+    std::optional<u32> seed;
+    std::optional<QuirkProfile> quirks;
+    std::optional<u32> cycles_per_frame;
+    bool turbo = false;
+    std::string record_path;
+    std::string profile_prefix;
+    std::string trace_path;
+    std::string rom_cache_path;
+    std::string rom_path;
 
-        return 0;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg.starts_with("--engine=")) {
+            auto kind = parse_engine_kind(arg.substr(std::string_view("--engine=").size()));
+            if (!kind) {
+                std::cout << "Unknown engine: " << arg << '\n';
+                print_usage();
+                return 1;
+            }
+            engine_kind = *kind;
+        } else if (arg.starts_with("--jit-block-limit=")) {
+            // only compile the first n blocks, for bisecting the JIT against the interpreter
+            if (!parse_option(arg.substr(std::string_view("--jit-block-limit=").size()), jit_block_limit))
+                return bad_option(arg, print_usage);
+        } else if (arg.starts_with("--seed=")) {
+            if (!parse_option(arg.substr(std::string_view("--seed=").size()), seed))
+                return bad_option(arg, print_usage);
+        } else if (arg.starts_with("--quirks=")) {
+            // which CHIP-8 variant the ROM was written for, see quirks.h
+            auto profile = parse_quirk_profile(arg.substr(std::string_view("--quirks=").size()));
+            if (!profile) {
+                std::cout << "Unknown quirk profile: " << arg << '\n';
+                print_usage();
+                return 1;
+            }
+            quirks = *profile;
+        } else if (arg.starts_with("--ips=")) {
+            // instructions per second, rounded to whole instructions per frame
+            u32 ips = 0;
+            if (!parse_option(arg.substr(std::string_view("--ips=").size()), ips)) return bad_option(arg, print_usage);
+            cycles_per_frame = cycles_for_speed(ips);
+        } else if (arg == "--turbo") {
+            turbo = true;
+        } else if (arg.starts_with("--record=")) {
+            // writes every key change to an input log chip8_headless can replay
+            record_path = arg.substr(std::string_view("--record=").size());
+        } else if (arg.starts_with("--rom-cache=")) {
+            // remembers the detected profile, ips and keys per ROM, see rom.h
+            rom_cache_path = arg.substr(std::string_view("--rom-cache=").size());
+        } else if (arg.starts_with("--profile=")) {
+            // needs a CHIP8_PROFILE build, see profiler.h
+            profile_prefix = arg.substr(std::string_view("--profile=").size());
+        } else if (arg.starts_with("--trace=")) {
+            // records every instruction for chip8_tracedump, see tracer.h
+            trace_path = arg.substr(std::string_view("--trace=").size());
+        } else if (rom_path.empty()) {
+            rom_path = arg;
+        } else {
+            std::cout << "Too many arguments passed.\n";
+            print_usage();
+            return 0;
+        }
     }
 
-    Keyboard keyboard;
-    Chip8 chip8(keyboard);
+    if (rom_path.empty()) {
+        std::cout << "Too few arguments passed.\n";
+        print_usage();
+        return 0;
+    }
 
-    chip8.load_program(std::string(argv[1]));
-    
-    Display display;
-    if (!display.initialize()) {
-        std::cerr << "Display couldn't be initialized\n";
+#ifndef CHIP8_PROFILE
+    if (!profile_prefix.empty()) {
+        std::cout << "--profile needs a build with CHIP8_PROFILE\n";
         return 1;
     }
+#endif
+
+    // bad ROMs and unwritable paths are reported rather than thrown
+    try {
+        // what the command line leaves open comes from the cache
+        const Rom rom(rom_path);
+        RomInfo info;
+        if (!rom_cache_path.empty()) {
+            info = RomCache(rom_cache_path).lookup(rom.bytes());
+        }
+        if (!cycles_per_frame && info.ips) {
+            cycles_per_frame = cycles_for_speed(info.ips);
+        }
 
-    Emulator emulator(chip8, keyboard);
-    emulator.run(display);
+        Chip8 chip8;
+
+        chip8.set_quirks(quirks.value_or(info.quirks));
+        chip8.load_program(rom.bytes());
+        if (seed) {
+            chip8.seed(*seed);
+        }
+#ifdef CHIP8_PROFILE
+        std::unique_ptr<Profiler> profiler;
+        if (!profile_prefix.empty()) {
+            profiler = std::make_unique<Profiler>(profile_prefix);
+            Profiler::dump_on_signal();
+            chip8.profiler = profiler.get();
+        }
+#endif
+
+        Display display;
+        if (!display.initialize()) {
+            std::cerr << "Display couldn't be initialized\n";
+            return 1;
+        }
+
+        // traced machines always run through the interpreter
+        std::unique_ptr<Tracer> tracer;
+        std::unique_ptr<Engine> engine;
+        if (!trace_path.empty()) {
+            tracer = std::make_unique<Tracer>(trace_path, chip8.quirks());
+            engine = std::make_unique<TracingInterpreter>(*tracer);
+        } else if (engine_kind == EngineKind::jit && jit_block_limit) {
+            engine = std::make_unique<Jit>(*jit_block_limit);
+        } else {
+            engine = make_engine(engine_kind);
+        }
+        Emulator emulator(chip8, *engine, display, rom_path + ".state");
+        if (cycles_per_frame) {
+            emulator.cycles_per_frame = *cycles_per_frame;
+        }
+        if (!info.keys.empty()) {
+            emulator.set_key_layout(info.keys);
+        }
+        emulator.turbo = turbo;
+
+        // runs silently without a sound device
+        Speaker speaker;
+        if (speaker.initialize()) {
+            emulator.play_to(speaker);
+        }
+
+        InputLog log;
+        if (!record_path.empty()) {
+            log.seed = seed.value_or(std::mt19937::default_seed);
+            log.rom_hash = rom.hash();
+            emulator.record_to(log);
+        }
+        emulator.run();
+        if (!record_path.empty()) {
+            log.save(record_path);
+        }
+#ifdef CHIP8_PROFILE
+        if (profiler) {
+            profiler->write(chip8);
+        }
+#endif
+
+        return chip8.crashed() ? 1 : 0;
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what();
+        return 1;
+    }
 }
 
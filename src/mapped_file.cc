@@ -0,0 +1,49 @@
+#include "include/mapped_file.h"
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string& path, const std::string& what) {
+#ifdef __unix__
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error(what + " couldn't be found\n");
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        throw std::runtime_error(what + " couldn't be read\n");
+    }
+    // mmap refuses zero bytes, there's nothing to map anyway
+    if (info.st_size == 0) {
+        close(fd);
+        return;
+    }
+    void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        throw std::runtime_error(what + " couldn't be mapped\n");
+    data = static_cast<const u8*>(mapping);
+    size = info.st_size;
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file.good())
+        throw std::runtime_error(what + " couldn't be found\n");
+    buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    data = buffer.data();
+    size = buffer.size();
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifdef __unix__
+    if (data) munmap(const_cast<u8*>(data), size);
+#endif
+}
@@ -0,0 +1,195 @@
+#include "include/profiler.h"
+
+#ifdef CHIP8_PROFILE
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <csignal>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include "include/disassembler.h"
+
+namespace {
+
+std::atomic<bool> dump_requested = false;
+
+void request_dump(int) {
+    dump_requested = true;
+}
+
+std::string hex(const u16 value, const int width) {
+    std::ostringstream out;
+    out << std::hex << std::uppercase << std::setw(width) << std::setfill('0') << value;
+    return out.str();
+}
+
+std::ofstream open_output(const std::string& path) {
+    std::ofstream file(path);
+    if (!file) {
+        throw std::runtime_error("Couldn't write profile " + path + "\n");
+    }
+    return file;
+}
+
+}
+
+Profiler::Profiler(std::string prefix) : prefix(std::move(prefix)) {
+    contexts.push_back({0x200, 0, 0, 0, 0, 0});
+}
+
+void Profiler::enter(const u16 target) {
+    if (untracked_depth) {
+        untracked_depth++;
+        return;
+    }
+
+    // children are a plain linked list, subroutines rarely call more than a
+    // handful of others
+    u32 child = contexts[context].first_child;
+    while (child && contexts[child].target != target) {
+        child = contexts[child].next_sibling;
+    }
+    if (!child) {
+        if (contexts.size() == max_contexts) {
+            untracked_depth = 1;
+            return;
+        }
+        child = contexts.size();
+        contexts.push_back({target, context, 0, contexts[context].first_child, 0, 0});
+        contexts[context].first_child = child;
+    }
+    contexts[child].calls++;
+    context = child;
+}
+
+void Profiler::leave() {
+    if (untracked_depth) {
+        untracked_depth--;
+        return;
+    }
+    // a ret without a matching call, e.g. after loading a state
+    if (context == 0) return;
+    context = contexts[context].parent;
+}
+
+void Profiler::end_frame(const Chip8& c8) {
+    draw_histogram[std::min<size_t>(frame_draws, draw_histogram.size() - 1)]++;
+    frame_draws = 0;
+    frames++;
+
+    if (dump_requested.exchange(false)) {
+        write(c8);
+    }
+}
+
+void Profiler::dump_on_signal() {
+    std::signal(SIGUSR1, request_dump);
+}
+
+void Profiler::write(const Chip8& c8) const {
+    write_folded(prefix + ".folded");
+    write_heatmap(prefix + ".heatmap", c8);
+    write_summary(prefix + ".summary", c8);
+}
+
+std::string Profiler::context_name(u32 index) const {
+    if (index == 0) return "main";
+    return "sub_" + hex(contexts[index].target, 3);
+}
+
+// one line per calling context, "main;sub_2A0;sub_31C <instructions>", as
+// flamegraph.pl and speedscope read it
+void Profiler::write_folded(const std::string& path) const {
+    std::ofstream file = open_output(path);
+    for (u32 index = 0; index < contexts.size(); index++) {
+        if (contexts[index].instructions == 0) continue;
+
+        std::string stack = context_name(index);
+        for (u32 parent = index; parent != 0;) {
+            parent = contexts[parent].parent;
+            stack = context_name(parent) + ';' + stack;
+        }
+        file << stack << ' ' << contexts[index].instructions << '\n';
+    }
+}
+
+// a 64x64 map of memory, one character per two bytes, shaded by the log of
+// how often the instruction there ran. followed by the exact counts.
+void Profiler::write_heatmap(const std::string& path, const Chip8& c8) const {
+    constexpr std::string_view shades = " .:-=+*#%@";
+
+    u64 total = 0;
+    u64 hottest = 0;
+    for (u64 count : addresses) {
+        total += count;
+        hottest = std::max(hottest, count);
+    }
+    const int hottest_log = std::bit_width(hottest);
+
+    std::ofstream file = open_output(path);
+    for (u16 row = 0; row < addresses.size(); row += 64) {
+        file << hex(row, 3) << " |";
+        for (u16 address = row; address < row + 64; address += 2) {
+            const u64 count = addresses[address] + addresses[address + 1];
+            const size_t shade = count ? 1 + (shades.size() - 2) * std::bit_width(count) / hottest_log : 0;
+            file << shades[std::min(shade, shades.size() - 1)];
+        }
+        file << "|\n";
+    }
+
+    file << "\naddress opcode count percent handler\n";
+    for (u16 address = 0; address < addresses.size(); address++) {
+        if (addresses[address] == 0) continue;
+        const u16 opcode = c8.opcode_at(address);
+        file << hex(address, 3) << ' ' << hex(opcode, 4) << ' ' << addresses[address] << ' '
+             << std::fixed << std::setprecision(2) << 100.0 * addresses[address] / total << "% "
+             << handler_name(c8.fetch_instruction(opcode).handler) << '\n';
+    }
+}
+
+void Profiler::write_summary(const std::string& path, const Chip8& c8) const {
+    std::map<std::string, u64> handlers;
+    u64 total = 0;
+    for (size_t opcode = 0; opcode < opcodes.size(); opcode++) {
+        if (opcodes[opcode] == 0) continue;
+        handlers[handler_name(c8.fetch_instruction(opcode).handler)] += opcodes[opcode];
+        total += opcodes[opcode];
+    }
+
+    std::vector<std::pair<std::string, u64>> by_count(handlers.begin(), handlers.end());
+    std::sort(by_count.begin(), by_count.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+
+    std::ofstream file = open_output(path);
+    file << "instructions: " << total << '\n';
+    file << "frames: " << frames << '\n';
+
+    file << "\nhandler count percent\n";
+    for (const auto& [name, count] : by_count) {
+        file << name << ' ' << count << ' ' << std::fixed << std::setprecision(2)
+             << 100.0 * count / total << "%\n";
+    }
+
+    // the tree keeps callers apart by their own context, merge them back
+    // into plain caller -> callee edges
+    std::map<std::pair<std::string, std::string>, u64> edges;
+    for (u32 index = 1; index < contexts.size(); index++) {
+        edges[{context_name(contexts[index].parent), context_name(index)}] += contexts[index].calls;
+    }
+    file << "\ncaller callee calls\n";
+    for (const auto& [edge, calls] : edges) {
+        file << edge.first << ' ' << edge.second << ' ' << calls << '\n';
+    }
+
+    file << "\ndraws frames\n";
+    for (size_t draws = 0; draws < draw_histogram.size(); draws++) {
+        if (draw_histogram[draws] == 0) continue;
+        file << draws << (draws == draw_histogram.size() - 1 ? "+ " : " ") << draw_histogram[draws] << '\n';
+    }
+}
+
+#endif
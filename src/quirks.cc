@@ -0,0 +1,19 @@
+#include "include/quirks.h"
+
+std::optional<QuirkProfile> parse_quirk_profile(std::string_view name) {
+    if (name == "legacy") return QuirkProfile::legacy;
+    if (name == "cosmac") return QuirkProfile::cosmac;
+    if (name == "schip") return QuirkProfile::schip;
+    if (name == "xochip") return QuirkProfile::xochip;
+    return std::nullopt;
+}
+
+const char* quirk_profile_name(QuirkProfile profile) {
+    switch (profile) {
+        case QuirkProfile::legacy: return "legacy";
+        case QuirkProfile::cosmac: return "cosmac";
+        case QuirkProfile::schip: return "schip";
+        case QuirkProfile::xochip: return "xochip";
+    }
+    return "unknown";
+}
@@ -0,0 +1,180 @@
+#include "include/rom.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include "include/disassembler.h"
+
+Rom::Rom(const std::string& path) : file(path, "ROM") {
+    if (bytes().empty())
+        throw std::runtime_error("ROM is empty\n");
+    if (bytes().size() > Chip8::max_program_size(QuirkProfile::xochip))
+        throw std::runtime_error("ROM is too big, " + std::to_string(bytes().size()) + " bytes\n");
+}
+
+namespace {
+
+// bumped whenever analyze_rom finds something else than it used to, cached
+// entries of older versions are analyzed again
+constexpr u32 analysis_version = 2;
+
+// ordered, a program is as extended as its most extended instruction
+enum class Extension { none, super_chip, xo_chip };
+
+Extension extension_of(const u16 opcode) {
+    if ((opcode & 0xFFF0) == 0x00D0 || (opcode & 0xF00E) == 0x5002 || opcode == 0xF000 ||
+        (opcode & 0xF0FF) == 0xF001 || opcode == 0xF002 || (opcode & 0xF0FF) == 0xF03A) {
+        return Extension::xo_chip;
+    }
+    if ((opcode & 0xFFF0) == 0x00C0 || (opcode >= 0x00FB && opcode <= 0x00FF) || (opcode & 0xF00F) == 0xD000 ||
+        (opcode & 0xF0FF) == 0xF030 || (opcode & 0xF0FF) == 0xF075 || (opcode & 0xF0FF) == 0xF085) {
+        return Extension::super_chip;
+    }
+    return Extension::none;
+}
+
+void write_rom_info(std::ostream& out, const RomInfo& info) {
+    out << "# chip8 rom info, ips and keys can be edited\n";
+    out << "version=" << analysis_version << '\n';
+    out << "hash=" << std::hex << std::setw(16) << std::setfill('0') << info.hash << std::dec << '\n';
+    out << "size=" << info.size << '\n';
+    out << "quirks=" << quirk_profile_name(info.quirks) << '\n';
+    out << "ips=" << info.ips << '\n';
+    out << "keys=" << info.keys << '\n';
+    out << "indirect_jumps=" << info.indirect_jumps << '\n';
+    out << "code=" << std::hex;
+    const char* separator = "";
+    for (const auto& [first, last] : info.code) {
+        out << separator << first << '-' << last;
+        separator = " ";
+    }
+    out << std::dec << '\n';
+}
+
+// false when the file is broken or from another analysis version, info then
+// has whatever could be read
+bool read_rom_info(std::istream& in, RomInfo& info) {
+    u32 version = 0;
+    std::string line;
+    try {
+        while (std::getline(in, line)) {
+            line = line.substr(0, line.find('#'));
+            const size_t separator = line.find('=');
+            if (separator == std::string::npos) continue;
+            const std::string key = line.substr(0, separator);
+            const std::string value = line.substr(separator + 1);
+
+            if (key == "version") {
+                version = std::stoul(value);
+            } else if (key == "hash") {
+                info.hash = std::stoull(value, nullptr, 16);
+            } else if (key == "size") {
+                info.size = std::stoull(value);
+            } else if (key == "quirks") {
+                const auto profile = parse_quirk_profile(value);
+                if (!profile) return false;
+                info.quirks = *profile;
+            } else if (key == "ips") {
+                info.ips = std::stoul(value);
+            } else if (key == "keys") {
+                if (!value.empty() && value.size() != default_key_layout.size()) return false;
+                info.keys = value;
+            } else if (key == "indirect_jumps") {
+                info.indirect_jumps = value == "1";
+            } else if (key == "code") {
+                std::istringstream ranges(value);
+                for (std::string range; ranges >> range;) {
+                    const size_t dash = range.find('-');
+                    if (dash == std::string::npos) return false;
+                    info.code.emplace_back(std::stoul(range.substr(0, dash), nullptr, 16),
+                                           std::stoul(range.substr(dash + 1), nullptr, 16));
+                }
+            }
+        }
+    } catch (const std::logic_error&) {
+        // stoul's invalid_argument and out_of_range
+        return false;
+    }
+    return version == analysis_version;
+}
+
+}
+
+RomInfo analyze_rom(std::span<const u8> program) {
+    RomInfo info;
+    info.hash = fnv1a(program.data(), program.size());
+    info.size = program.size();
+
+    // decoded as XO-CHIP, that has every instruction of the others
+    const ControlFlowGraph graph = recover_control_flow(program, QuirkProfile::xochip);
+    info.indirect_jumps = graph.indirect_jumps;
+
+    Extension extension = Extension::none;
+    for (const auto& [start, block] : graph.blocks) {
+        for (u32 address = start; address < start + 2u * block.length; address += 2) {
+            const u32 offset = address - Chip8::program_start;
+            extension = std::max(extension, extension_of(program[offset] << 8 | program[offset + 1]));
+        }
+        // blocks come sorted by start, touching or overlapping ones merge
+        const u32 end = std::min<u32>(block.end, Chip8::program_start + program.size());
+        if (!info.code.empty() && info.code.back().second >= start) {
+            info.code.back().second = std::max(info.code.back().second, end);
+        } else {
+            info.code.emplace_back(start, end);
+        }
+    }
+
+    // nothing tells the plain CHIP-8 quirks apart without running the program
+    switch (extension) {
+        case Extension::none: info.quirks = QuirkProfile::legacy; break;
+        case Extension::super_chip: info.quirks = QuirkProfile::schip; break;
+        case Extension::xo_chip: info.quirks = QuirkProfile::xochip; break;
+    }
+    return info;
+}
+
+RomCache::RomCache(const std::string& directory) : directory(directory) {
+    std::error_code error;
+    std::filesystem::create_directories(this->directory, error);
+    if (!std::filesystem::is_directory(this->directory))
+        throw std::runtime_error("ROM cache directory couldn't be created\n");
+}
+
+std::filesystem::path RomCache::path_of(const u64 hash) const {
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << hash << ".rominfo";
+    return directory / name.str();
+}
+
+RomInfo RomCache::lookup(std::span<const u8> program) {
+    const u64 hash = fnv1a(program.data(), program.size());
+    const std::filesystem::path path = path_of(hash);
+
+    RomInfo cached;
+    bool current = false;
+    if (std::ifstream in(path); in.good()) {
+        current = read_rom_info(in, cached);
+    }
+    // a matching size on top of the hash guards against collisions
+    const bool same_rom = cached.hash == hash && cached.size == program.size();
+    if (current && same_rom) return cached;
+
+    RomInfo info = analyze_rom(program);
+    if (same_rom) {
+        info.ips = cached.ips;
+        info.keys = cached.keys;
+    }
+    // written next to it and renamed, so other processes sharing the cache
+    // never read half a file. failing to write only costs the next run
+    // another analysis.
+    const std::filesystem::path temporary = path.string() + ".tmp";
+    {
+        std::ofstream out(temporary);
+        write_rom_info(out, info);
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    return info;
+}
@@ -0,0 +1,18 @@
+#include "include/runner.h"
+
+bool Runner::run_frame() {
+    return run_frame(cycles_per_frame);
+}
+
+bool Runner::run_frame(u64 budget) {
+    instructions += engine.run(c8, budget);
+    frames++;
+
+    if (output) output->present(c8, c8.take_dirty_rows());
+    // the frame that set the sound timer to n is the first of n beeping ones
+    if (audio) audio->play_frame(c8.sound_on());
+    c8.tick_timers();
+
+    if (input && !input->poll(c8, {frames, instructions})) return false;
+    return !c8.trap;
+}
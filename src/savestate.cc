@@ -0,0 +1,334 @@
+#include "include/savestate.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+constexpr std::array<u8, 4> magic = {'C', '8', 'S', 'S'};
+
+class Writer {
+  public:
+    explicit Writer(std::span<u8> out) : out(out) {}
+
+    void byte(const u8 value) { out[at++] = value; }
+    void word(const u16 value) { byte(value & 0xFF); byte(value >> 8); }
+    void quad(const u64 value) {
+        for (size_t shift = 0; shift < 64; shift += 8) byte(value >> shift);
+    }
+    void bytes(std::span<const u8> values) {
+        std::copy(values.begin(), values.end(), out.begin() + at);
+        at += values.size();
+    }
+  private:
+    std::span<u8> out;
+    size_t at = 0;
+};
+
+class Reader {
+  public:
+    explicit Reader(std::span<const u8> in) : in(in) {}
+
+    u8 byte() { return in[at++]; }
+    u16 word() { const u8 low = byte(); return low | byte() << 8; }
+    u64 quad() {
+        u64 value = 0;
+        for (size_t shift = 0; shift < 64; shift += 8) value |= static_cast<u64>(byte()) << shift;
+        return value;
+    }
+    void bytes(std::span<u8> values) {
+        std::copy_n(in.begin() + at, values.size(), values.begin());
+        at += values.size();
+    }
+  private:
+    std::span<const u8> in;
+    size_t at = 0;
+};
+
+}
+
+// has access to the machine's internals, the free functions below go through it
+struct StateCodec {
+    static void save(const Chip8& c8, SaveState& out) {
+        out.fill(0);
+        Writer writer(out);
+        writer.bytes(magic);
+        writer.word(save_state_version);
+        writer.word(static_cast<u16>(c8.quirks()));
+
+        writer.bytes(c8.memory);
+        for (const BitPlane& plane : c8.display.planes) {
+            for (const DisplayRow& row : plane) {
+                for (const u64 word : row) writer.quad(word);
+            }
+        }
+        writer.byte(c8.display.hires);
+        writer.byte(c8.selected_planes);
+        writer.byte(c8.pitch);
+        writer.bytes(c8.flags);
+        writer.bytes(c8.audio_pattern);
+        for (const u16 address : c8.stack) writer.word(address);
+        writer.bytes(c8.registers);
+        for (const bool key : c8.keyboard.keys) writer.byte(key);
+
+        writer.word(c8.program_counter);
+        writer.word(c8.index_register);
+        writer.byte(c8.stack_pointer);
+        writer.byte(c8.sound_delay);
+        writer.byte(c8.timer_delay);
+        writer.byte(c8.keyboard.waiting ? 0x80 | c8.keyboard.wait_register : 0);
+
+        writer.byte(c8.trap.has_value());
+        writer.byte(c8.trap ? static_cast<u8>(c8.trap->kind) : 0);
+        writer.word(c8.trap ? c8.trap->address : 0);
+        writer.word(c8.trap ? c8.trap->opcode : 0);
+
+        // the standard only promises that the engine round trips through
+        // its text form
+        std::ostringstream rng;
+        rng << c8.rnd;
+        const std::string text = rng.str();
+        if (text.size() > save_state_rng_size)
+            throw std::runtime_error("random number generator state doesn't fit a save state\n");
+        writer.word(text.size());
+        writer.bytes({reinterpret_cast<const u8*>(text.data()), text.size()});
+    }
+
+    static void load(Chip8& c8, std::span<const u8> in) {
+        if (in.size() != save_state_size && in.size() != save_state_v2_size)
+            throw std::runtime_error("save state has the wrong size\n");
+        Reader reader(in);
+        std::array<u8, 4> header;
+        reader.bytes(header);
+        if (header != magic)
+            throw std::runtime_error("not a save state\n");
+        const u16 version = reader.word();
+        if (version < 1 || version > save_state_version)
+            throw std::runtime_error("save state is from an unsupported version\n");
+        if (in.size() != (version < 3 ? save_state_v2_size : save_state_size))
+            throw std::runtime_error("save state has the wrong size\n");
+        // the word was reserved before version 3, those states are legacy
+        const u16 stored = reader.word();
+        const u16 profile = version < 3 ? static_cast<u16>(QuirkProfile::legacy) : stored;
+        if (profile != static_cast<u16>(c8.quirks()))
+            throw std::runtime_error("save state is from another quirk profile\n");
+
+        // decode into a copy so a bad state leaves the machine alone
+        auto loaded = std::make_unique<Chip8>(c8);
+        loaded->display = {};
+        if (version < 3) {
+            // 4K of memory and the low resolution display in plane 0
+            loaded->memory.fill(0);
+            reader.bytes({loaded->memory.data(), 4096});
+            for (size_t row = 0; row < Chip8::display_height; row++) {
+                loaded->display.planes[0][row][0] = reader.quad();
+            }
+            loaded->selected_planes = 1;
+            loaded->pitch = 64;
+            loaded->flags.fill(0);
+            loaded->audio_pattern.fill(0);
+        } else {
+            reader.bytes(loaded->memory);
+            for (BitPlane& plane : loaded->display.planes) {
+                for (DisplayRow& row : plane) {
+                    for (u64& word : row) word = reader.quad();
+                }
+            }
+            loaded->display.hires = reader.byte();
+            loaded->selected_planes = reader.byte() & 0x3;
+            loaded->pitch = reader.byte();
+            reader.bytes(loaded->flags);
+            reader.bytes(loaded->audio_pattern);
+        }
+        for (u16& address : loaded->stack) address = reader.word();
+        reader.bytes(loaded->registers);
+        for (bool& key : loaded->keyboard.keys) key = reader.byte();
+
+        loaded->program_counter = reader.word();
+        loaded->index_register = reader.word();
+        loaded->stack_pointer = reader.byte();
+        loaded->sound_delay = reader.byte();
+        loaded->timer_delay = reader.byte();
+        const u8 waiting_key = reader.byte();
+        loaded->keyboard.waiting = waiting_key & 0x80;
+        loaded->keyboard.wait_register = waiting_key & 0xF;
+        if (loaded->keyboard.waiting && version == 1) {
+            loaded->program_counter += 2;
+        }
+        if (loaded->stack_pointer > Chip8::stack_depth)
+            throw std::runtime_error("save state has a bad stack pointer\n");
+
+        const bool trapped = reader.byte();
+        const u8 kind = reader.byte();
+        const u16 address = reader.word();
+        const u16 opcode = reader.word();
+        if (kind > static_cast<u8>(TrapKind::exit))
+            throw std::runtime_error("save state has a bad trap\n");
+        loaded->trap = trapped ? std::optional<Trap>(Trap{static_cast<TrapKind>(kind), address, opcode}) : std::nullopt;
+
+        const u16 length = reader.word();
+        if (length > save_state_rng_size)
+            throw std::runtime_error("save state has a bad random number generator state\n");
+        std::string text(length, '\0');
+        reader.bytes({reinterpret_cast<u8*>(text.data()), text.size()});
+        std::istringstream rng(text);
+        rng >> loaded->rnd;
+        if (!rng)
+            throw std::runtime_error("save state has a bad random number generator state\n");
+
+        // everything cached about the old memory and display is stale
+        loaded->written_pages = 0xFFFF;
+        loaded->dirty_rows = ~u64{0};
+        c8 = *loaded;
+    }
+};
+
+void save_state(const Chip8& c8, SaveState& out) {
+    StateCodec::save(c8, out);
+}
+
+void load_state(Chip8& c8, std::span<const u8> in) {
+    StateCodec::load(c8, in);
+}
+
+void save_state_file(const Chip8& c8, const std::string& path) {
+    auto state = std::make_unique<SaveState>();
+    save_state(c8, *state);
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(state->data()), state->size());
+    if (!file.good())
+        throw std::runtime_error("save state couldn't be written\n");
+}
+
+void load_state_file(Chip8& c8, const std::string& path) {
+    const MappedState state(path);
+    load_state(c8, state.bytes());
+}
+
+MappedState::MappedState(const std::string& path) : file(path, "save state") {
+    if (file.bytes().empty())
+        throw std::runtime_error("save state couldn't be read\n");
+}
+
+namespace {
+
+// deltas are a list of [u16 equal bytes][u16 literal count][literals], the
+// literals being the xor of the two snapshots.
+void encode_delta(const SaveState& a, const SaveState& b, std::vector<u8>& out) {
+    out.clear();
+    const auto put = [&](const u16 value) { out.push_back(value & 0xFF); out.push_back(value >> 8); };
+
+    for (size_t at = 0; at < save_state_size;) {
+        size_t equal = 0;
+        while (at + equal < save_state_size && equal < 0xFFFF && a[at + equal] == b[at + equal]) equal++;
+        at += equal;
+
+        size_t end = at;
+        while (end < save_state_size && end - at < 0xFFFF) {
+            if (a[end] != b[end]) {
+                end++;
+                continue;
+            }
+            // a short equal stretch is cheaper inside the literal than as a
+            // token of its own
+            size_t same = 0;
+            while (end + same < save_state_size && same < 4 && a[end + same] == b[end + same]) same++;
+            if (same == 4 || end + same == save_state_size) break;
+            end = std::min(end + same, at + 0xFFFF);
+        }
+
+        put(equal);
+        put(end - at);
+        for (; at < end; at++) out.push_back(a[at] ^ b[at]);
+    }
+}
+
+void apply_delta(std::span<const u8> delta, SaveState& state) {
+    size_t at = 0;
+    for (size_t i = 0; i + 4 <= delta.size();) {
+        at += delta[i] | delta[i + 1] << 8;
+        const size_t literals = delta[i + 2] | delta[i + 3] << 8;
+        i += 4;
+        for (size_t n = 0; n < literals; n++) state[at++] ^= delta[i++];
+    }
+}
+
+}
+
+Rewind::Rewind(size_t capacity) : ring(capacity) {}
+
+void Rewind::record(const Chip8& c8) {
+    save_state(c8, scratch);
+    if (has_newest) {
+        encode_delta(newest, scratch, encoded);
+        push_record(encoded);
+    }
+    newest = scratch;
+    has_newest = true;
+}
+
+bool Rewind::step_back(Chip8& c8) {
+    if (deltas == 0) return false;
+
+    const size_t end = (head + used) % ring.size();
+    const u32 length = read_length((end + ring.size() - 4) % ring.size());
+    encoded.resize(length);
+    read_bytes((end + ring.size() - 4 - length) % ring.size(), encoded);
+    used -= length + 8;
+    deltas--;
+
+    apply_delta(encoded, newest);
+    load_state(c8, newest);
+    return true;
+}
+
+void Rewind::push_record(std::span<const u8> record) {
+    const size_t total = record.size() + 8;
+    if (total > ring.size()) {
+        // doesn't fit at all, the history before this frame is lost
+        head = used = deltas = 0;
+        return;
+    }
+    while (used + total > ring.size()) drop_oldest();
+
+    const size_t start = (head + used) % ring.size();
+    const u32 length = record.size();
+    const std::array<u8, 4> length_bytes = {
+        static_cast<u8>(length), static_cast<u8>(length >> 8), static_cast<u8>(length >> 16), static_cast<u8>(length >> 24)};
+    write_bytes(start, length_bytes);
+    write_bytes((start + 4) % ring.size(), record);
+    write_bytes((start + 4 + record.size()) % ring.size(), length_bytes);
+    used += total;
+    deltas++;
+}
+
+void Rewind::drop_oldest() {
+    const u32 length = read_length(head);
+    head = (head + length + 8) % ring.size();
+    used -= length + 8;
+    deltas--;
+}
+
+u32 Rewind::read_length(size_t at) const {
+    std::array<u8, 4> bytes;
+    read_bytes(at, bytes);
+    return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | static_cast<u32>(bytes[3]) << 24;
+}
+
+void Rewind::write_bytes(size_t at, std::span<const u8> bytes) {
+    // at most two pieces, before and after the end of the ring
+    const size_t first = std::min(bytes.size(), ring.size() - at);
+    std::copy_n(bytes.begin(), first, ring.begin() + at);
+    std::copy(bytes.begin() + first, bytes.end(), ring.begin());
+}
+
+void Rewind::read_bytes(size_t at, std::span<u8> bytes) const {
+    const size_t first = std::min(bytes.size(), ring.size() - at);
+    std::copy_n(ring.begin() + at, first, bytes.begin());
+    std::copy_n(ring.begin(), bytes.size() - first, bytes.begin() + first);
+}
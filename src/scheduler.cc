@@ -0,0 +1,51 @@
+#include "include/scheduler.h"
+#include <thread>
+
+void Scheduler::run(u64 frame_limit) {
+    clock::time_point start = clock::now();
+    // frames since start, the next one is due at start + scheduled
+    u64 scheduled = 0;
+
+    while (!frame_limit || runner.frames < frame_limit) {
+        if (input && runner.idle() && input->wait_for_input()) {
+            // the frame that polls the input runs right away, and so does the
+            // one reacting to it, pretend it's a frame late
+            start = clock::now() - std::chrono::duration_cast<clock::duration>(frames(1));
+            scheduled = 0;
+        }
+
+        if (mode == Mode::turbo) {
+            presenting = (runner.frames + 1) % present_every == 0;
+            if (!runner.run_frame()) break;
+            // leaving turbo continues from wherever the clock is then
+            start = clock::now();
+            scheduled = 0;
+            continue;
+        }
+
+        const auto deadline = start + frames(scheduled);
+        const clock::time_point now = clock::now();
+        if (now < deadline) {
+            std::this_thread::sleep_until(deadline);
+        } else if (now - deadline > frames(max_late_frames)) {
+            dropped_frames += std::chrono::duration_cast<frames>(now - deadline).count();
+            start = now;
+            scheduled = 0;
+        }
+        scheduled++;
+
+        // when the next frame is due already this one won't be on screen
+        // long enough to matter, show the one that catches up instead
+        presenting = clock::now() < start + frames(scheduled);
+        if (!presenting) late_frames++;
+        if (!runner.run_frame()) break;
+    }
+}
+
+void Scheduler::present(const Chip8& c8, u64 dirty_rows) {
+    pending_rows |= dirty_rows;
+    if (!presenting || !output) return;
+
+    output->present(c8, pending_rows);
+    pending_rows = 0;
+}
@@ -0,0 +1,41 @@
+#include "include/speaker.h"
+#include <algorithm>
+#include <iostream>
+#include <span>
+
+bool Speaker::initialize() {
+    SDL_AudioSpec wanted{};
+    wanted.freq = Beeper::sample_rate;
+    wanted.format = AUDIO_S16SYS;
+    wanted.channels = 1;
+    wanted.samples = 512;
+    wanted.callback = fill;
+    wanted.userdata = this;
+
+    // no allowed changes, SDL converts if the device wants something else
+    device = SDL_OpenAudioDevice(nullptr, 0, &wanted, nullptr, 0);
+    if (!device) {
+        std::cerr << "Could not open audio device " << SDL_GetError() << '\n';
+        return false;
+    }
+    return true;
+}
+
+void Speaker::play_frame(bool sound_on) {
+    beeper.generate(sound_on, samples);
+    ring.push(std::span<const i16>(samples));
+
+    if (++frames_played == prefill_frames) {
+        SDL_PauseAudioDevice(device, 0);
+    }
+}
+
+// runs on SDL's audio thread
+void Speaker::fill(void* userdata, Uint8* stream, int length) {
+    Speaker& speaker = *static_cast<Speaker*>(userdata);
+    const std::span<i16> out(reinterpret_cast<i16*>(stream), length / sizeof(i16));
+
+    // whatever isn't there yet is silence, the machine stopped or stalled
+    const size_t count = speaker.ring.pop(out);
+    std::fill(out.begin() + count, out.end(), 0);
+}
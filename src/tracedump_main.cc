@@ -0,0 +1,228 @@
+#include <charconv>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "include/disassembler.h"
+#include "include/options.h"
+#include "include/tracer.h"
+
+// decodes, filters and compares the traces chip8 --trace and chip8_headless
+// --trace write, see tracer.h.
+
+void print_usage() {
+    std::cout << "Example usage: \n";
+    std::cout << "./chip8_tracedump [--pc=first[-last]] [--opcode=pattern] [--from=n] [--count=n] <trace>\n";
+    std::cout << "./chip8_tracedump --diff <trace> <other_trace>\n";
+    std::cout << "prints one line per instruction: its number, pc, opcode and what it changed\n";
+    std::cout << "--pc only prints instructions at addresses in [first, last], in hex\n";
+    std::cout << "--opcode only prints opcodes matching pattern, hex digits match themselves and\n";
+    std::cout << "         anything else matches any digit, e.g. Fx33 or 8xy4\n";
+    std::cout << "--from skips instructions numbered below n, --count stops after printing n\n";
+    std::cout << "--diff prints the first instruction the traces disagree on, exits with 1 if there is one\n";
+}
+
+namespace {
+
+std::string hex(const unsigned value, const int width) {
+    std::ostringstream out;
+    out << "0x" << std::hex << std::uppercase << std::setw(width) << std::setfill('0') << value;
+    return out.str();
+}
+
+std::optional<u32> parse_hex(std::string_view text) {
+    if (text.starts_with("0x") || text.starts_with("0X")) text.remove_prefix(2);
+    u32 value = 0;
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value, 16);
+    if (text.empty() || error != std::errc() || end != text.data() + text.size()) return std::nullopt;
+    return value;
+}
+
+// an opcode pattern as a mask of the digits that have to match and their
+// values
+struct OpcodePattern {
+    u16 mask = 0;
+    u16 value = 0;
+
+    bool matches(const u16 opcode) const { return (opcode & mask) == value; }
+};
+
+std::optional<OpcodePattern> parse_opcode_pattern(const std::string_view text) {
+    if (text.size() != 4) return std::nullopt;
+    OpcodePattern pattern;
+    for (const char c : text) {
+        pattern.mask <<= 4;
+        pattern.value <<= 4;
+        const std::optional<u32> digit = parse_hex(std::string_view(&c, 1));
+        if (digit) {
+            pattern.mask |= 0xF;
+            pattern.value |= *digit;
+        }
+    }
+    return pattern;
+}
+
+// instruction, pc, opcode and mnemonic, then the registers that differ
+// from before
+void print_record(std::ostream& out, const TraceRecord& record, const TraceRecord& before, const QuirkProfile profile,
+                  const bool registers) {
+    std::ostringstream changes;
+    if (registers) {
+        for (size_t x = 0; x < 16; x++) {
+            if (record.registers[x] != before.registers[x])
+                changes << " V" << std::hex << std::uppercase << x << std::dec << '=' << hex(record.registers[x], 2);
+        }
+        if (record.index != before.index) changes << " I=" << hex(record.index, 3);
+    }
+    out << std::setw(12) << std::setfill(' ') << record.instruction << "  " << hex(record.pc, 3) << "  "
+        << hex(record.opcode, 4) << "  ";
+    if (changes.str().empty()) {
+        out << disassemble(record.opcode, profile) << '\n';
+    } else {
+        out << std::left << std::setw(18) << disassemble(record.opcode, profile) << std::right << changes.str() << '\n';
+    }
+}
+
+bool same(const TraceRecord& a, const TraceRecord& b, const bool registers) {
+    if (a.instruction != b.instruction || a.pc != b.pc || a.opcode != b.opcode) return false;
+    return !registers || (a.index == b.index && a.registers == b.registers);
+}
+
+int dump(TraceReader& reader, const u16 first_pc, const u16 last_pc, const std::optional<OpcodePattern> pattern,
+         const u64 from, const u64 count) {
+    TraceRecord before;
+    u64 printed = 0;
+    while (const std::optional<TraceRecord> record = reader.next()) {
+        if (record->instruction >= from && record->pc >= first_pc && record->pc <= last_pc &&
+            (!pattern || pattern->matches(record->opcode))) {
+            print_record(std::cout, *record, before, reader.profile(), reader.registers());
+            if (count && ++printed == count) break;
+        }
+        before = *record;
+    }
+    return 0;
+}
+
+int diff(TraceReader& a, TraceReader& b) {
+    // only compared when both have them
+    const bool registers = a.registers() && b.registers();
+    // a few instructions leading up to the difference, usually where it
+    // started
+    constexpr size_t context = 8;
+    std::deque<TraceRecord> recent;
+    TraceRecord before;
+    u64 agreed = 0;
+    while (true) {
+        const std::optional<TraceRecord> left = a.next();
+        const std::optional<TraceRecord> right = b.next();
+        if (!left && !right) {
+            std::cout << "traces agree on all " << agreed << " instructions\n";
+            return 0;
+        }
+        if (left && right && same(*left, *right, registers)) {
+            agreed++;
+            recent.push_back(*left);
+            if (recent.size() > context) recent.pop_front();
+            before = *left;
+            continue;
+        }
+
+        std::cout << "traces agree on " << agreed << " instructions, then differ\n";
+        TraceRecord shown;
+        for (const TraceRecord& record : recent) {
+            std::cout << "  ";
+            print_record(std::cout, record, shown, a.profile(), registers);
+            shown = record;
+        }
+        std::cout << "- ";
+        if (left) {
+            print_record(std::cout, *left, before, a.profile(), registers);
+        } else {
+            std::cout << "end of trace\n";
+        }
+        std::cout << "+ ";
+        if (right) {
+            print_record(std::cout, *right, before, b.profile(), registers);
+        } else {
+            std::cout << "end of trace\n";
+        }
+        return 1;
+    }
+}
+
+}
+
+int main(int argc, char** argv) {
+    u16 first_pc = 0;
+    u16 last_pc = 0xFFFF;
+    std::optional<OpcodePattern> pattern;
+    u64 from = 0;
+    u64 count = 0;
+    bool compare = false;
+    std::string trace_path;
+    std::string other_path;
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        auto value = [&](std::string_view option) { return arg.substr(option.size()); };
+
+        if (arg.starts_with("--pc=")) {
+            const std::string_view range = value("--pc=");
+            const size_t dash = range.find('-');
+            const std::optional<u32> first = parse_hex(range.substr(0, dash));
+            const std::optional<u32> last = dash == std::string_view::npos ? first : parse_hex(range.substr(dash + 1));
+            if (!first || !last || *first > *last || *last > 0xFFFF) {
+                std::cout << "Bad address range: " << arg << '\n';
+                print_usage();
+                return 1;
+            }
+            first_pc = *first;
+            last_pc = *last;
+        } else if (arg.starts_with("--opcode=")) {
+            pattern = parse_opcode_pattern(value("--opcode="));
+            if (!pattern) {
+                std::cout << "Bad opcode pattern: " << arg << '\n';
+                print_usage();
+                return 1;
+            }
+        } else if (arg.starts_with("--from=")) {
+            if (!parse_option(value("--from="), from)) return bad_option(arg, print_usage);
+        } else if (arg.starts_with("--count=")) {
+            if (!parse_option(value("--count="), count)) return bad_option(arg, print_usage);
+        } else if (arg == "--diff") {
+            compare = true;
+        } else if (trace_path.empty()) {
+            trace_path = arg;
+        } else if (compare && other_path.empty()) {
+            other_path = arg;
+        } else {
+            std::cout << "Too many arguments passed.\n";
+            print_usage();
+            return 1;
+        }
+    }
+    if (trace_path.empty() || (compare && other_path.empty())) {
+        std::cout << "Too few arguments passed.\n";
+        print_usage();
+        return 1;
+    }
+
+    // bad files are reported rather than thrown, a trace cut short by a
+    // crash still prints everything up to where it ends
+    try {
+        TraceReader reader(trace_path);
+        if (compare) {
+            TraceReader other(other_path);
+            return diff(reader, other);
+        }
+        return dump(reader, first_pc, last_pc, pattern, from, count);
+    } catch (const std::runtime_error& e) {
+        std::cerr << e.what();
+        return 1;
+    }
+}
@@ -0,0 +1,169 @@
+#include "include/tracer.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+u8* put_varint(u8* out, u64 value) {
+    while (value >= 0x80) {
+        *out++ = 0x80 | (value & 0x7F);
+        value >>= 7;
+    }
+    *out++ = value;
+    return out;
+}
+
+u8 get_byte(const std::span<const u8> bytes, size_t& at) {
+    if (at == bytes.size()) throw std::runtime_error("trace is truncated\n");
+    return bytes[at++];
+}
+
+u64 get_varint(const std::span<const u8> bytes, size_t& at) {
+    u64 value = 0;
+    for (size_t shift = 0; shift < 64; shift += 7) {
+        const u8 next = get_byte(bytes, at);
+        value |= static_cast<u64>(next & 0x7F) << shift;
+        if (!(next & 0x80)) return value;
+    }
+    throw std::runtime_error("trace has a bad number\n");
+}
+
+}
+
+// the first record counts as following one numbered -1, so it doesn't need a
+// gap when it's instruction 0
+TraceEncoder::TraceEncoder() : opcodes(0x10000) {
+    previous.instruction = ~u64{0};
+}
+
+u8* TraceEncoder::encode(const TraceRecord& record, u8* out) {
+    // the registers compared 8 at a time, a byte that differs sets that
+    // register's bit. VF has its own tag bit, it changes too often to pay
+    // for the wider mask.
+    u64 now[2];
+    u64 before[2];
+    std::memcpy(now, record.registers.data(), sizeof(now));
+    std::memcpy(before, previous.registers.data(), sizeof(before));
+    u16 changed = 0;
+    for (size_t half = 0; half < 2; half++) {
+        for (u64 diff = now[half] ^ before[half]; diff; diff &= diff - 1) {
+            const int byte = std::countr_zero(diff) / 8;
+            changed |= 1 << (half * 8 + (std::endian::native == std::endian::little ? byte : 7 - byte));
+        }
+    }
+
+    u8 tag = 0;
+    if (record.instruction != previous.instruction + 1) tag |= trace_gap;
+    if (record.pc != static_cast<u16>(previous.pc + 2)) tag |= trace_jump;
+    if (record.opcode != opcodes[record.pc]) tag |= trace_opcode;
+    if (record.index != previous.index) tag |= trace_index;
+    if (changed & 0x7FFF) tag |= trace_registers;
+    if (changed & 0x8000) tag |= trace_flag;
+
+    *out++ = tag;
+    if (tag & trace_gap) out = put_varint(out, record.instruction - previous.instruction);
+    if (tag & trace_jump) out = put_varint(out, record.pc);
+    if (tag & trace_opcode) {
+        *out++ = record.opcode >> 8;
+        *out++ = record.opcode & 0xFF;
+    }
+    if (tag & trace_index) out = put_varint(out, record.index);
+    if (tag & trace_registers) {
+        out = put_varint(out, changed & 0x7FFF);
+        for (u16 rest = changed & 0x7FFF; rest; rest &= rest - 1) {
+            *out++ = record.registers[std::countr_zero(rest)];
+        }
+    }
+    if (tag & trace_flag) *out++ = record.registers[0xF];
+
+    opcodes[record.pc] = record.opcode;
+    previous = record;
+    return out;
+}
+
+TraceDecoder::TraceDecoder() : opcodes(0x10000) {
+    previous.instruction = ~u64{0};
+}
+
+std::optional<TraceRecord> TraceDecoder::decode(const std::span<const u8> bytes, size_t& at) {
+    if (at >= bytes.size()) return std::nullopt;
+    TraceRecord record = previous;
+    const u8 tag = get_byte(bytes, at);
+    record.instruction += tag & trace_gap ? get_varint(bytes, at) : 1;
+    record.pc = tag & trace_jump ? get_varint(bytes, at) : previous.pc + 2;
+    if (tag & trace_opcode) {
+        const u8 high = get_byte(bytes, at);
+        opcodes[record.pc] = high << 8 | get_byte(bytes, at);
+    }
+    record.opcode = opcodes[record.pc];
+    if (tag & trace_index) record.index = get_varint(bytes, at);
+    if (tag & trace_registers) {
+        const u64 changed = get_varint(bytes, at);
+        for (size_t x = 0; x < 15; x++) {
+            if (changed & (1 << x)) record.registers[x] = get_byte(bytes, at);
+        }
+    }
+    if (tag & trace_flag) record.registers[0xF] = get_byte(bytes, at);
+    previous = record;
+    return record;
+}
+
+Tracer::Tracer(const std::string& path, const QuirkProfile profile, const bool registers)
+    : out(path, std::ios::binary), registers(registers),
+      ring(std::make_unique<SpscQueue<TraceRecord, ring_size>>()) {
+    if (!out.good()) throw std::runtime_error("Couldn't create " + path + "\n");
+    out.write(reinterpret_cast<const char*>(magic.data()), magic.size());
+    const u8 header[] = {version, static_cast<u8>(registers ? flag_registers : 0), static_cast<u8>(profile)};
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    flusher = std::thread(&Tracer::flush, this);
+}
+
+Tracer::~Tracer() {
+    stopping.store(true, std::memory_order_release);
+    flusher.join();
+}
+
+void Tracer::flush() {
+    TraceEncoder encoder;
+    std::vector<TraceRecord> records(4096);
+    std::vector<u8> bytes(records.size() * TraceEncoder::max_size);
+    bool reported = false;
+    while (true) {
+        // everything pushed before stopping was set is in the ring by now,
+        // so draining after seeing it loses nothing
+        const bool last = stopping.load(std::memory_order_acquire);
+        size_t count;
+        bool drained = false;
+        while ((count = ring->pop(records)) > 0) {
+            u8* end = bytes.data();
+            for (size_t i = 0; i < count; i++) {
+                end = encoder.encode(records[i], end);
+            }
+            out.write(reinterpret_cast<const char*>(bytes.data()), end - bytes.data());
+            drained = true;
+        }
+        if (!out.good() && !reported) {
+            // keep draining, the machine mustn't end up waiting on a full ring
+            std::cerr << "Couldn't write the trace\n";
+            reported = true;
+        }
+        if (last) break;
+        if (!drained) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    out.flush();
+}
+
+TraceReader::TraceReader(const std::string& path) : file(path, "Trace") {
+    const std::span<const u8> bytes = file.bytes();
+    if (bytes.size() < Tracer::header_size || !std::equal(Tracer::magic.begin(), Tracer::magic.end(), bytes.begin()))
+        throw std::runtime_error(path + " isn't a trace\n");
+    if (bytes[4] != Tracer::version) throw std::runtime_error(path + " is from an unsupported version\n");
+    if (bytes[6] >= quirk_profile_count) throw std::runtime_error(path + " has a bad quirk profile\n");
+    flags = bytes[5];
+    quirks = static_cast<QuirkProfile>(bytes[6]);
+}
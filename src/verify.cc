@@ -0,0 +1,404 @@
+#include "include/verify.h"
+
+#include <algorithm>
+#include <array>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include "include/disassembler.h"
+#include "include/lockstep.h"
+
+struct Verifier::Side {
+    Side(const Chip8& boot, const EngineKind kind, const InputLog* log)
+        : kind(kind), c8(std::make_unique<Chip8>(boot)) {
+        if (log) input.emplace(*log);
+        reset(0, 0);
+    }
+
+    // a fresh engine and runner, after the machine changed under them
+    void reset(const u64 frames, const u64 instructions) {
+        engine = make_engine(kind);
+        runner.emplace(*c8, *engine, input ? &*input : nullptr);
+        runner->frames = frames;
+        runner->instructions = instructions;
+    }
+
+    EngineKind kind;
+    std::unique_ptr<Chip8> c8;
+    std::unique_ptr<Engine> engine;
+    std::optional<ReplayInput> input;
+    std::optional<Runner> runner;
+};
+
+Verifier::Verifier(const Chip8& boot, const EngineKind reference, const EngineKind candidate, const InputLog* log)
+    : reference_side(std::make_unique<Side>(boot, reference, log)),
+      candidate_side(std::make_unique<Side>(boot, candidate, log)) {
+    take(last);
+}
+
+Verifier::~Verifier() = default;
+
+u64 Verifier::frames() const {
+    return reference_side->runner->frames;
+}
+
+u64 Verifier::instructions() const {
+    return reference_side->runner->instructions;
+}
+
+void Verifier::take(Checkpoint& checkpoint) const {
+    // a plain copy, much cheaper than a save state with its RNG as text
+    if (checkpoint.c8) {
+        *checkpoint.c8 = *reference_side->c8;
+    } else {
+        checkpoint.c8 = std::make_unique<Chip8>(*reference_side->c8);
+    }
+    checkpoint.input.reset();
+    if (reference_side->input) checkpoint.input.emplace(*reference_side->input);
+    checkpoint.frames = reference_side->runner->frames;
+    checkpoint.instructions = reference_side->runner->instructions;
+}
+
+void Verifier::restore(const Checkpoint& checkpoint) {
+    for (Side* side : {reference_side.get(), candidate_side.get()}) {
+        *side->c8 = *checkpoint.c8;
+        // fresh engines have nothing cached, but those that follow stores
+        // have to look at all of memory once
+        side->c8->written_pages = 0xFFFF;
+        if (checkpoint.input) side->input.emplace(*checkpoint.input);
+        side->reset(checkpoint.frames, checkpoint.instructions);
+    }
+}
+
+bool Verifier::step(Side& side) {
+    side.runner->cycles_per_frame = cycles_per_frame;
+    return side.runner->run_frame();
+}
+
+u64 Verifier::checkpoint_hash(const Side& side) {
+    const Chip8& c8 = *side.c8;
+    const std::array<u64, 3> parts = {c8.quick_state_hash(), side.runner->instructions,
+                                      c8.trap ? u64(c8.trap->kind) + 1 : 0};
+    return fnv1a(parts.data(), sizeof(parts));
+}
+
+bool Verifier::agree() const {
+    return checkpoint_hash(*reference_side) == checkpoint_hash(*candidate_side);
+}
+
+std::optional<Divergence> Verifier::run(const u64 frames) {
+    u64 since_checkpoint = 0;
+    for (u64 frame = 0; frame < frames; frame++) {
+        const bool reference_going = step(*reference_side);
+        const bool candidate_going = step(*candidate_side);
+        since_checkpoint++;
+        since_last++;
+        const bool going = reference_going && candidate_going;
+        if (going && since_checkpoint < std::max<u64>(interval, 1) && frame + 1 < frames) continue;
+
+        const u64 reference_hash = checkpoint_hash(*reference_side);
+        const u64 candidate_hash = checkpoint_hash(*candidate_side);
+        reference_digest = fnv1a(&reference_hash, sizeof(reference_hash), reference_digest);
+        candidate_digest = fnv1a(&candidate_hash, sizeof(candidate_hash), candidate_digest);
+        if (reference_digest != candidate_digest) return bisect(since_last);
+        since_checkpoint = 0;
+        // copying the machine costs more than hashing it, and bisecting from
+        // further back only costs a few more probes
+        if (since_last >= frames_per_copy) {
+            take(last);
+            since_last = 0;
+        }
+        if (!going) break;
+    }
+    return std::nullopt;
+}
+
+Divergence Verifier::bisect(const u64 frames) {
+    // the last copy agreed and frames later they didn't. keep good
+    // agreeing and bad not, until they're next to each other.
+    u64 good = 0;
+    u64 bad = frames;
+    while (bad - good > 1) {
+        const u64 middle = good + (bad - good) / 2;
+        restore(last);
+        for (u64 frame = 0; frame < middle; frame++) {
+            step(*reference_side);
+            step(*candidate_side);
+        }
+        (agree() ? good : bad) = middle;
+    }
+    restore(last);
+    for (u64 frame = 0; frame < good; frame++) {
+        step(*reference_side);
+        step(*candidate_side);
+    }
+    Checkpoint start;
+    take(start);
+
+    // then the instructions of the frame that went wrong, every probe runs
+    // both engines n instructions into it in one go
+    const auto probe = [&](const u64 n) {
+        restore(start);
+        for (Side* side : {reference_side.get(), candidate_side.get()}) {
+            side->runner->instructions += side->engine->run(*side->c8, n);
+        }
+    };
+    Divergence divergence;
+    divergence.frame = start.frames;
+    probe(cycles_per_frame);
+    if (agree()) {
+        divergence.after_frame = true;
+        good = cycles_per_frame;
+    } else {
+        good = 0;
+        bad = cycles_per_frame;
+        while (bad - good > 1) {
+            const u64 middle = good + (bad - good) / 2;
+            probe(middle);
+            (agree() ? good : bad) = middle;
+        }
+    }
+    probe(good);
+    divergence.before = std::make_unique<Chip8>(*reference_side->c8);
+    divergence.in_frame = reference_side->runner->instructions - start.instructions;
+    divergence.instruction = reference_side->runner->instructions;
+    if (divergence.after_frame) {
+        restore(start);
+        step(*reference_side);
+        step(*candidate_side);
+    } else {
+        probe(bad);
+    }
+    divergence.reference = std::make_unique<Chip8>(*reference_side->c8);
+    divergence.candidate = std::make_unique<Chip8>(*candidate_side->c8);
+
+    // leave both where the search started, a later run() would diverge again
+    restore(last);
+    since_last = 0;
+    return divergence;
+}
+
+// the lockstep engine's lanes next to their interpreter machines, both
+// driven the way Runner drives a machine
+struct LockstepVerifier::Lanes {
+    Lanes(const std::span<const u8> program, const QuirkProfile profile, const size_t count, const u32 first_seed,
+          const InputLog* log)
+        : lockstep(count), log(log), executed(count) {
+        lockstep.set_quirks(profile);
+        lockstep.load_program(program);
+        for (size_t lane = 0; lane < count; lane++) {
+            lockstep.seed(lane, first_seed + lane);
+            auto c8 = std::make_unique<Chip8>();
+            c8->set_quirks(profile);
+            c8->load_program(program);
+            c8->seed(first_seed + lane);
+            machines.push_back(std::move(c8));
+        }
+    }
+
+    // at most budget instructions on every lane and machine
+    void execute(const u64 budget) {
+        instructions += lockstep.run(budget);
+        for (size_t lane = 0; lane < machines.size(); lane++) {
+            executed[lane] += interpreter.run(*machines[lane], budget);
+        }
+    }
+
+    // timers, then the keys due by now, like Runner and ReplayInput
+    void end_frame() {
+        frames++;
+        lockstep.tick_timers();
+        for (auto& c8 : machines) c8->tick_timers();
+        if (!log) return;
+        for (; next_event < log->events.size() && log->events[next_event].time <= frames; next_event++) {
+            const KeyEvent& event = log->events[next_event];
+            for (size_t lane = 0; lane < machines.size(); lane++) {
+                if (event.pressed) {
+                    lockstep.press_key(lane, event.key);
+                    machines[lane]->press_key(event.key);
+                } else {
+                    lockstep.release_key(lane, event.key);
+                    machines[lane]->release_key(event.key);
+                }
+            }
+        }
+    }
+
+    bool ended() const { return log && frames >= log->end; }
+
+    // the lane exported into c8 and compared with its machine
+    bool agrees(const size_t lane, Chip8& c8) const {
+        lockstep.export_lane(lane, c8);
+        const Chip8& machine = *machines[lane];
+        const auto trap = [](const Chip8& c8) { return c8.trap ? int(c8.trap->kind) + 1 : 0; };
+        return c8.quick_state_hash() == machine.quick_state_hash() && trap(c8) == trap(machine);
+    }
+
+    Lockstep lockstep;
+    std::vector<std::unique_ptr<Chip8>> machines;
+    Interpreter interpreter;
+    const InputLog* log;
+    size_t next_event = 0;
+    u64 frames = 0;
+    u64 instructions = 0;
+    // per machine, for reporting where a lane diverged
+    std::vector<u64> executed;
+};
+
+LockstepVerifier::LockstepVerifier(const std::span<const u8> program, const QuirkProfile profile, const size_t lanes,
+                                   const u32 first_seed, const InputLog* log)
+    : program(program), profile(profile), lane_count(lanes), first_seed(first_seed), log(log),
+      lanes(std::make_unique<Lanes>(program, profile, lanes, first_seed, log)) {
+    if (log && log->timebase != Timebase::frame)
+        throw std::runtime_error("Lockstep lanes can only replay input logs timed in frames\n");
+}
+
+LockstepVerifier::~LockstepVerifier() = default;
+
+u64 LockstepVerifier::frames() const {
+    return lanes->frames;
+}
+
+u64 LockstepVerifier::instructions() const {
+    return lanes->instructions;
+}
+
+std::optional<Divergence> LockstepVerifier::run(const u64 frames) {
+    auto c8 = std::make_unique<Chip8>();
+    for (u64 frame = 0; frame < frames && !lanes->ended(); frame++) {
+        lanes->execute(cycles_per_frame);
+        lanes->end_frame();
+        for (size_t lane = 0; lane < lane_count; lane++) {
+            if (!lanes->agrees(lane, *c8)) return locate(lane, lanes->frames - 1);
+            const u64 hash = c8->quick_state_hash();
+            lane_digest = fnv1a(&hash, sizeof(hash), lane_digest);
+        }
+    }
+    return std::nullopt;
+}
+
+Divergence LockstepVerifier::locate(const size_t lane, const u64 frame) const {
+    // lanes can't be copied or rewound, the frames before run again from
+    // boot and the one that went wrong an instruction at a time
+    Lanes replay(program, profile, lane_count, first_seed, log);
+    for (u64 done = 0; done < frame; done++) {
+        replay.execute(cycles_per_frame);
+        replay.end_frame();
+    }
+    const Chip8& machine = *replay.machines[lane];
+    const u64 start = replay.executed[lane];
+    Divergence divergence;
+    divergence.frame = frame;
+    divergence.lane = lane;
+    divergence.after_frame = true;
+    auto candidate = std::make_unique<Chip8>();
+    for (u64 n = 0; n < cycles_per_frame; n++) {
+        auto before = std::make_unique<Chip8>(machine);
+        const u64 instruction = replay.executed[lane];
+        replay.execute(1);
+        if (!replay.agrees(lane, *candidate)) {
+            divergence.after_frame = false;
+            divergence.before = std::move(before);
+            divergence.instruction = instruction;
+            break;
+        }
+    }
+    if (divergence.after_frame) {
+        divergence.before = std::make_unique<Chip8>(machine);
+        divergence.instruction = replay.executed[lane];
+        replay.end_frame();
+        replay.agrees(lane, *candidate);
+    }
+    divergence.in_frame = divergence.instruction - start;
+    divergence.reference = std::make_unique<Chip8>(machine);
+    divergence.candidate = std::move(candidate);
+    return divergence;
+}
+
+namespace {
+
+std::string hex(const unsigned value, const int width) {
+    std::ostringstream out;
+    out << "0x" << std::hex << std::uppercase << std::setw(width) << std::setfill('0') << value;
+    return out.str();
+}
+
+}
+
+void Verifier::print(std::ostream& os, const Divergence& divergence) {
+    const Chip8& before = *divergence.before;
+    const Chip8& reference = *divergence.reference;
+    const Chip8& candidate = *divergence.candidate;
+
+    if (divergence.lane) os << "lockstep lane " << *divergence.lane << " diverged from its interpreter machine\n";
+    os << "engines diverged on instruction " << divergence.instruction << " (frame " << divergence.frame
+       << ", instruction " << divergence.in_frame << " of it, both counted from 0)\n";
+    if (divergence.after_frame) {
+        os << "every instruction agreed, the end of the frame didn't\n";
+    } else {
+        const u16 opcode = before.opcode_at(before.program_counter);
+        os << "first divergent instruction: " << hex(before.program_counter, 3) << "  " << hex(opcode, 4) << "  "
+           << disassemble(opcode, before.quirks()) << '\n';
+    }
+
+    // one row per piece of state, marked where reference and candidate differ
+    os << std::left << std::setw(14) << "" << std::setw(12) << "before" << std::setw(12) << "reference"
+       << "candidate\n";
+    const auto row = [&](const std::string& name, const auto& field, const int width) {
+        const unsigned a = field(before);
+        const unsigned b = field(reference);
+        const unsigned c = field(candidate);
+        os << (b != c ? "* " : "  ") << std::setw(12) << name << std::setw(12) << hex(a, width) << std::setw(12)
+           << hex(b, width) << hex(c, width) << '\n';
+    };
+    row("pc", [](const Chip8& c8) { return c8.program_counter; }, 3);
+    row("I", [](const Chip8& c8) { return c8.index_register; }, 3);
+    row("sp", [](const Chip8& c8) { return c8.stack_pointer; }, 2);
+    for (u8 reg = 0; reg < 16; reg++) {
+        std::ostringstream name;
+        name << 'V' << std::hex << std::uppercase << int(reg);
+        row(name.str(), [reg](const Chip8& c8) { return c8.registers[reg]; }, 2);
+    }
+    // the stack only as deep as any of them went
+    const size_t depth = std::max({before.stack_pointer, reference.stack_pointer, candidate.stack_pointer});
+    for (size_t level = 0; level < std::min(depth, Chip8::stack_depth); level++) {
+        row("stack[" + std::to_string(level) + "]", [level](const Chip8& c8) { return c8.stack[level]; }, 3);
+    }
+    row("delay", [](const Chip8& c8) { return c8.timer_delay; }, 2);
+    row("sound", [](const Chip8& c8) { return c8.sound_delay; }, 2);
+    row("waiting", [](const Chip8& c8) { return c8.keyboard.waiting ? 0x80 | c8.keyboard.wait_register : 0; }, 2);
+    row("trap", [](const Chip8& c8) { return c8.trap ? unsigned(c8.trap->kind) + 1 : 0; }, 2);
+    row("planes", [](const Chip8& c8) { return c8.selected_planes; }, 2);
+    row("hires", [](const Chip8& c8) { return c8.display.hires; }, 2);
+    os << std::right;
+
+    // memory and display only where they differ
+    size_t differences = 0;
+    for (size_t address = 0; address < Chip8::memory_size; address++) {
+        if (reference.memory[address] == candidate.memory[address]) continue;
+        if (differences++ < 16) {
+            os << "* memory " << hex(address, 4) << ": " << hex(before.memory[address], 2) << ' '
+               << hex(reference.memory[address], 2) << ' ' << hex(candidate.memory[address], 2) << '\n';
+        }
+    }
+    if (differences > 16) os << "  and " << differences - 16 << " more bytes of memory\n";
+    u64 rows = 0;
+    for (size_t plane = 0; plane < Framebuffer::plane_count; plane++) {
+        for (size_t y = 0; y < Chip8::hires_height; y++) {
+            if (reference.display.planes[plane][y] != candidate.display.planes[plane][y]) rows |= u64{1} << y;
+        }
+    }
+    if (rows) {
+        os << "* display rows";
+        for (size_t y = 0; y < Chip8::hires_height; y++) {
+            if (rows & (u64{1} << y)) os << ' ' << y;
+        }
+        os << '\n';
+    }
+}
+
+std::ostream& operator<<(std::ostream& os, const Divergence& divergence) {
+    Verifier::print(os, divergence);
+    return os;
+}